@@ -0,0 +1,510 @@
+/*
+ * GPIO Driver Benchmark
+ *
+ * Measures throughput and latency percentiles of every gpio.h call over every available transport,
+ * plus multi-thread and multi-process scaling of the hot path.
+ *
+ * Output is one JSON object per line on stdout, one line per measurement.
+ *
+ * Usage: bench.elf [-t transport] [-n iterations] [-p pin] [-T max_threads] [-P max_procs] [-l label]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "gpio.h"
+#include "gpio_sim.h"
+
+#define BENCH_DRIVER_VERSION "2.0"
+
+#define BENCH_ITERATIONS_DEFAULT 20000UL
+#define BENCH_PIN_DEFAULT 12U
+#define BENCH_THREADS_MAX_DEFAULT 4U
+#define BENCH_PROCS_MAX_DEFAULT 4U
+#define BENCH_THREADS_MAX 64U
+
+typedef struct {
+	const char *name;
+	bool (*init)(void);
+} bench_transport_t;
+
+typedef struct {
+	const char *name;
+	void (*run)(uint32_t n);
+} bench_op_t;
+
+typedef struct {
+	const bench_op_t *op;
+	uint32_t n_iter;
+	uint32_t *samples;
+	pthread_barrier_t *barrier;
+	uint64_t start;
+	uint64_t end;
+} bench_thread_t;
+
+uint8_t bench_pin = BENCH_PIN_DEFAULT;
+uint32_t bench_n_iter = BENCH_ITERATIONS_DEFAULT;
+uint32_t bench_threads_max = BENCH_THREADS_MAX_DEFAULT;
+uint32_t bench_procs_max = BENCH_PROCS_MAX_DEFAULT;
+const char *bench_label = "";
+
+gpio_port_t bench_port;
+gpio_pin_cfg bench_cfg;
+
+uint64_t now_ns(void);
+int cmp_u32(const void *a, const void *b);
+void report(const char *transport, const char *op, uint32_t threads, uint32_t procs, uint32_t *samples, size_t n, uint64_t elapsed_ns);
+void measure(const bench_op_t *op, uint32_t n_iter, uint32_t *samples);
+void run_single(const char *transport, const bench_op_t *op);
+void run_threads(const char *transport, const bench_op_t *op, uint32_t n_threads);
+void run_procs(const bench_transport_t *transport, const bench_op_t *op, uint32_t n_procs);
+void *thread_main(void *arg);
+bool init_ring(void);
+bool init_sim_ring(void);
+
+void op_set_level(uint32_t n) { gpio_set_level(bench_pin, (n & 1u)); }
+void op_get_level(uint32_t n) { gpio_get_level(bench_pin); }
+void op_reset_pin(uint32_t n) { gpio_reset_pin(bench_pin); }
+void op_set_pinmode(uint32_t n) { gpio_set_pinmode(bench_pin, (n & 1u) ? GPIO_PINMODE_OUTPUT : GPIO_PINMODE_INPUT); }
+void op_get_pinmode(uint32_t n) { gpio_get_pinmode(bench_pin); }
+void op_set_pudctrl(uint32_t n) { gpio_set_pudctrl(bench_pin, (n & 1u) ? GPIO_PUDCTRL_PULLUP : GPIO_PUDCTRL_NOPULL); }
+void op_get_pudctrl(uint32_t n) { gpio_get_pudctrl(bench_pin); }
+void op_event_detected(uint32_t n) { gpio_event_detected(bench_pin); }
+void op_enable_redge(uint32_t n) { gpio_enable_redge_detect(bench_pin, (n & 1u)); }
+void op_redge_enabled(uint32_t n) { gpio_redge_detect_is_enabled(bench_pin); }
+void op_enable_fedge(uint32_t n) { gpio_enable_fedge_detect(bench_pin, (n & 1u)); }
+void op_fedge_enabled(uint32_t n) { gpio_fedge_detect_is_enabled(bench_pin); }
+void op_enable_fast_redge(uint32_t n) { gpio_enable_fast_redge_detect(bench_pin, (n & 1u)); }
+void op_fast_redge_enabled(uint32_t n) { gpio_fast_redge_detect_is_enabled(bench_pin); }
+void op_enable_fast_fedge(uint32_t n) { gpio_enable_fast_fedge_detect(bench_pin, (n & 1u)); }
+void op_fast_fedge_enabled(uint32_t n) { gpio_fast_fedge_detect_is_enabled(bench_pin); }
+void op_enable_high(uint32_t n) { gpio_enable_high_detect(bench_pin, (n & 1u)); }
+void op_high_enabled(uint32_t n) { gpio_high_detect_is_enabled(bench_pin); }
+void op_enable_low(uint32_t n) { gpio_enable_low_detect(bench_pin, (n & 1u)); }
+void op_low_enabled(uint32_t n) { gpio_low_detect_is_enabled(bench_pin); }
+void op_port_write(uint32_t n) { gpio_port_write(&bench_port, n); }
+void op_port_read(uint32_t n) { gpio_port_read(&bench_port); }
+void op_write_bankmask(uint32_t n) { gpio_write_bankmask((1u << (bench_pin & 0x1f)), 0u, 0u, 0u); }
+void op_read_banklevel(uint32_t n) { uint32_t level0, level1; gpio_read_banklevel(&level0, &level1); }
+void op_configure(uint32_t n) { gpio_configure(&bench_cfg, 1u); }
+void op_config_generation(uint32_t n) { gpio_get_config_generation(); }
+void op_wait_event(uint32_t n) { gpio_wait_event((1ull << bench_pin), 0u, NULL); }
+
+//Pin is driven as an output, so toggle rate is the set_level rate with alternating levels
+const bench_op_t bench_ops[] = {
+	{"toggle", &op_set_level},
+	{"get_level", &op_get_level},
+	{"reset_pin", &op_reset_pin},
+	{"set_pinmode", &op_set_pinmode},
+	{"get_pinmode", &op_get_pinmode},
+	{"set_pudctrl", &op_set_pudctrl},
+	{"get_pudctrl", &op_get_pudctrl},
+	{"event_detected", &op_event_detected},
+	{"enable_redge_detect", &op_enable_redge},
+	{"redge_detect_is_enabled", &op_redge_enabled},
+	{"enable_fedge_detect", &op_enable_fedge},
+	{"fedge_detect_is_enabled", &op_fedge_enabled},
+	{"enable_fast_redge_detect", &op_enable_fast_redge},
+	{"fast_redge_detect_is_enabled", &op_fast_redge_enabled},
+	{"enable_fast_fedge_detect", &op_enable_fast_fedge},
+	{"fast_fedge_detect_is_enabled", &op_fast_fedge_enabled},
+	{"enable_high_detect", &op_enable_high},
+	{"high_detect_is_enabled", &op_high_enabled},
+	{"enable_low_detect", &op_enable_low},
+	{"low_detect_is_enabled", &op_low_enabled},
+	{"port_write", &op_port_write},
+	{"port_read", &op_port_read},
+	{"write_bankmask", &op_write_bankmask},
+	{"read_banklevel", &op_read_banklevel},
+	{"configure", &op_configure},
+	{"get_config_generation", &op_config_generation},
+	{"wait_event_nowait", &op_wait_event}
+};
+
+#define BENCH_N_OPS (sizeof(bench_ops)/sizeof(bench_op_t))
+
+//Calls measured for thread/process scaling
+const bench_op_t *bench_scaling_ops[] = {&bench_ops[0], &bench_ops[1]};
+
+#define BENCH_N_SCALING_OPS (sizeof(bench_scaling_ops)/sizeof(bench_op_t*))
+
+const bench_transport_t bench_transports[] = {
+	{"procfs", &gpio_init},
+	{"ring", &init_ring},
+	{"sim", &gpio_init_sim},
+	{"sim_ring", &init_sim_ring}
+};
+
+#define BENCH_N_TRANSPORTS (sizeof(bench_transports)/sizeof(bench_transport_t))
+
+int main(int argc, char **argv)
+{
+	const char *transport_name = NULL;
+	size_t n_transport;
+	size_t n_op;
+	uint32_t n_conc;
+	uint8_t port_pins[1];
+	bool ran = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:n:p:T:P:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				transport_name = optarg;
+				break;
+
+			case 'n':
+				bench_n_iter = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'p':
+				bench_pin = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'T':
+				bench_threads_max = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'P':
+				bench_procs_max = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'l':
+				bench_label = optarg;
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-t transport] [-n iterations] [-p pin] [-T max_threads] [-P max_procs] [-l label]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(bench_n_iter == 0u) bench_n_iter = 1u;
+	if(bench_threads_max > BENCH_THREADS_MAX) bench_threads_max = BENCH_THREADS_MAX;
+
+	port_pins[0] = bench_pin;
+	if(!gpio_port_init(&bench_port, port_pins, 1u))
+	{
+		fprintf(stderr, "BENCH: invalid pin %u\n", bench_pin);
+		return 1;
+	}
+
+	bench_cfg.pin = bench_pin;
+	bench_cfg.pinmode = GPIO_PINMODE_OUTPUT;
+	bench_cfg.pudctrl = GPIO_PUDCTRL_NOPULL;
+	bench_cfg.detect = 0u;
+
+	for(n_transport = 0u; n_transport < BENCH_N_TRANSPORTS; n_transport++)
+	{
+		if((transport_name != NULL) && strcmp(transport_name, bench_transports[n_transport].name)) continue;
+
+		if(!bench_transports[n_transport].init())
+		{
+			fprintf(stderr, "BENCH: transport %s not available, skipped\n", bench_transports[n_transport].name);
+			continue;
+		}
+
+		ran = true;
+
+		for(n_op = 0u; n_op < BENCH_N_OPS; n_op++)
+		{
+			gpio_reset_pin(bench_pin);
+			gpio_set_pinmode(bench_pin, GPIO_PINMODE_OUTPUT);
+
+			run_single(bench_transports[n_transport].name, &bench_ops[n_op]);
+		}
+
+		gpio_reset_pin(bench_pin);
+		gpio_set_pinmode(bench_pin, GPIO_PINMODE_OUTPUT);
+
+		for(n_op = 0u; n_op < BENCH_N_SCALING_OPS; n_op++)
+		{
+			for(n_conc = 1u; n_conc <= bench_threads_max; n_conc <<= 1)
+				run_threads(bench_transports[n_transport].name, bench_scaling_ops[n_op], n_conc);
+
+			for(n_conc = 1u; n_conc <= bench_procs_max; n_conc <<= 1)
+				run_procs(&bench_transports[n_transport], bench_scaling_ops[n_op], n_conc);
+		}
+
+		gpio_reset_pin(bench_pin);
+		gpio_deinit();
+	}
+
+	if(!ran)
+	{
+		fprintf(stderr, "BENCH: no transport available\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec)*1000000000ull + ((uint64_t) ts.tv_nsec);
+}
+
+int cmp_u32(const void *a, const void *b)
+{
+	uint32_t va = *((const uint32_t*) a);
+	uint32_t vb = *((const uint32_t*) b);
+
+	if(va < vb) return -1;
+	if(va > vb) return 1;
+	return 0;
+}
+
+//Transports with the command rings on top
+bool init_ring(void)
+{
+	if(!gpio_init()) return false;
+	if(gpio_ring_enable()) return true;
+
+	gpio_deinit();
+	return false;
+}
+
+bool init_sim_ring(void)
+{
+	if(!gpio_init_sim()) return false;
+	if(gpio_ring_enable()) return true;
+
+	gpio_deinit();
+	return false;
+}
+
+void report(const char *transport, const char *op, uint32_t threads, uint32_t procs, uint32_t *samples, size_t n, uint64_t elapsed_ns)
+{
+	double ops_per_sec;
+
+	qsort(samples, n, sizeof(uint32_t), &cmp_u32);
+
+	if(elapsed_ns == 0u) elapsed_ns = 1u;
+	ops_per_sec = ((double) n)*1e9/((double) elapsed_ns);
+
+	printf("{\"bench\":\"gpio\",\"driver\":\"%s\",\"label\":\"%s\",\"transport\":\"%s\",\"op\":\"%s\",\"threads\":%u,\"procs\":%u,\"ops\":%zu,\"ops_per_sec\":%.1f,"
+		"\"lat_ns\":{\"min\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}\n",
+		BENCH_DRIVER_VERSION, bench_label, transport, op, threads, procs, n, ops_per_sec,
+		samples[0], samples[n/2u], samples[(n*90u)/100u], samples[(n*99u)/100u], samples[(n*999u)/1000u], samples[n - 1u]);
+
+	fflush(stdout);
+	return;
+}
+
+void measure(const bench_op_t *op, uint32_t n_iter, uint32_t *samples)
+{
+	uint64_t t0;
+	uint64_t t1;
+	uint32_t n;
+
+	for(n = 0u; n < n_iter; n++)
+	{
+		t0 = now_ns();
+		op->run(n);
+		t1 = now_ns();
+
+		samples[n] = ((t1 - t0) > UINT32_MAX) ? UINT32_MAX : (uint32_t) (t1 - t0);
+	}
+
+	return;
+}
+
+void run_single(const char *transport, const bench_op_t *op)
+{
+	uint32_t *samples = malloc(bench_n_iter*sizeof(uint32_t));
+	uint64_t start;
+	uint64_t elapsed;
+
+	if(samples == NULL) return;
+
+	start = now_ns();
+	measure(op, bench_n_iter, samples);
+	elapsed = now_ns() - start;
+
+	report(transport, op->name, 1u, 1u, samples, bench_n_iter, elapsed);
+
+	free(samples);
+	return;
+}
+
+void *thread_main(void *arg)
+{
+	bench_thread_t *thread = (bench_thread_t*) arg;
+
+	pthread_barrier_wait(thread->barrier);
+
+	thread->start = now_ns();
+	measure(thread->op, thread->n_iter, thread->samples);
+	thread->end = now_ns();
+
+	return NULL;
+}
+
+void run_threads(const char *transport, const bench_op_t *op, uint32_t n_threads)
+{
+	pthread_t tids[BENCH_THREADS_MAX];
+	bench_thread_t threads[BENCH_THREADS_MAX];
+	pthread_barrier_t barrier;
+	uint32_t *samples;
+	uint64_t start;
+	uint64_t end;
+	uint64_t elapsed;
+	uint32_t n;
+
+	samples = malloc(((size_t) n_threads)*bench_n_iter*sizeof(uint32_t));
+	if(samples == NULL) return;
+
+	pthread_barrier_init(&barrier, NULL, n_threads + 1u);
+
+	for(n = 0u; n < n_threads; n++)
+	{
+		threads[n].op = op;
+		threads[n].n_iter = bench_n_iter;
+		threads[n].samples = &samples[((size_t) n)*bench_n_iter];
+		threads[n].barrier = &barrier;
+
+		pthread_create(&tids[n], NULL, &thread_main, &threads[n]);
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	for(n = 0u; n < n_threads; n++) pthread_join(tids[n], NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	//Elapsed time spans from the first worker starting to the last one finishing, thread creation and joins are not counted
+	start = threads[0].start;
+	end = threads[0].end;
+
+	for(n = 1u; n < n_threads; n++)
+	{
+		if(threads[n].start < start) start = threads[n].start;
+		if(threads[n].end > end) end = threads[n].end;
+	}
+
+	elapsed = end - start;
+
+	report(transport, op->name, n_threads, 1u, samples, ((size_t) n_threads)*bench_n_iter, elapsed);
+
+	free(samples);
+	return;
+}
+
+//Children reopen the transport (an inherited descriptor would share one command buffer), wait on a pipe for the start signal,
+//and write their start/end timestamps and samples to a shared anonymous mapping
+void run_procs(const bench_transport_t *transport, const bench_op_t *op, uint32_t n_procs)
+{
+	size_t map_size = ((size_t) n_procs)*(2u*sizeof(uint64_t) + bench_n_iter*sizeof(uint32_t));
+	size_t n_samples;
+	void *map;
+	uint64_t *times;
+	uint32_t *samples;
+	bool failed = false;
+	uint64_t start;
+	uint64_t end;
+	uint64_t elapsed;
+	pid_t pid;
+	int start_pipe[2];
+	int ready_pipe[2];
+	char c;
+	uint32_t n;
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED) return;
+
+	times = (uint64_t*) map;
+	samples = (uint32_t*) &times[2u*n_procs];
+
+	if(pipe(start_pipe) < 0)
+	{
+		munmap(map, map_size);
+		return;
+	}
+
+	if(pipe(ready_pipe) < 0)
+	{
+		close(start_pipe[0]);
+		close(start_pipe[1]);
+		munmap(map, map_size);
+		return;
+	}
+
+	fflush(stdout);
+
+	for(n = 0u; n < n_procs; n++)
+	{
+		pid = fork();
+		if(pid < 0) break;
+
+		if(pid == 0)
+		{
+			close(start_pipe[1]);
+			close(ready_pipe[0]);
+
+			gpio_deinit();
+			if(!transport->init())
+			{
+				write(ready_pipe[1], "f", 1);
+				_exit(1);
+			}
+
+			write(ready_pipe[1], "r", 1);
+			read(start_pipe[0], &c, 1);
+
+			times[2u*n] = now_ns();
+			measure(op, bench_n_iter, &samples[((size_t) n)*bench_n_iter]);
+			times[2u*n + 1u] = now_ns();
+
+			gpio_deinit();
+			_exit(0);
+		}
+	}
+
+	n_procs = n;
+	n_samples = ((size_t) n_procs)*bench_n_iter;
+
+	close(start_pipe[0]);
+	close(ready_pipe[1]);
+
+	for(n = 0u; n < n_procs; n++)
+	{
+		if(read(ready_pipe[0], &c, 1) != 1) c = 'f';
+		if(c != 'r') failed = true;
+	}
+
+	close(start_pipe[1]);
+
+	while(wait(NULL) > 0);
+
+	close(ready_pipe[0]);
+
+	//Elapsed time spans from the first child starting to the last one finishing, fork/exit/wait are not counted
+	start = UINT64_MAX;
+	end = 0u;
+
+	for(n = 0u; n < n_procs; n++)
+	{
+		if(times[2u*n] < start) start = times[2u*n];
+		if(times[2u*n + 1u] > end) end = times[2u*n + 1u];
+	}
+
+	elapsed = (end > start) ? (end - start) : 0u;
+
+	if(failed) fprintf(stderr, "BENCH: transport %s failed to open in a child process, %s x%u skipped\n", transport->name, op->name, n_procs);
+	else if(n_procs) report(transport->name, op->name, 1u, n_procs, samples, n_samples, elapsed);
+
+	munmap(map, map_size);
+	return;
+}
@@ -5,10 +5,20 @@
  * Email: rafaelmsabe@gmail.com
  */
 
+#define _GNU_SOURCE
+
 #include "gpio.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #define __GPIO_PROC_FILE_DIR ("/proc/gpioctrl")
 
@@ -17,6 +27,79 @@
 #define __GPIO_PUDCTRL_MAX 2U
 
 #define __GPIO_DATAIO_SIZE 3UL
+#define __GPIO_DATAIO_SIZE_MAX 256UL
+
+//Commands with a word payload carry it as 32 bit words starting at byte 4
+#define __GPIO_DATAIO_BANKMASK_SIZE 20UL
+#define __GPIO_DATAIO_BANKLEVEL_SIZE 12UL
+
+#define __GPIO_DATAIO_CONFIG_SIZE 96UL
+#define __GPIO_DATAIO_CONFIGURE_SIZE 132UL
+
+#define __GPIO_DATAIO_WAIT_EVENT_SIZE 28UL
+#define __GPIO_DATAIO_SCHEDULE_WRITE_SIZE 28UL
+#define __GPIO_DATAIO_WAIT_CONDITION_SIZE 28UL
+#define __GPIO_DATAIO_POLL_SET_SIZE 32UL
+#define __GPIO_DATAIO_SUBSCRIBE_SIZE 32UL
+#define __GPIO_DATAIO_EVENT_READ_SIZE __GPIO_DATAIO_SIZE_MAX
+
+#define __GPIO_EVENT_READ_RECORD_WORD 5U
+#define __GPIO_EVENT_READ_RECORD_WORDS 4U
+#define __GPIO_EVENT_READ_MAX 14U
+
+#define __GPIO_DATAIO_STATE_SIZE 100UL
+
+#define __GPIO_DATAIO_MOTION_SETUP_SIZE 16UL
+#define __GPIO_DATAIO_MOTION_MOVE_SIZE 20UL
+#define __GPIO_DATAIO_MOTION_START_SIZE 16UL
+#define __GPIO_DATAIO_MOTION_STOP_SIZE 12UL
+#define __GPIO_DATAIO_MOTION_STATUS_SIZE 104UL
+#define __GPIO_MOTION_STATUS_WORD 2U
+#define __GPIO_MOTION_STATUS_WORDS 3U
+
+#define __GPIO_MOTION_FLAG_HOLD 0x1U
+#define __GPIO_MOTION_STOP_RAMP 0x1U
+
+#define __GPIO_BANK1_MASK 0x3fffffU
+
+//Submission/completion rings, same layout as mod/gpio_core.h
+#define __GPIO_RING_MMAP_OFFSET 4096UL
+#define __GPIO_RING_MMAP_SIZE 12288UL
+#define __GPIO_RING_PAGE_WORDS 1024U
+
+#define __GPIO_RING_SQ_HEAD 0U
+#define __GPIO_RING_SQ_TAIL 16U
+#define __GPIO_RING_CQ_HEAD 32U
+#define __GPIO_RING_CQ_TAIL 48U
+#define __GPIO_RING_FLAGS 64U
+
+#define __GPIO_RING_FLAG_NEED_WAKEUP 0x1U
+
+#define __GPIO_RING_ENTRIES 128U
+#define __GPIO_RING_ENTRY_WORDS 8U
+#define __GPIO_RING_ENTRY_PAYLOAD 28UL
+#define __GPIO_RING_ENTRY_TAG 7U
+
+//Completion polls before each further poll yields the CPU (the ring thread may share it)
+#define __GPIO_RING_SPIN_MAX 4096U
+
+#define __GPIO_STATUS_PAGE_SIZE 4096UL
+#define __GPIO_STATUS_GENERATION 0U
+#define __GPIO_STATUS_EVENT_SEQ 1U
+
+#define __GPIO_FSEL_COUNT 6U
+
+#define __GPIO_DETECT_REDGE 0U
+#define __GPIO_DETECT_FEDGE 1U
+#define __GPIO_DETECT_ASYNC_REDGE 2U
+#define __GPIO_DETECT_ASYNC_FEDGE 3U
+#define __GPIO_DETECT_HIGH 4U
+#define __GPIO_DETECT_LOW 5U
+
+#define __GPIO_DETECT_COUNT 6U
+#define __GPIO_DETECT_FLAGS_MAX 0x3fU
+
+#define __GPIO_EVENT_SUBSCRIBED 0xffU
 
 #define __GPIO_CMD_RESET_PIN 0U
 #define __GPIO_CMD_SET_LEVEL 1U
@@ -37,38 +120,448 @@
 #define __GPIO_CMD_GET_ENABLE_HIGHDETECT 16U
 #define __GPIO_CMD_SET_ENABLE_LOWDETECT 17U
 #define __GPIO_CMD_GET_ENABLE_LOWDETECT 18U
+#define __GPIO_CMD_SET_BANKMASK 19U
+#define __GPIO_CMD_GET_BANKLEVEL 20U
+#define __GPIO_CMD_GET_PUDCTRL 21U
+#define __GPIO_CMD_GET_CONFIG 22U
+#define __GPIO_CMD_CONFIGURE 23U
+#define __GPIO_CMD_WAIT_EVENT 24U
+#define __GPIO_CMD_SCHEDULE_WRITE 25U
+#define __GPIO_CMD_SCHEDULE_CANCEL 26U
+#define __GPIO_CMD_WAIT_CONDITION 27U
+#define __GPIO_CMD_RING_ENTER 28U
+#define __GPIO_CMD_POLL_SET 29U
+#define __GPIO_CMD_SUBSCRIBE 30U
+#define __GPIO_CMD_EVENT_READ 31U
+#define __GPIO_CMD_STATE_SAVE 32U
+#define __GPIO_CMD_STATE_RESTORE 33U
+#define __GPIO_CMD_WRITE_BEGIN 34U
+#define __GPIO_CMD_WRITE_COMMIT 35U
+#define __GPIO_CMD_MOTION_SETUP 36U
+#define __GPIO_CMD_MOTION_MOVE 37U
+#define __GPIO_CMD_MOTION_START 38U
+#define __GPIO_CMD_MOTION_STOP 39U
+#define __GPIO_CMD_MOTION_STATUS 40U
 
 #define __GPIO_CMD_KERNEL_RESPONSE 0xff
 
+//Sleeps end early by a spin tail of twice the measured wakeup lateness plus a margin, within these bounds
+#define __GPIO_SLEEP_TAIL_MIN_NS 2000ULL
+#define __GPIO_SLEEP_TAIL_MAX_NS 500000ULL
+#define __GPIO_SLEEP_CALIBRATION_RUNS 16U
+#define __GPIO_SLEEP_CALIBRATION_NS 100000ULL
+#define __GPIO_SLEEP_LATENESS_DEFAULT_NS 50000ULL
+
 int _gpio_proc_fd = -1;
-uint8_t _gpio_data_io[__GPIO_DATAIO_SIZE];
+
+uint8_t _gpio_transport = GPIO_TRANSPORT_NONE;
+
+//Command handler of an in-process backend (GPIO_TRANSPORT_SIM), called instead of the proc file write/read pair
+void (*_gpio_backend_call)(uint8_t *data_io, size_t size) = NULL;
+
+//Ring provider of an in-process backend, called by gpio_ring_enable() instead of mapping the module's rings
+uint32_t *(*_gpio_backend_map_ring)(void) = NULL;
+
+//Rings mapped by gpio_ring_enable(), NULL while commands go through the proc file (or the backend call)
+//Submissions are made under _gpio_call_mutex, one at a time, each waiting for its own completion
+volatile uint32_t *_gpio_ring_map = NULL;
+uint32_t _gpio_ring_tag = 0u;
+
+//Command buffers are per thread, a call is a write/read pair on the shared descriptor made under _gpio_call_mutex
+__thread uint32_t _gpio_data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+#define _gpio_data_io ((uint8_t*) _gpio_data_io32)
+
+pthread_mutex_t _gpio_call_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Blocking commands use a descriptor of their own per thread, so a sleeping thread never holds _gpio_call_mutex
+//The descriptor is reopened after a new gpio_init() and closed when the thread exits
+__thread int _gpio_wait_fd = -1;
+__thread uint32_t _gpio_wait_session = 0u;
+
+pthread_key_t _gpio_wait_key;
+pthread_once_t _gpio_wait_key_once = PTHREAD_ONCE_INIT;
+
+//Incremented by every gpio_init(), invalidates the per thread caches of a previous session
+uint32_t _gpio_session = 0u;
+
+//Read-only status page exported by the module, NULL if it could not be mapped
+const volatile uint32_t *_gpio_status_map = NULL;
+
+//Per thread configuration cache, valid while the module generation counter matches _gpio_cache_generation
+__thread bool _gpio_cache_valid = false;
+__thread uint32_t _gpio_cache_session = 0u;
+__thread uint32_t _gpio_cache_generation = 0u;
+__thread uint32_t _gpio_cache_fsel[__GPIO_FSEL_COUNT];
+__thread uint32_t _gpio_cache_detect[__GPIO_DETECT_COUNT][2];
+__thread uint32_t _gpio_cache_pullup[2];
+__thread uint32_t _gpio_cache_pulldown[2];
+
+//Output log of gpio_record_start(), records are appended under _gpio_record_mutex so each stays whole
+//Writers only take the mutex while _gpio_record_file is set
+FILE *_gpio_record_file = NULL;
+uint64_t _gpio_record_start_ns = 0u;
+pthread_mutex_t _gpio_record_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Average lateness of clock_nanosleep() wakeups (moving average, 1/8 weight per sample)
+//Calibrated once by the first gpio_init() (or backend attach), never from a timed wait; the default holds until then
+uint64_t _gpio_sleep_lateness_ns = __GPIO_SLEEP_LATENESS_DEFAULT_NS;
+pthread_once_t _gpio_sleep_calibration_once = PTHREAD_ONCE_INIT;
+
+void _gpio_sleep_abs(uint64_t abs_ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t) (abs_ns/1000000000ULL);
+	ts.tv_nsec = (long) (abs_ns%1000000000ULL);
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+	return;
+}
+
+void _gpio_sleep_calibrate(void)
+{
+	uint64_t target;
+	uint64_t total = 0u;
+	uint32_t n;
+
+	for(n = 0u; n < __GPIO_SLEEP_CALIBRATION_RUNS; n++)
+	{
+		target = gpio_time_ns() + __GPIO_SLEEP_CALIBRATION_NS;
+		_gpio_sleep_abs(target);
+		total += gpio_time_ns() - target;
+	}
+
+	__atomic_store_n(&_gpio_sleep_lateness_ns, total/__GPIO_SLEEP_CALIBRATION_RUNS, __ATOMIC_RELAXED);
+	return;
+}
+
+//Append an output write due at t_abs_ns to the log, writes due in the past are logged at the current time (taken under the mutex)
+void _gpio_record(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1, uint64_t t_abs_ns)
+{
+	gpio_record_t record;
+	uint64_t now;
+
+	if(__atomic_load_n(&_gpio_record_file, __ATOMIC_RELAXED) == NULL) return;
+
+	pthread_mutex_lock(&_gpio_record_mutex);
+
+	if(_gpio_record_file != NULL)
+	{
+		now = gpio_time_ns();
+		if(t_abs_ns < now) t_abs_ns = now;
+
+		record.time_ns = t_abs_ns - _gpio_record_start_ns;
+		record.set[0] = set0;
+		record.clr[0] = clr0;
+		record.set[1] = (set1 & __GPIO_BANK1_MASK);
+		record.clr[1] = (clr1 & __GPIO_BANK1_MASK);
+
+		fwrite(&record, sizeof(gpio_record_t), 1u, _gpio_record_file);
+	}
+
+	pthread_mutex_unlock(&_gpio_record_mutex);
+	return;
+}
 
 bool gpio_is_active(void)
 {
-	return (_gpio_proc_fd >= 0);
+	return (_gpio_transport != GPIO_TRANSPORT_NONE);
+}
+
+uint8_t gpio_get_transport(void)
+{
+	return _gpio_transport;
+}
+
+//Used by in-process backends (gpio_sim.c) to take the place of the proc file
+bool _gpio_attach_backend(uint8_t transport, void (*call)(uint8_t *data_io, size_t size), const volatile uint32_t *status_page, uint32_t *(*map_ring)(void))
+{
+	if(gpio_is_active()) return false;
+	if(call == NULL) return false;
+
+	_gpio_backend_call = call;
+	_gpio_backend_map_ring = map_ring;
+	_gpio_status_map = status_page;
+	_gpio_transport = transport;
+
+	_gpio_session++;
+
+	pthread_once(&_gpio_sleep_calibration_once, &_gpio_sleep_calibrate);
+	return true;
 }
 
 bool gpio_init(void)
 {
+	void *page;
+
 	if(gpio_is_active()) return true;
 
 	_gpio_proc_fd = open(__GPIO_PROC_FILE_DIR, O_RDWR);
-	return (_gpio_proc_fd >= 0);
+	if(_gpio_proc_fd < 0) return false;
+
+	page = mmap(NULL, __GPIO_STATUS_PAGE_SIZE, PROT_READ, MAP_SHARED, _gpio_proc_fd, 0);
+	if(page != MAP_FAILED) _gpio_status_map = (const volatile uint32_t*) page;
+
+	_gpio_transport = GPIO_TRANSPORT_PROCFS;
+	_gpio_session++;
+
+	pthread_once(&_gpio_sleep_calibration_once, &_gpio_sleep_calibrate);
+	return true;
 }
 
-void _gpio_call_kernel(void)
+void gpio_deinit(void)
 {
-	if(_gpio_proc_fd < 0) return;
+	if(!gpio_is_active()) return;
+
+	gpio_ring_disable();
 
-	write(_gpio_proc_fd, _gpio_data_io, __GPIO_DATAIO_SIZE);
+	if(_gpio_transport == GPIO_TRANSPORT_PROCFS)
+	{
+		if(_gpio_status_map != NULL) munmap((void*) _gpio_status_map, __GPIO_STATUS_PAGE_SIZE);
+
+		close(_gpio_proc_fd);
+		_gpio_proc_fd = -1;
+	}
+
+	_gpio_status_map = NULL;
+	_gpio_backend_call = NULL;
+	_gpio_backend_map_ring = NULL;
+	_gpio_transport = GPIO_TRANSPORT_NONE;
+	return;
+}
+
+//Wake the ring thread, the response is not read back
+void _gpio_ring_enter(void)
+{
+	uint8_t data_io[__GPIO_DATAIO_SIZE] = {__GPIO_CMD_RING_ENTER, 0u, 0u};
+
+	if(_gpio_backend_call != NULL) _gpio_backend_call(data_io, __GPIO_DATAIO_SIZE);
+	else write(_gpio_proc_fd, data_io, __GPIO_DATAIO_SIZE);
+
+	return;
+}
+
+//Submit the command buffer to the ring and spin until its completion is posted, caller holds _gpio_call_mutex
+//The submission ring always has room: every earlier submission has already been completed and consumed
+void _gpio_ring_call(void)
+{
+	volatile uint32_t *psqe;
+	volatile const uint32_t *pcqe;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t n_spin = 0u;
+	uint8_t n_word;
+
+	sq_tail = _gpio_ring_map[__GPIO_RING_SQ_TAIL];
+	psqe = &_gpio_ring_map[__GPIO_RING_PAGE_WORDS + (sq_tail & (__GPIO_RING_ENTRIES - 1u))*__GPIO_RING_ENTRY_WORDS];
+
+	for(n_word = 0u; n_word < (__GPIO_RING_ENTRY_PAYLOAD/4u); n_word++) psqe[n_word] = _gpio_data_io32[n_word];
+	psqe[__GPIO_RING_ENTRY_TAG] = ++_gpio_ring_tag;
+
+	__atomic_store_n(&_gpio_ring_map[__GPIO_RING_SQ_TAIL], sq_tail + 1u, __ATOMIC_RELEASE);
+
+	//Pairs with the ring thread's barrier between setting NEED_WAKEUP and its last look at SQ_TAIL
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(_gpio_ring_map[__GPIO_RING_FLAGS] & __GPIO_RING_FLAG_NEED_WAKEUP) _gpio_ring_enter();
+
+	cq_head = _gpio_ring_map[__GPIO_RING_CQ_HEAD];
+	while(__atomic_load_n(&_gpio_ring_map[__GPIO_RING_CQ_TAIL], __ATOMIC_ACQUIRE) == cq_head)
+		if(++n_spin >= __GPIO_RING_SPIN_MAX) sched_yield();
+
+	pcqe = &_gpio_ring_map[2u*__GPIO_RING_PAGE_WORDS + (cq_head & (__GPIO_RING_ENTRIES - 1u))*__GPIO_RING_ENTRY_WORDS];
+	for(n_word = 0u; n_word < (__GPIO_RING_ENTRY_PAYLOAD/4u); n_word++) _gpio_data_io32[n_word] = pcqe[n_word];
+
+	__atomic_store_n(&_gpio_ring_map[__GPIO_RING_CQ_HEAD], cq_head + 1u, __ATOMIC_RELEASE);
+	return;
+}
+
+void _gpio_call_kernel_size(size_t size)
+{
+	if(_gpio_transport == GPIO_TRANSPORT_NONE) return;
+
+	//Blocking commands never get here, every command fitting in an entry can go through the ring
+	if((_gpio_ring_map != NULL) && (size <= __GPIO_RING_ENTRY_PAYLOAD))
+	{
+		pthread_mutex_lock(&_gpio_call_mutex);
+		_gpio_ring_call();
+		pthread_mutex_unlock(&_gpio_call_mutex);
+		return;
+	}
+
+	if(_gpio_backend_call != NULL)
+	{
+		_gpio_backend_call(_gpio_data_io, size);
+		return;
+	}
+
+	pthread_mutex_lock(&_gpio_call_mutex);
+
+	if(write(_gpio_proc_fd, _gpio_data_io, size) < 0)
+	{
+		pthread_mutex_unlock(&_gpio_call_mutex);
+		return;
+	}
+
+	do{
+		read(_gpio_proc_fd, _gpio_data_io, size);
+	}while(_gpio_data_io[0] != __GPIO_CMD_KERNEL_RESPONSE);
+
+	pthread_mutex_unlock(&_gpio_call_mutex);
+	return;
+}
+
+void _gpio_wait_fd_close(void *value)
+{
+	close((int) (intptr_t) value - 1);
+	return;
+}
+
+void _gpio_wait_key_create(void)
+{
+	pthread_key_create(&_gpio_wait_key, &_gpio_wait_fd_close);
+	return;
+}
+
+//Issue a command that may sleep in the driver
+//If the driver gives up without a response (signal, module unloading) the call reports nothing pending, as if it timed out
+void _gpio_call_kernel_blocking(size_t size)
+{
+	if(_gpio_transport == GPIO_TRANSPORT_NONE) return;
+
+	if(_gpio_backend_call != NULL)
+	{
+		_gpio_backend_call(_gpio_data_io, size);
+		return;
+	}
+
+	if((_gpio_wait_fd < 0) || (_gpio_wait_session != _gpio_session))
+	{
+		pthread_once(&_gpio_wait_key_once, &_gpio_wait_key_create);
+
+		if(_gpio_wait_fd >= 0) close(_gpio_wait_fd);
+
+		_gpio_wait_fd = open(__GPIO_PROC_FILE_DIR, O_RDWR);
+		_gpio_wait_session = _gpio_session;
+
+		pthread_setspecific(_gpio_wait_key, (void*) (intptr_t) (_gpio_wait_fd + 1));
+
+		if(_gpio_wait_fd < 0)
+		{
+			_gpio_data_io32[1] = 0u;
+			_gpio_data_io32[2] = 0u;
+			return;
+		}
+	}
+
+	if(write(_gpio_wait_fd, _gpio_data_io, size) < 0)
+	{
+		_gpio_data_io32[1] = 0u;
+		_gpio_data_io32[2] = 0u;
+		return;
+	}
 
 	do{
-		read(_gpio_proc_fd, _gpio_data_io, __GPIO_DATAIO_SIZE);
+		read(_gpio_wait_fd, _gpio_data_io, size);
 	}while(_gpio_data_io[0] != __GPIO_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 
+bool gpio_ring_enable(void)
+{
+	void *ring;
+
+	if(!gpio_is_active()) return false;
+	if(_gpio_ring_map != NULL) return true;
+
+	if(_gpio_backend_call != NULL)
+	{
+		if(_gpio_backend_map_ring == NULL) return false;
+		ring = (void*) _gpio_backend_map_ring();
+		if(ring == NULL) return false;
+	}
+	else
+	{
+		ring = mmap(NULL, __GPIO_RING_MMAP_SIZE, (PROT_READ | PROT_WRITE), MAP_SHARED, _gpio_proc_fd, __GPIO_RING_MMAP_OFFSET);
+		if(ring == MAP_FAILED) return false;
+	}
+
+	pthread_mutex_lock(&_gpio_call_mutex);
+	_gpio_ring_map = (volatile uint32_t*) ring;
+	pthread_mutex_unlock(&_gpio_call_mutex);
+	return true;
+}
+
+void gpio_ring_disable(void)
+{
+	volatile uint32_t *ring;
+
+	if(_gpio_ring_map == NULL) return;
+
+	pthread_mutex_lock(&_gpio_call_mutex);
+	ring = _gpio_ring_map;
+	_gpio_ring_map = NULL;
+	pthread_mutex_unlock(&_gpio_call_mutex);
+
+	if(_gpio_backend_call == NULL) munmap((void*) ring, __GPIO_RING_MMAP_SIZE);
+	return;
+}
+
+bool gpio_ring_is_enabled(void)
+{
+	return (_gpio_ring_map != NULL);
+}
+
+void _gpio_call_kernel(void)
+{
+	_gpio_call_kernel_size(__GPIO_DATAIO_SIZE);
+	return;
+}
+
+//Refresh the configuration cache if the module reports a configuration change
+//Without the status page every call is a single GET_CONFIG round trip
+void _gpio_cache_sync(void)
+{
+	size_t n_reg;
+	uint8_t detect;
+
+	if(!gpio_is_active()) return;
+
+	if(_gpio_cache_valid && (_gpio_cache_session == _gpio_session) && (_gpio_status_map != NULL))
+		if(_gpio_status_map[__GPIO_STATUS_GENERATION] == _gpio_cache_generation) return;
+
+	_gpio_data_io[0] = __GPIO_CMD_GET_CONFIG;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_CONFIG_SIZE);
+
+	_gpio_cache_generation = _gpio_data_io32[1];
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++) _gpio_cache_fsel[n_reg] = _gpio_data_io32[2u + n_reg];
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		_gpio_cache_detect[detect][0] = _gpio_data_io32[8u + 2u*detect];
+		_gpio_cache_detect[detect][1] = _gpio_data_io32[9u + 2u*detect];
+	}
+
+	_gpio_cache_pullup[0] = _gpio_data_io32[20];
+	_gpio_cache_pullup[1] = _gpio_data_io32[21];
+	_gpio_cache_pulldown[0] = _gpio_data_io32[22];
+	_gpio_cache_pulldown[1] = _gpio_data_io32[23];
+
+	_gpio_cache_session = _gpio_session;
+	_gpio_cache_valid = true;
+	return;
+}
+
+bool _gpio_cache_detect_is_enabled(uint8_t detect, uint8_t pin)
+{
+	if(pin > __GPIO_PIN_MAX) return false;
+
+	_gpio_cache_sync();
+	return (bool) (_gpio_cache_detect[detect][pin >> 5] & (1u << (pin & 0x1f)));
+}
+
 void gpio_reset_pin(uint8_t pin)
 {
 	if(pin > __GPIO_PIN_MAX) return;
@@ -84,6 +577,9 @@ void gpio_set_level(uint8_t pin, bool level)
 {
 	if(pin > __GPIO_PIN_MAX) return;
 
+	if(pin < 32u) _gpio_record((level ? (1u << pin) : 0u), (level ? 0u : (1u << pin)), 0u, 0u, 0u);
+	else _gpio_record(0u, 0u, (level ? (1u << (pin & 0x1f)) : 0u), (level ? 0u : (1u << (pin & 0x1f))), 0u);
+
 	_gpio_data_io[0] = __GPIO_CMD_SET_LEVEL;
 	_gpio_data_io[1] = pin;
 	_gpio_data_io[2] = (uint8_t) level;
@@ -120,11 +616,8 @@ uint8_t gpio_get_pinmode(uint8_t pin)
 {
 	if(pin > __GPIO_PIN_MAX) return 0u;
 
-	_gpio_data_io[0] = __GPIO_CMD_GET_PINMODE;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (_gpio_data_io[2] & 0x7);
+	_gpio_cache_sync();
+	return ((_gpio_cache_fsel[pin/10u] >> (3u*(pin%10u))) & 0x7);
 }
 
 void gpio_set_pudctrl(uint8_t pin, uint8_t pudctrl)
@@ -140,6 +633,28 @@ void gpio_set_pudctrl(uint8_t pin, uint8_t pudctrl)
 	return;
 }
 
+uint8_t gpio_get_pudctrl(uint8_t pin)
+{
+	uint32_t bit_mask;
+
+	if(pin > __GPIO_PIN_MAX) return GPIO_PUDCTRL_NOPULL;
+
+	_gpio_cache_sync();
+
+	bit_mask = (1u << (pin & 0x1f));
+
+	if(_gpio_cache_pullup[pin >> 5] & bit_mask) return GPIO_PUDCTRL_PULLUP;
+	if(_gpio_cache_pulldown[pin >> 5] & bit_mask) return GPIO_PUDCTRL_PULLDOWN;
+
+	return GPIO_PUDCTRL_NOPULL;
+}
+
+uint32_t gpio_get_config_generation(void)
+{
+	_gpio_cache_sync();
+	return _gpio_cache_generation;
+}
+
 bool gpio_event_detected(uint8_t pin)
 {
 	if(pin > __GPIO_PIN_MAX) return false;
@@ -148,9 +663,307 @@ bool gpio_event_detected(uint8_t pin)
 	_gpio_data_io[1] = pin;
 
 	_gpio_call_kernel();
+
+	if(_gpio_data_io[2] == __GPIO_EVENT_SUBSCRIBED)
+	{
+		errno = EBUSY;
+		return false;
+	}
+
 	return (bool) _gpio_data_io[2];
 }
 
+bool gpio_wait_event(uint64_t pin_mask, uint32_t timeout_us, gpio_event_t *pevent)
+{
+	uint64_t pending;
+
+	_gpio_data_io[0] = __GPIO_CMD_WAIT_EVENT;
+	_gpio_data_io32[1] = (uint32_t) pin_mask;
+	_gpio_data_io32[2] = (uint32_t) (pin_mask >> 32);
+	_gpio_data_io32[3] = timeout_us;
+
+	_gpio_call_kernel_blocking(__GPIO_DATAIO_WAIT_EVENT_SIZE);
+
+	pending = ((uint64_t) _gpio_data_io32[1]) | (((uint64_t) _gpio_data_io32[2]) << 32);
+
+	if(pevent != NULL)
+	{
+		pevent->pending = pending;
+		pevent->irq_time_ns = ((uint64_t) _gpio_data_io32[3]) | (((uint64_t) _gpio_data_io32[4]) << 32);
+		pevent->wake_time_ns = ((uint64_t) _gpio_data_io32[5]) | (((uint64_t) _gpio_data_io32[6]) << 32);
+	}
+
+	return (pending != 0u);
+}
+
+bool gpio_wait_condition(uint64_t pin_mask, uint64_t value, uint64_t timeout_ns)
+{
+	_gpio_data_io[0] = __GPIO_CMD_WAIT_CONDITION;
+	_gpio_data_io[2] = 0u;
+	_gpio_data_io32[1] = (uint32_t) pin_mask;
+	_gpio_data_io32[2] = (uint32_t) (pin_mask >> 32);
+	_gpio_data_io32[3] = (uint32_t) value;
+	_gpio_data_io32[4] = (uint32_t) (value >> 32);
+	_gpio_data_io32[5] = (uint32_t) timeout_ns;
+	_gpio_data_io32[6] = (uint32_t) (timeout_ns >> 32);
+
+	_gpio_call_kernel_blocking(__GPIO_DATAIO_WAIT_CONDITION_SIZE);
+	return (bool) _gpio_data_io[2];
+}
+
+void gpio_hybrid_wait_init(gpio_hybrid_wait_t *pwait, uint64_t spin_max_ns, bool auto_tune)
+{
+	if(pwait == NULL) return;
+
+	pwait->spin_max_ns = spin_max_ns;
+	pwait->auto_tune = auto_tune;
+	pwait->spin_budget_ns = spin_max_ns;
+	pwait->gap_avg_ns = 0u;
+	pwait->last_event_ns = 0u;
+	pwait->n_waits = 0u;
+	pwait->n_spin_hits = 0u;
+	pwait->n_blocks = 0u;
+	pwait->n_timeouts = 0u;
+	pwait->spin_total_ns = 0u;
+	return;
+}
+
+//Spinning only pays off when the next event is likely to come within the budget (the cost of a sleep and wakeup is then saved)
+void _gpio_hybrid_wait_tune(gpio_hybrid_wait_t *pwait, uint64_t event_ns)
+{
+	uint64_t gap;
+
+	if(pwait->last_event_ns && (event_ns > pwait->last_event_ns))
+	{
+		gap = event_ns - pwait->last_event_ns;
+
+		if(pwait->gap_avg_ns) pwait->gap_avg_ns = pwait->gap_avg_ns - pwait->gap_avg_ns/8u + gap/8u;
+		else pwait->gap_avg_ns = gap;
+	}
+
+	pwait->last_event_ns = event_ns;
+
+	if(!pwait->auto_tune || !pwait->gap_avg_ns) return;
+
+	if(pwait->gap_avg_ns > pwait->spin_max_ns) pwait->spin_budget_ns = 0u;
+	else if(2u*pwait->gap_avg_ns > pwait->spin_max_ns) pwait->spin_budget_ns = pwait->spin_max_ns;
+	else pwait->spin_budget_ns = 2u*pwait->gap_avg_ns;
+
+	return;
+}
+
+bool gpio_hybrid_wait(gpio_hybrid_wait_t *pwait, uint64_t pin_mask, uint32_t timeout_us, gpio_event_t *pevent)
+{
+	gpio_event_t event;
+	uint64_t start;
+	uint64_t now;
+	uint64_t deadline;
+	uint64_t spin_end;
+	uint32_t seq = 0u;
+	bool found;
+
+	if(pwait == NULL) return false;
+
+	pwait->n_waits++;
+
+	start = gpio_time_ns();
+	deadline = start + 1000u*((uint64_t) timeout_us);
+
+	spin_end = start + pwait->spin_budget_ns;
+	if(spin_end > deadline) spin_end = deadline;
+
+	if(_gpio_status_map != NULL) seq = __atomic_load_n(&_gpio_status_map[__GPIO_STATUS_EVENT_SEQ], __ATOMIC_ACQUIRE);
+
+	found = gpio_wait_event(pin_mask, 0u, &event);
+	now = start;
+
+	//The event counter moves on every interrupt, events of other pins send the spin back to waiting
+	while(!found && (now < spin_end))
+	{
+		if((_gpio_status_map == NULL) || (__atomic_load_n(&_gpio_status_map[__GPIO_STATUS_EVENT_SEQ], __ATOMIC_ACQUIRE) != seq))
+		{
+			if(_gpio_status_map != NULL) seq = __atomic_load_n(&_gpio_status_map[__GPIO_STATUS_EVENT_SEQ], __ATOMIC_ACQUIRE);
+			found = gpio_wait_event(pin_mask, 0u, &event);
+		}
+
+		now = gpio_time_ns();
+	}
+
+	pwait->spin_total_ns += (now - start);
+
+	if(found) pwait->n_spin_hits++;
+	else if(now < deadline)
+	{
+		//The driver looks at the latched events before it sleeps, nothing arriving since the last check is lost
+		pwait->n_blocks++;
+		found = gpio_wait_event(pin_mask, (uint32_t) ((deadline - now + 999u)/1000u), &event);
+	}
+
+	if(!found)
+	{
+		pwait->n_timeouts++;
+		return false;
+	}
+
+	_gpio_hybrid_wait_tune(pwait, event.irq_time_ns);
+
+	if(pevent != NULL) *pevent = event;
+	return true;
+}
+
+//Run a command on a descriptor of gpio_poll_open(), its own proc file or, for in-process backends, the eventfd named in word 7
+//Returns true if a response was received
+bool _gpio_call_descriptor(int fd, uint32_t *data_io32, size_t size)
+{
+	uint8_t *data_io = (uint8_t*) data_io32;
+
+	data_io32[7] = (uint32_t) fd;
+
+	if(_gpio_backend_call != NULL) _gpio_backend_call(data_io, size);
+	else
+	{
+		if(write(fd, data_io, size) < 0) return false;
+		if(read(fd, data_io, size) < 0) return false;
+	}
+
+	return (data_io[0] == __GPIO_CMD_KERNEL_RESPONSE);
+}
+
+//The module polls the proc file a descriptor was opened on, in-process backends signal an eventfd named in word 7
+int gpio_poll_open(void)
+{
+	if(!gpio_is_active()) return -1;
+
+	if(_gpio_backend_call != NULL) return eventfd(0u, EFD_NONBLOCK);
+
+	return open(__GPIO_PROC_FILE_DIR, O_RDWR);
+}
+
+bool gpio_poll_set(int fd, uint64_t event_mask, uint64_t level_mask, uint64_t level_snapshot)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+	uint8_t *data_io = (uint8_t*) data_io32;
+
+	if(fd < 0) return false;
+	if(!gpio_is_active()) return false;
+
+	data_io[0] = __GPIO_CMD_POLL_SET;
+	data_io[1] = 0u;
+	data_io[2] = 0u;
+	data_io32[1] = (uint32_t) event_mask;
+	data_io32[2] = (uint32_t) (event_mask >> 32);
+	data_io32[3] = (uint32_t) level_mask;
+	data_io32[4] = (uint32_t) (level_mask >> 32);
+	data_io32[5] = (uint32_t) level_snapshot;
+	data_io32[6] = (uint32_t) (level_snapshot >> 32);
+
+	if(!_gpio_call_descriptor(fd, data_io32, __GPIO_DATAIO_POLL_SET_SIZE)) return false;
+	return !data_io[2];
+}
+
+void gpio_poll_close(int fd)
+{
+	if(fd < 0) return;
+
+	if(_gpio_backend_call != NULL) gpio_poll_set(fd, 0u, 0u, 0u);
+
+	close(fd);
+	return;
+}
+
+bool gpio_subscribe(gpio_subscriber_t *psub, uint64_t pin_mask)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+	uint8_t *data_io = (uint8_t*) data_io32;
+
+	if(psub == NULL) return false;
+	if(!pin_mask) return false;
+
+	psub->fd = gpio_poll_open();
+	if(psub->fd < 0) return false;
+
+	data_io[0] = __GPIO_CMD_SUBSCRIBE;
+	data_io[1] = 0u;
+	data_io[2] = 0u;
+	data_io32[1] = (uint32_t) pin_mask;
+	data_io32[2] = (uint32_t) (pin_mask >> 32);
+
+	if(_gpio_call_descriptor(psub->fd, data_io32, __GPIO_DATAIO_SUBSCRIBE_SIZE) && !data_io[2]) return true;
+
+	close(psub->fd);
+	psub->fd = -1;
+	return false;
+}
+
+//Chunks after the first are taken without sleeping, while the previous one came back full
+size_t gpio_subscriber_read(gpio_subscriber_t *psub, gpio_event_t *pevents, size_t n_max, uint32_t timeout_us, uint32_t *pn_dropped)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+	uint8_t *data_io = (uint8_t*) data_io32;
+	const uint32_t *precord;
+	uint64_t wake_time;
+	uint32_t n_chunk;
+	uint32_t n_record;
+	size_t n_read = 0u;
+
+	if(pn_dropped != NULL) *pn_dropped = 0u;
+
+	if(psub == NULL) return 0u;
+	if(psub->fd < 0) return 0u;
+	if(pevents == NULL) return 0u;
+
+	while(n_read < n_max)
+	{
+		n_chunk = (n_max - n_read) > __GPIO_EVENT_READ_MAX ? __GPIO_EVENT_READ_MAX : (uint32_t) (n_max - n_read);
+
+		data_io[0] = __GPIO_CMD_EVENT_READ;
+		data_io32[1] = n_chunk;
+		data_io32[2] = n_read ? 0u : timeout_us;
+
+		if(!_gpio_call_descriptor(psub->fd, data_io32, __GPIO_DATAIO_EVENT_READ_SIZE)) break;
+
+		if(pn_dropped != NULL) *pn_dropped += data_io32[2];
+		wake_time = ((uint64_t) data_io32[3]) | (((uint64_t) data_io32[4]) << 32);
+
+		precord = &data_io32[__GPIO_EVENT_READ_RECORD_WORD];
+		for(n_record = 0u; n_record < data_io32[1]; n_record++)
+		{
+			pevents[n_read].pending = ((uint64_t) precord[0]) | (((uint64_t) precord[1]) << 32);
+			pevents[n_read].irq_time_ns = ((uint64_t) precord[2]) | (((uint64_t) precord[3]) << 32);
+			pevents[n_read].wake_time_ns = wake_time;
+
+			precord += __GPIO_EVENT_READ_RECORD_WORDS;
+			n_read++;
+		}
+
+		if(data_io32[1] < n_chunk) break;
+	}
+
+	return n_read;
+}
+
+void gpio_unsubscribe(gpio_subscriber_t *psub)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+	uint8_t *data_io = (uint8_t*) data_io32;
+
+	if(psub == NULL) return;
+	if(psub->fd < 0) return;
+
+	//Closing the module's file drops its queue, in-process backends are told
+	if(_gpio_backend_call != NULL)
+	{
+		data_io[0] = __GPIO_CMD_SUBSCRIBE;
+		data_io32[1] = 0u;
+		data_io32[2] = 0u;
+		_gpio_call_descriptor(psub->fd, data_io32, __GPIO_DATAIO_SUBSCRIBE_SIZE);
+	}
+
+	gpio_poll_close(psub->fd);
+	psub->fd = -1;
+	return;
+}
+
 void gpio_enable_redge_detect(uint8_t pin, bool enable)
 {
 	if(pin > __GPIO_PIN_MAX) return;
@@ -165,13 +978,7 @@ void gpio_enable_redge_detect(uint8_t pin, bool enable)
 
 bool gpio_redge_detect_is_enabled(uint8_t pin)
 {
-	if(pin > __GPIO_PIN_MAX) return false;
-
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_REDGEDETECT;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (bool) _gpio_data_io[2];
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_REDGE, pin);
 }
 
 void gpio_enable_fedge_detect(uint8_t pin, bool enable)
@@ -188,13 +995,7 @@ void gpio_enable_fedge_detect(uint8_t pin, bool enable)
 
 bool gpio_fedge_detect_is_enabled(uint8_t pin)
 {
-	if(pin > __GPIO_PIN_MAX) return false;
-
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_FEDGEDETECT;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (bool) _gpio_data_io[2];
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_FEDGE, pin);
 }
 
 void gpio_enable_fast_redge_detect(uint8_t pin, bool enable)
@@ -211,13 +1012,7 @@ void gpio_enable_fast_redge_detect(uint8_t pin, bool enable)
 
 bool gpio_fast_redge_detect_is_enabled(uint8_t pin)
 {
-	if(pin > __GPIO_PIN_MAX) return false;
-
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_ASYNC_REDGEDETECT;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (bool) _gpio_data_io[2];
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_ASYNC_REDGE, pin);
 }
 
 void gpio_enable_fast_fedge_detect(uint8_t pin, bool enable)
@@ -234,13 +1029,7 @@ void gpio_enable_fast_fedge_detect(uint8_t pin, bool enable)
 
 bool gpio_fast_fedge_detect_is_enabled(uint8_t pin)
 {
-	if(pin > __GPIO_PIN_MAX) return false;
-
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_ASYNC_FEDGEDETECT;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (bool) _gpio_data_io[2];
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_ASYNC_FEDGE, pin);
 }
 
 void gpio_enable_high_detect(uint8_t pin, bool enable)
@@ -257,13 +1046,7 @@ void gpio_enable_high_detect(uint8_t pin, bool enable)
 
 bool gpio_high_detect_is_enabled(uint8_t pin)
 {
-	if(pin > __GPIO_PIN_MAX) return false;
-
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_HIGHDETECT;
-	_gpio_data_io[1] = pin;
-
-	_gpio_call_kernel();
-	return (bool) _gpio_data_io[2];
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_HIGH, pin);
 }
 
 void gpio_enable_low_detect(uint8_t pin, bool enable)
@@ -280,12 +1063,645 @@ void gpio_enable_low_detect(uint8_t pin, bool enable)
 
 bool gpio_low_detect_is_enabled(uint8_t pin)
 {
+	return _gpio_cache_detect_is_enabled(__GPIO_DETECT_LOW, pin);
+}
+
+void gpio_event_loop_init(gpio_event_loop_t *ploop)
+{
+	uint8_t pin;
+
+	if(ploop == NULL) return;
+
+	for(pin = 0u; pin < GPIO_EVENT_LOOP_PINS; pin++)
+	{
+		ploop->callbacks[pin] = NULL;
+		ploop->args[pin] = NULL;
+	}
+
+	ploop->pin_mask = 0u;
+	ploop->priority = 0;
+	ploop->cpu = -1;
+	ploop->lock_memory = false;
+	ploop->running = false;
+	ploop->stop = false;
+	return;
+}
+
+bool gpio_event_loop_add(gpio_event_loop_t *ploop, uint8_t pin, uint8_t detect_flags, gpio_event_callback_t callback, void *arg)
+{
+	uint8_t detect;
+
+	if(ploop == NULL) return false;
 	if(pin > __GPIO_PIN_MAX) return false;
+	if(callback == NULL) return false;
+	if(ploop->running) return false;
 
-	_gpio_data_io[0] = __GPIO_CMD_GET_ENABLE_LOWDETECT;
-	_gpio_data_io[1] = pin;
+	//SET_ENABLE commands of the detectors are two apart, in GPIO_DETECT_* bit order
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		if(!(detect_flags & (1u << detect))) continue;
+
+		_gpio_data_io[0] = __GPIO_CMD_SET_ENABLE_REDGEDETECT + 2u*detect;
+		_gpio_data_io[1] = pin;
+		_gpio_data_io[2] = 1u;
+
+		_gpio_call_kernel();
+	}
+
+	ploop->callbacks[pin] = callback;
+	ploop->args[pin] = arg;
+	ploop->pin_mask |= (1ULL << pin);
+	return true;
+}
+
+bool gpio_event_loop_remove(gpio_event_loop_t *ploop, uint8_t pin)
+{
+	if(ploop == NULL) return false;
+	if(pin > __GPIO_PIN_MAX) return false;
+	if(ploop->running) return false;
+
+	ploop->callbacks[pin] = NULL;
+	ploop->args[pin] = NULL;
+	ploop->pin_mask &= ~(1ULL << pin);
+	return true;
+}
+
+void gpio_event_loop_set_realtime(gpio_event_loop_t *ploop, int priority, int cpu, bool lock_memory)
+{
+	if(ploop == NULL) return;
+
+	ploop->priority = priority;
+	ploop->cpu = cpu;
+	ploop->lock_memory = lock_memory;
+	return;
+}
+
+void *_gpio_event_loop_main(void *arg)
+{
+	gpio_event_loop_t *ploop = (gpio_event_loop_t*) arg;
+	gpio_event_t events[__GPIO_EVENT_READ_MAX];
+	uint64_t pending;
+	size_t n_events;
+	size_t n_event;
+	uint8_t pin;
+
+	while(!ploop->stop)
+	{
+		//Every event queued since the previous wake comes back in this one call
+		n_events = gpio_subscriber_read(&ploop->subscriber, events, __GPIO_EVENT_READ_MAX, GPIO_EVENT_LOOP_POLL_US, NULL);
+
+		for(n_event = 0u; n_event < n_events; n_event++)
+		{
+			pending = events[n_event].pending & ploop->pin_mask;
+			while(pending)
+			{
+				pin = (uint8_t) __builtin_ctzll(pending);
+				pending &= (pending - 1u);
+
+				ploop->callbacks[pin](pin, &events[n_event], ploop->args[pin]);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+bool gpio_event_loop_start(gpio_event_loop_t *ploop)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpuset;
+	int err;
+
+	if(ploop == NULL) return false;
+	if(ploop->running) return false;
+	if(!ploop->pin_mask) return false;
+
+	if(ploop->lock_memory)
+		if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) return false;
+
+	if(!gpio_subscribe(&ploop->subscriber, ploop->pin_mask)) return false;
+
+	pthread_attr_init(&attr);
+
+	if(ploop->priority > 0)
+	{
+		param.sched_priority = ploop->priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	if(ploop->cpu >= 0)
+	{
+		CPU_ZERO(&cpuset);
+		CPU_SET(ploop->cpu, &cpuset);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+	}
+
+	ploop->stop = false;
+
+	//Policy and affinity are set before the thread runs, a refused option fails here instead of in the thread
+	err = pthread_create(&ploop->thread, &attr, &_gpio_event_loop_main, ploop);
+	pthread_attr_destroy(&attr);
+
+	if(err)
+	{
+		gpio_unsubscribe(&ploop->subscriber);
+		return false;
+	}
+
+	ploop->running = true;
+	return true;
+}
+
+void gpio_event_loop_stop(gpio_event_loop_t *ploop)
+{
+	if(ploop == NULL) return;
+	if(!ploop->running) return;
+
+	ploop->stop = true;
+	pthread_join(ploop->thread, NULL);
+
+	gpio_unsubscribe(&ploop->subscriber);
+	ploop->running = false;
+	return;
+}
+
+//The pin list is validated before anything is written, a port that fails to initialize is left as it was
+bool gpio_port_init(gpio_port_t *port, const uint8_t *pins, uint8_t n_pins)
+{
+	uint32_t bank_mask[2] = {0u, 0u};
+	uint32_t bit_mask;
+	uint32_t value;
+	uint8_t bit;
+	uint8_t n_bank;
+
+	if(port == NULL) return false;
+	if(pins == NULL) return false;
+	if(n_pins > GPIO_PORT_MAXPINS) return false;
+
+	for(bit = 0u; bit < n_pins; bit++)
+	{
+		if(pins[bit] > __GPIO_PIN_MAX) return false;
+
+		n_bank = (pins[bit] >> 5);
+		bit_mask = (1u << (pins[bit] & 0x1f));
+
+		if(bank_mask[n_bank] & bit_mask) return false;
+		bank_mask[n_bank] |= bit_mask;
+	}
+
+	for(bit = 0u; bit < n_pins; bit++)
+	{
+		port->pins[bit] = pins[bit];
+		port->bit_bank[bit] = (pins[bit] >> 5);
+		port->bit_mask[bit] = (1u << (pins[bit] & 0x1f));
+	}
+
+	for(value = 0u; value < GPIO_PORT_LUT_SIZE; value++)
+	{
+		port->lut_set[value][0] = 0u;
+		port->lut_set[value][1] = 0u;
+
+		for(bit = 0u; (bit < n_pins) && (bit < GPIO_PORT_LUT_BITS); bit++)
+			if(value & (1u << bit)) port->lut_set[value][port->bit_bank[bit]] |= port->bit_mask[bit];
+	}
+
+	port->bank_mask[0] = bank_mask[0];
+	port->bank_mask[1] = bank_mask[1];
+	port->n_pins = n_pins;
+	return true;
+}
+
+void gpio_port_write(const gpio_port_t *port, uint32_t value)
+{
+	uint32_t set0;
+	uint32_t set1;
+	uint8_t bit;
+
+	if(port == NULL) return;
+
+	set0 = port->lut_set[value & (GPIO_PORT_LUT_SIZE - 1u)][0];
+	set1 = port->lut_set[value & (GPIO_PORT_LUT_SIZE - 1u)][1];
+
+	for(bit = GPIO_PORT_LUT_BITS; bit < port->n_pins; bit++)
+	{
+		if(!(value & (1u << bit))) continue;
+
+		if(port->bit_bank[bit]) set1 |= port->bit_mask[bit];
+		else set0 |= port->bit_mask[bit];
+	}
+
+	gpio_write_bankmask(set0, (port->bank_mask[0] & ~set0), set1, (port->bank_mask[1] & ~set1));
+	return;
+}
+
+uint32_t gpio_port_read(const gpio_port_t *port)
+{
+	uint32_t level[2];
+	uint32_t value = 0u;
+	uint8_t bit;
+
+	if(port == NULL) return 0u;
+
+	gpio_read_banklevel(&level[0], &level[1]);
+
+	for(bit = 0u; bit < port->n_pins; bit++)
+		if(level[port->bit_bank[bit]] & port->bit_mask[bit]) value |= (1u << bit);
+
+	return value;
+}
+
+void gpio_write_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1)
+{
+	_gpio_record(set0, clr0, set1, clr1, 0u);
+
+	_gpio_data_io[0] = __GPIO_CMD_SET_BANKMASK;
+	_gpio_data_io32[1] = set0;
+	_gpio_data_io32[2] = clr0;
+	_gpio_data_io32[3] = (set1 & __GPIO_BANK1_MASK);
+	_gpio_data_io32[4] = (clr1 & __GPIO_BANK1_MASK);
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_BANKMASK_SIZE);
+	return;
+}
+
+void gpio_write_begin(void)
+{
+	_gpio_data_io[0] = __GPIO_CMD_WRITE_BEGIN;
+
+	_gpio_call_kernel();
+	return;
+}
+
+void gpio_write_commit(void)
+{
+	_gpio_data_io[0] = __GPIO_CMD_WRITE_COMMIT;
 
 	_gpio_call_kernel();
+	return;
+}
+
+void gpio_read_banklevel(uint32_t *plevel0, uint32_t *plevel1)
+{
+	_gpio_data_io[0] = __GPIO_CMD_GET_BANKLEVEL;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_BANKLEVEL_SIZE);
+
+	if(plevel0 != NULL) *plevel0 = _gpio_data_io32[1];
+	if(plevel1 != NULL) *plevel1 = _gpio_data_io32[2];
+	return;
+}
+
+bool gpio_configure(const gpio_pin_cfg *cfgs, size_t n)
+{
+	uint32_t *fsel_mask = &_gpio_data_io32[1];
+	uint32_t *fsel_value = &_gpio_data_io32[7];
+	uint32_t *pin_mask = &_gpio_data_io32[13];
+	uint32_t *pud_mask = &_gpio_data_io32[15];
+	uint32_t *detect_value = &_gpio_data_io32[21];
+	size_t n_cfg;
+	size_t n_word;
+	uint8_t n_bank;
+	uint8_t bit_offset;
+	uint8_t detect;
+	uint32_t bit_mask;
+
+	if(cfgs == NULL) return false;
+	if(!gpio_is_active()) return false;
+
+	for(n_cfg = 0u; n_cfg < n; n_cfg++)
+	{
+		if(cfgs[n_cfg].pin > __GPIO_PIN_MAX) return false;
+		if(cfgs[n_cfg].pinmode > __GPIO_PINMODE_MAX) return false;
+		if(cfgs[n_cfg].pudctrl > __GPIO_PUDCTRL_MAX) return false;
+		if(cfgs[n_cfg].detect > __GPIO_DETECT_FLAGS_MAX) return false;
+	}
+
+	for(n_word = 1u; n_word < (__GPIO_DATAIO_CONFIGURE_SIZE/4UL); n_word++) _gpio_data_io32[n_word] = 0u;
+
+	for(n_cfg = 0u; n_cfg < n; n_cfg++)
+	{
+		n_bank = (cfgs[n_cfg].pin >> 5);
+		bit_mask = (1u << (cfgs[n_cfg].pin & 0x1f));
+		bit_offset = 3u*(cfgs[n_cfg].pin%10u);
+
+		fsel_mask[cfgs[n_cfg].pin/10u] |= (0x7 << bit_offset);
+		fsel_value[cfgs[n_cfg].pin/10u] &= ~(0x7 << bit_offset);
+		fsel_value[cfgs[n_cfg].pin/10u] |= (cfgs[n_cfg].pinmode << bit_offset);
+
+		pin_mask[n_bank] |= bit_mask;
+
+		pud_mask[2u*GPIO_PUDCTRL_NOPULL + n_bank] &= ~bit_mask;
+		pud_mask[2u*GPIO_PUDCTRL_PULLUP + n_bank] &= ~bit_mask;
+		pud_mask[2u*GPIO_PUDCTRL_PULLDOWN + n_bank] &= ~bit_mask;
+		pud_mask[2u*cfgs[n_cfg].pudctrl + n_bank] |= bit_mask;
+
+		for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+		{
+			if(cfgs[n_cfg].detect & (1u << detect)) detect_value[2u*detect + n_bank] |= bit_mask;
+			else detect_value[2u*detect + n_bank] &= ~bit_mask;
+		}
+	}
+
+	_gpio_data_io[0] = __GPIO_CMD_CONFIGURE;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_CONFIGURE_SIZE);
+	return true;
+}
+
+bool gpio_state_save(gpio_state_t *pstate)
+{
+	uint32_t *pwords = (uint32_t*) pstate;
+	size_t n_word;
+
+	if(pstate == NULL) return false;
+	if(!gpio_is_active()) return false;
+
+	_gpio_data_io[0] = __GPIO_CMD_STATE_SAVE;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_STATE_SIZE);
+
+	for(n_word = 0u; n_word < (sizeof(gpio_state_t)/4UL); n_word++) pwords[n_word] = _gpio_data_io32[1u + n_word];
+	return true;
+}
+
+bool gpio_state_restore(const gpio_state_t *pstate)
+{
+	const uint32_t *pwords = (const uint32_t*) pstate;
+	size_t n_word;
+
+	if(pstate == NULL) return false;
+	if(!gpio_is_active()) return false;
+
+	for(n_word = 0u; n_word < (sizeof(gpio_state_t)/4UL); n_word++) _gpio_data_io32[1u + n_word] = pwords[n_word];
+	_gpio_data_io[0] = __GPIO_CMD_STATE_RESTORE;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_STATE_SIZE);
+	return true;
+}
+
+//Returns 0 if queued, else the errno value of the failure (ENOSPC: the driver's queue is full)
+//record: log the write if a recording is running (replays do not re-record what they play)
+int _gpio_schedule_write(uint64_t set_mask, uint64_t clr_mask, uint64_t t_abs_ns, bool record)
+{
+	if(!gpio_is_active()) return ENODEV;
+
+	_gpio_data_io[0] = __GPIO_CMD_SCHEDULE_WRITE;
+	_gpio_data_io[2] = 0u;
+	_gpio_data_io32[1] = (uint32_t) set_mask;
+	_gpio_data_io32[2] = (uint32_t) clr_mask;
+	_gpio_data_io32[3] = (uint32_t) (set_mask >> 32);
+	_gpio_data_io32[4] = (uint32_t) (clr_mask >> 32);
+	_gpio_data_io32[5] = (uint32_t) t_abs_ns;
+	_gpio_data_io32[6] = (uint32_t) (t_abs_ns >> 32);
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_SCHEDULE_WRITE_SIZE);
+
+	if(_gpio_data_io[0] != __GPIO_CMD_KERNEL_RESPONSE) return EIO;
+	if(!_gpio_data_io[2]) return (_gpio_data_io32[1] != 0u) ? (int) _gpio_data_io32[1] : EIO;
+
+	if(record) _gpio_record((uint32_t) set_mask, (uint32_t) clr_mask, (uint32_t) (set_mask >> 32), (uint32_t) (clr_mask >> 32), t_abs_ns);
+	return 0;
+}
+
+bool gpio_schedule_write(uint64_t set_mask, uint64_t clr_mask, uint64_t t_abs_ns)
+{
+	return (_gpio_schedule_write(set_mask, clr_mask, t_abs_ns, true) == 0);
+}
+
+void gpio_schedule_cancel(void)
+{
+	_gpio_data_io[0] = __GPIO_CMD_SCHEDULE_CANCEL;
+
+	_gpio_call_kernel();
+	return;
+}
+
+uint64_t gpio_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec)*1000000000ULL + ((uint64_t) ts.tv_nsec);
+}
+
+void gpio_sleep_until(uint64_t abs_ns)
+{
+	uint64_t lateness;
+	uint64_t tail;
+	uint64_t wake_target;
+	uint64_t now;
+
+	lateness = __atomic_load_n(&_gpio_sleep_lateness_ns, __ATOMIC_RELAXED);
+
+	tail = 2u*lateness + __GPIO_SLEEP_TAIL_MIN_NS;
+	if(tail > __GPIO_SLEEP_TAIL_MAX_NS) tail = __GPIO_SLEEP_TAIL_MAX_NS;
+
+	now = gpio_time_ns();
+
+	if((now + tail) < abs_ns)
+	{
+		wake_target = abs_ns - tail;
+		_gpio_sleep_abs(wake_target);
+
+		now = gpio_time_ns();
+		lateness = lateness - lateness/8u + (now - wake_target)/8u;
+		__atomic_store_n(&_gpio_sleep_lateness_ns, lateness, __ATOMIC_RELAXED);
+	}
+
+	while(now < abs_ns) now = gpio_time_ns();
+
+	return;
+}
+
+void gpio_delay_ns(uint64_t time_ns)
+{
+	gpio_sleep_until(gpio_time_ns() + time_ns);
+	return;
+}
+
+bool gpio_motion_setup(uint8_t axis, uint8_t step_pin, uint8_t dir_pin, uint32_t pulse_ns)
+{
+	if(axis >= GPIO_MOTION_AXES) return false;
+
+	_gpio_data_io[0] = __GPIO_CMD_MOTION_SETUP;
+	_gpio_data_io[1] = axis;
+	_gpio_data_io[2] = 0u;
+	_gpio_data_io32[1] = step_pin;
+	_gpio_data_io32[2] = dir_pin;
+	_gpio_data_io32[3] = pulse_ns;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_MOTION_SETUP_SIZE);
 	return (bool) _gpio_data_io[2];
 }
 
+bool gpio_motion_move(uint8_t axis, int32_t steps, uint32_t max_rate, uint32_t accel, bool hold)
+{
+	if(axis >= GPIO_MOTION_AXES) return false;
+
+	_gpio_data_io[0] = __GPIO_CMD_MOTION_MOVE;
+	_gpio_data_io[1] = axis;
+	_gpio_data_io[2] = 0u;
+	_gpio_data_io32[1] = (uint32_t) steps;
+	_gpio_data_io32[2] = max_rate;
+	_gpio_data_io32[3] = accel;
+	_gpio_data_io32[4] = hold ? __GPIO_MOTION_FLAG_HOLD : 0u;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_MOTION_MOVE_SIZE);
+	return (bool) _gpio_data_io[2];
+}
+
+void gpio_motion_start(uint32_t axis_mask, uint64_t t_abs_ns)
+{
+	_gpio_data_io[0] = __GPIO_CMD_MOTION_START;
+	_gpio_data_io32[1] = axis_mask;
+	_gpio_data_io32[2] = (uint32_t) t_abs_ns;
+	_gpio_data_io32[3] = (uint32_t) (t_abs_ns >> 32);
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_MOTION_START_SIZE);
+	return;
+}
+
+void gpio_motion_stop(uint32_t axis_mask, bool ramp_down)
+{
+	_gpio_data_io[0] = __GPIO_CMD_MOTION_STOP;
+	_gpio_data_io32[1] = axis_mask;
+	_gpio_data_io32[2] = ramp_down ? __GPIO_MOTION_STOP_RAMP : 0u;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_MOTION_STOP_SIZE);
+	return;
+}
+
+void gpio_motion_status(gpio_motion_status_t *pstatus)
+{
+	const uint32_t *pwords;
+	uint8_t axis;
+
+	if(pstatus == NULL) return;
+
+	_gpio_data_io[0] = __GPIO_CMD_MOTION_STATUS;
+
+	_gpio_call_kernel_size(__GPIO_DATAIO_MOTION_STATUS_SIZE);
+
+	pstatus->running_mask = _gpio_data_io32[1];
+
+	for(axis = 0u; axis < GPIO_MOTION_AXES; axis++)
+	{
+		pwords = &_gpio_data_io32[__GPIO_MOTION_STATUS_WORD + __GPIO_MOTION_STATUS_WORDS*axis];
+
+		pstatus->position[axis] = (int32_t) pwords[0];
+		pstatus->steps_left[axis] = pwords[1];
+		pstatus->queued[axis] = pwords[2];
+	}
+
+	return;
+}
+
+bool gpio_record_start(const char *path)
+{
+	FILE *pfile;
+
+	if(path == NULL) return false;
+
+	pthread_mutex_lock(&_gpio_record_mutex);
+
+	if(_gpio_record_file != NULL)
+	{
+		pthread_mutex_unlock(&_gpio_record_mutex);
+		return false;
+	}
+
+	pfile = fopen(path, "wb");
+	if(pfile == NULL)
+	{
+		pthread_mutex_unlock(&_gpio_record_mutex);
+		return false;
+	}
+
+	fwrite(GPIO_RECORD_MAGIC, 1u, 8u, pfile);
+
+	_gpio_record_start_ns = gpio_time_ns();
+	__atomic_store_n(&_gpio_record_file, pfile, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&_gpio_record_mutex);
+	return true;
+}
+
+void gpio_record_stop(void)
+{
+	pthread_mutex_lock(&_gpio_record_mutex);
+
+	if(_gpio_record_file != NULL)
+	{
+		fclose(_gpio_record_file);
+		__atomic_store_n(&_gpio_record_file, NULL, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&_gpio_record_mutex);
+	return;
+}
+
+//Writes are queued in log order, each no earlier than GPIO_REPLAY_LEAD_NS before it is due, so the driver queue holds a bounded window
+//A full queue is retried once some of it went out
+bool gpio_replay(const char *path, uint64_t t_start_ns)
+{
+	gpio_record_t records[GPIO_REPLAY_CHUNK];
+	char magic[8];
+	FILE *pfile;
+	size_t n_read;
+	size_t n_rec;
+	uint64_t set_mask;
+	uint64_t clr_mask;
+	uint64_t t_abs;
+	int n_err;
+
+	if(path == NULL)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	if(!gpio_is_active())
+	{
+		errno = ENODEV;
+		return false;
+	}
+
+	pfile = fopen(path, "rb");
+	if(pfile == NULL) return false;
+
+	if((fread(magic, 1u, 8u, pfile) != 8u) || memcmp(magic, GPIO_RECORD_MAGIC, 8u))
+	{
+		fclose(pfile);
+		errno = EINVAL;
+		return false;
+	}
+
+	if(!t_start_ns) t_start_ns = gpio_time_ns();
+
+	while((n_read = fread(records, sizeof(gpio_record_t), GPIO_REPLAY_CHUNK, pfile)) > 0u)
+	{
+		for(n_rec = 0u; n_rec < n_read; n_rec++)
+		{
+			t_abs = t_start_ns + records[n_rec].time_ns;
+			set_mask = ((uint64_t) records[n_rec].set[1] << 32) | records[n_rec].set[0];
+			clr_mask = ((uint64_t) records[n_rec].clr[1] << 32) | records[n_rec].clr[0];
+
+			if(t_abs > GPIO_REPLAY_LEAD_NS) _gpio_sleep_abs(t_abs - GPIO_REPLAY_LEAD_NS);
+
+			//A full queue drains as the timer applies writes, anything else will not get better by waiting
+			while((n_err = _gpio_schedule_write(set_mask, clr_mask, t_abs, false)) == ENOSPC) _gpio_sleep_abs(gpio_time_ns() + GPIO_REPLAY_LEAD_NS/8u);
+
+			if(n_err)
+			{
+				fclose(pfile);
+				errno = n_err;
+				return false;
+			}
+		}
+	}
+
+	fclose(pfile);
+	return true;
+}
@@ -11,6 +11,11 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define GPIO_PINMODE_INPUT 0U
 #define GPIO_PINMODE_OUTPUT 1U
@@ -25,7 +30,126 @@
 #define GPIO_PUDCTRL_PULLUP 2U
 #define GPIO_PUDCTRL_PULLDOWN 1U
 
-//Returns true if gpio_init() has already been succesfully called, false else
+#define GPIO_DETECT_REDGE 0x01U
+#define GPIO_DETECT_FEDGE 0x02U
+#define GPIO_DETECT_FAST_REDGE 0x04U
+#define GPIO_DETECT_FAST_FEDGE 0x08U
+#define GPIO_DETECT_HIGH 0x10U
+#define GPIO_DETECT_LOW 0x20U
+
+//Where library commands are executed
+#define GPIO_TRANSPORT_NONE 0U
+#define GPIO_TRANSPORT_PROCFS 1U
+#define GPIO_TRANSPORT_SIM 2U
+
+//Events returned by gpio_wait_event(), times are CLOCK_MONOTONIC nanoseconds
+typedef struct {
+	uint64_t pending; //bit n set if an event was detected on pin n
+	uint64_t irq_time_ns; //when the interrupt latched the earliest of them
+	uint64_t wake_time_ns; //when the waiting thread was woken in the driver
+} gpio_event_t;
+
+//Full configuration of a single pin, see gpio_configure()
+typedef struct {
+	uint8_t pin;
+	uint8_t pinmode;
+	uint8_t pudctrl;
+	uint8_t detect; //GPIO_DETECT_* flags, detectors not listed are disabled
+} gpio_pin_cfg;
+
+//Whole-register snapshot of the pin configuration, see gpio_state_save()
+//Written to a file it is also a boot profile for the module (profile_fw=, or its 24 words as profile=)
+typedef struct {
+	uint32_t fsel[6]; //FSEL0-5
+	uint32_t level[2]; //pin levels, bank 0 and 1
+	uint32_t pullup[2];
+	uint32_t pulldown[2];
+	uint32_t detect[6][2]; //detect enables, in the order of the GPIO_DETECT_* flags
+} gpio_state_t;
+
+//Output log written by gpio_record_start(): the 8 bytes of GPIO_RECORD_MAGIC, then one gpio_record_t per output write
+#define GPIO_RECORD_MAGIC "GPIOREC1"
+
+typedef struct {
+	uint64_t time_ns; //since gpio_record_start()
+	uint32_t set[2]; //OUTPUTx_SET masks, bank 0 and 1
+	uint32_t clr[2]; //OUTPUTx_CLR masks
+} gpio_record_t;
+
+//gpio_replay() reads the log GPIO_REPLAY_CHUNK records at a time and queues writes at most GPIO_REPLAY_LEAD_NS ahead
+#define GPIO_REPLAY_CHUNK 64U
+#define GPIO_REPLAY_LEAD_NS 20000000ULL
+
+#define GPIO_MOTION_AXES 8U
+
+//Steps/s the driver runs over all axes, see gpio_motion_move()
+#define GPIO_MOTION_RATE_TOTAL_MAX 40000U
+
+//Stepper axes state, see gpio_motion_status()
+typedef struct {
+	uint32_t running_mask; //bit n set while axis n runs a move or holds one for gpio_motion_start()
+	int32_t position[GPIO_MOTION_AXES]; //steps since gpio_motion_setup(), counted on the rising edge
+	uint32_t steps_left[GPIO_MOTION_AXES]; //of the current move
+	uint32_t queued[GPIO_MOTION_AXES]; //moves waiting behind it
+} gpio_motion_status_t;
+
+#define GPIO_PORT_MAXPINS 32U
+#define GPIO_PORT_LUT_BITS 8U
+#define GPIO_PORT_LUT_SIZE (1U << GPIO_PORT_LUT_BITS)
+
+//Group of pins read/written as a single value (bit n of the value maps to pins[n])
+//Scatter/gather masks are precomputed by gpio_port_init(), values up to 8 bits are looked up in a table
+typedef struct {
+	uint8_t n_pins;
+	uint8_t pins[GPIO_PORT_MAXPINS];
+	uint8_t bit_bank[GPIO_PORT_MAXPINS];
+	uint32_t bit_mask[GPIO_PORT_MAXPINS];
+	uint32_t bank_mask[2];
+	uint32_t lut_set[GPIO_PORT_LUT_SIZE][2];
+} gpio_port_t;
+
+//Subscription to the events of a set of pins, see gpio_subscribe()
+typedef struct {
+	int fd; //may be polled (poll, epoll, select), readable while events are queued
+} gpio_subscriber_t;
+
+#define GPIO_EVENT_LOOP_PINS 54U
+#define GPIO_EVENT_LOOP_POLL_US 100000U
+
+//Called from the event loop thread with the pin and its event (pevent->pending holds every pin of the same interrupt)
+typedef void (*gpio_event_callback_t)(uint8_t pin, const gpio_event_t *pevent, void *arg);
+
+//Per-pin event callbacks run by a dedicated thread, see gpio_event_loop_init()
+//Fields are managed by the gpio_event_loop_* functions
+typedef struct {
+	gpio_event_callback_t callbacks[GPIO_EVENT_LOOP_PINS];
+	void *args[GPIO_EVENT_LOOP_PINS];
+	uint64_t pin_mask;
+	gpio_subscriber_t subscriber;
+	int priority;
+	int cpu;
+	bool lock_memory;
+	bool running;
+	volatile bool stop;
+	pthread_t thread;
+} gpio_event_loop_t;
+
+//Spin-then-block waiter, see gpio_hybrid_wait()
+//Stats are cumulative since gpio_hybrid_wait_init(), read them to trade CPU time against wakeup latency
+typedef struct {
+	uint64_t spin_max_ns; //spin budget, or its upper bound when auto tuned
+	bool auto_tune; //size the budget from the recent gaps between events
+	uint64_t spin_budget_ns; //budget of the next wait
+	uint64_t gap_avg_ns; //moving average of the gaps between returned events (1/8 weight per sample)
+	uint64_t last_event_ns;
+	uint64_t n_waits;
+	uint64_t n_spin_hits; //events found without sleeping
+	uint64_t n_blocks; //waits that went to sleep in the driver
+	uint64_t n_timeouts;
+	uint64_t spin_total_ns; //time spent spinning
+} gpio_hybrid_wait_t;
+
+//Returns true if gpio_init() (or gpio_init_sim()) has already been succesfully called, false else
 bool gpio_is_active(void);
 
 //Must be called before calling any other function
@@ -33,6 +157,23 @@ bool gpio_is_active(void);
 //Returns true if successful or already initialized, false else
 bool gpio_init(void);
 
+//Closes the GPIO Interface, gpio_init() may be called again afterwards
+void gpio_deinit(void);
+
+//Returns the active transport (GPIO_TRANSPORT_NONE if not initialized)
+//gpio_init() uses the kernel module, gpio_init_sim() (gpio_sim.h) the register simulator
+uint8_t gpio_get_transport(void);
+
+//Issue commands through submission/completion rings shared with the driver instead of a write/read pair per command
+//A kernel thread executes the submissions (module parameters ring_cpu, ring_idle_us); while it polls, a command costs no syscall
+//Blocking and configuration commands keep using the proc file; call these while no other thread uses the library
+//Returns true if the rings are in use, false if the driver does not provide them
+bool gpio_ring_enable(void);
+void gpio_ring_disable(void);
+bool gpio_ring_is_enabled(void);
+
+//All calls may be made from several threads, commands are serialized on the shared descriptor
+
 void gpio_reset_pin(uint8_t pin);
 
 //Set/Get the digital level on a GPIO pin (pin must be configured as output to set a level)
@@ -43,14 +184,71 @@ bool gpio_get_level(uint8_t pin);
 void gpio_set_pinmode(uint8_t pin, uint8_t pinmode);
 uint8_t gpio_get_pinmode(uint8_t pin);
 
-//Set the Pull Up/Down control
+//Set/Get the Pull Up/Down control
+//The hardware cannot report pulls, gpio_get_pudctrl() returns the last value set through the driver
 void gpio_set_pudctrl(uint8_t pin, uint8_t pudctrl);
+uint8_t gpio_get_pudctrl(uint8_t pin);
+
+//Configuration getters (pinmode, pull, *_is_enabled) are served from a library cache
+//The cache is revalidated against a module generation counter read from a shared page, without a syscall
+//Returns the generation counter, which changes on every configuration change by any process
+uint32_t gpio_get_config_generation(void);
 
 //Check if an event has occurred on a given pin
 //Returns true if event occurred, false else
 //The pin must have event detection enabled (rising edge detect, low detect, etc...)
+//Events of a pin subscribed with gpio_subscribe() go to the subscribers: returns false with errno set to EBUSY
 bool gpio_event_detected(uint8_t pin);
 
+//Sleep until an event is detected on one of the pins in pin_mask (bit n = pin n), or timeout_us elapses (0: do not sleep)
+//Events are taken from the driver's interrupt path, the call never spins; pins need event detection enabled
+//Returned events are consumed, as with gpio_event_detected(), pevent may be NULL
+//Returns true if events were returned, false on timeout (or if a signal or the driver unloading ended the wait)
+bool gpio_wait_event(uint64_t pin_mask, uint32_t timeout_us, gpio_event_t *pevent);
+
+//Sleep until the input levels of the pins in pin_mask equal the matching bits of value, or timeout_ns elapses (0: do not sleep, UINT64_MAX: no timeout)
+//Returns at once if the condition already holds; the driver arms level detection on the pins still mismatched, so no change is missed
+//Detection enables set with the functions below are left as they are
+//Returns true if the condition holds, false on timeout (or if a signal or the driver unloading ended the wait)
+bool gpio_wait_condition(uint64_t pin_mask, uint64_t value, uint64_t timeout_ns);
+
+//Set up a hybrid waiter: fixed spin budget of spin_max_ns, or with auto_tune a budget of twice the average gap between events,
+//capped at spin_max_ns, and no spinning while events come further apart than that
+void gpio_hybrid_wait_init(gpio_hybrid_wait_t *pwait, uint64_t spin_max_ns, bool auto_tune);
+
+//Same as gpio_wait_event(), but spins for the waiter's budget before sleeping in the driver
+//The spin polls the event counter of the module's status page (one kernel call per interrupt, none in between),
+//or, without the status page, takes events with non-blocking calls; the whole wait is bounded by timeout_us
+bool gpio_hybrid_wait(gpio_hybrid_wait_t *pwait, uint64_t pin_mask, uint32_t timeout_us, gpio_event_t *pevent);
+
+//Descriptor for event loops multiplexing GPIO with other sources (poll, epoll, select), close it with gpio_poll_close()
+//After gpio_poll_set() it signals POLLIN while events are pending on event_mask (take them with gpio_wait_event(), timeout 0)
+//and POLLPRI while the input level of a pin of level_mask differs from its bit in level_snapshot (pass the levels last seen)
+//Detection of the opposite level is armed on the watched pins, as in gpio_wait_condition(); on the simulator both show as POLLIN
+//Readiness may be spurious: after each wakeup re-check, then call gpio_poll_set() with the new state before waiting again
+//Returns the descriptor, -1 on failure
+int gpio_poll_open(void);
+
+//Returns true if successful, false else
+bool gpio_poll_set(int fd, uint64_t event_mask, uint64_t level_mask, uint64_t level_snapshot);
+
+void gpio_poll_close(int fd);
+
+//Subscribe to the events of the pins in pin_mask (bit n = pin n): the driver's interrupt path queues them for this subscriber,
+//one entry per interrupt with its time, and every subscriber of a pin gets each of its events
+//Events of subscribed pins no longer reach gpio_event_detected()/gpio_wait_event(), so processes sharing inputs do not take
+//events from each other; pins need event detection enabled
+//Returns true if successful, false if the driver has no free subscriber slot (32)
+bool gpio_subscribe(gpio_subscriber_t *psub, uint64_t pin_mask);
+
+//Take up to n_max queued events, oldest first, sleeping up to timeout_us for the first one (0: do not sleep)
+//pending holds the subscribed pins of one interrupt, wake_time_ns is when the call returned from the driver
+//*pn_dropped (may be NULL) takes the number of events lost to a full queue (256 entries) since the last read
+//Returns the number of events taken
+size_t gpio_subscriber_read(gpio_subscriber_t *psub, gpio_event_t *pevents, size_t n_max, uint32_t timeout_us, uint32_t *pn_dropped);
+
+void gpio_unsubscribe(gpio_subscriber_t *psub);
+
 //Enable rising edge event detection on a specific pin
 void gpio_enable_redge_detect(uint8_t pin, bool enable);
 bool gpio_redge_detect_is_enabled(uint8_t pin);
@@ -75,5 +273,116 @@ bool gpio_high_detect_is_enabled(uint8_t pin);
 void gpio_enable_low_detect(uint8_t pin, bool enable);
 bool gpio_low_detect_is_enabled(uint8_t pin);
 
+//Event loop: one thread subscribes to every registered pin (gpio_subscribe()), takes all events queued by a wake in one call
+//and calls their callbacks, in event then pin order, before sleeping again; callbacks should return quickly and may call the library
+void gpio_event_loop_init(gpio_event_loop_t *ploop);
+
+//Register a callback for pin and enable the detectors in detect_flags (GPIO_DETECT_* flags, others are left as they are)
+//Returns true if successful, false if the pin is invalid or the loop is running
+bool gpio_event_loop_add(gpio_event_loop_t *ploop, uint8_t pin, uint8_t detect_flags, gpio_event_callback_t callback, void *arg);
+
+//Unregister pin, its detectors are left enabled; returns false if the loop is running
+bool gpio_event_loop_remove(gpio_event_loop_t *ploop, uint8_t pin);
+
+//Options applied by gpio_event_loop_start(): SCHED_FIFO priority (0: inherit the caller's policy),
+//CPU the thread is pinned to (-1: any), lock_memory: mlockall() the process so callbacks take no page faults
+void gpio_event_loop_set_realtime(gpio_event_loop_t *ploop, int priority, int cpu, bool lock_memory);
+
+//Returns true if the thread was started, false if no pin is registered, the loop is already running, the subscription failed
+//or an option was refused (SCHED_FIFO and mlockall() need privileges, see RLIMIT_RTPRIO and RLIMIT_MEMLOCK)
+bool gpio_event_loop_start(gpio_event_loop_t *ploop);
+
+//Stop the thread and wait for it, returns within GPIO_EVENT_LOOP_POLL_US; must not be called from a callback
+void gpio_event_loop_stop(gpio_event_loop_t *ploop);
+
+//Build a port from a list of pins (up to GPIO_PORT_MAXPINS, no duplicates)
+//Returns true if successful, false else
+bool gpio_port_init(gpio_port_t *port, const uint8_t *pins, uint8_t n_pins);
+
+//Write/Read all pins of a port in a single kernel call (pins must be configured as outputs to write)
+void gpio_port_write(const gpio_port_t *port, uint32_t value);
+uint32_t gpio_port_read(const gpio_port_t *port);
+
+//Configure several pins in a single kernel call
+//Each affected FSEL and detect enable register is written once, pins sharing a pull value share one PUD sequence
+//If a pin is listed more than once, its last entry wins
+//Returns true if successful, false if any entry is invalid or the library is not initialized (nothing is applied in that case)
+bool gpio_configure(const gpio_pin_cfg *cfgs, size_t n);
+
+//Capture/reapply pin modes, output levels, pulls and detect enables of all pins in a single kernel call each
+//Restore writes the saved levels of output pins before switching pin modes, pulls are resequenced only where they differ
+//Returns true if successful, false if pstate is NULL or the library is not initialized
+bool gpio_state_save(gpio_state_t *pstate);
+bool gpio_state_restore(const gpio_state_t *pstate);
+
+//Write OUTPUTx_SET/OUTPUTx_CLR masks of both banks in a single kernel call (zero masks are skipped)
+void gpio_write_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1);
+
+//Defer output writes (gpio_set_level(), gpio_write_bankmask(), gpio_port_write()) until gpio_write_commit(),
+//which applies them with at most one OUTPUTx_SET and one OUTPUTx_CLR store per bank; a later write to a pin overrides an earlier one
+//The batch belongs to the process (all its threads), levels read back in between do not show the deferred writes yet
+void gpio_write_begin(void);
+void gpio_write_commit(void);
+
+//Read INPUT0/INPUT1 in a single kernel call
+void gpio_read_banklevel(uint32_t *plevel0, uint32_t *plevel1);
+
+//Write OUTPUT SET/CLR masks (bit n = pin n) at an absolute gpio_time_ns() time, from a timer in the driver
+//Pending writes are applied in time order, never early but up to the driver's coalescing window (2us by default) late,
+//so writes due within the window go out as a single register write per bank, a later write to a pin overriding an earlier one
+//Returns true if queued, false if the driver's queue is full
+bool gpio_schedule_write(uint64_t set_mask, uint64_t clr_mask, uint64_t t_abs_ns);
+
+//Drop every pending scheduled write (of all processes)
+void gpio_schedule_cancel(void);
+
+//Stepper motion engine in the driver: step/dir pulse trains emitted from a timer, trapezoidal speed profiles computed in integer math
+//Bind an axis to its step and dir pins; pulse_ns is the step pulse width and dir setup time (1000 to 100000)
+//Returns false if the axis is busy, an argument is invalid, either pin is not an output yet or belongs to another axis; the axis position is reset to 0
+bool gpio_motion_setup(uint8_t axis, uint8_t step_pin, uint8_t dir_pin, uint32_t pulse_ns);
+
+//Queue a move of steps (negative: dir pin high), accelerating at accel steps/s^2 up to max_rate steps/s and decelerating to a stop
+//Moves of an axis run back to back, each from and to standstill; with hold the move waits for gpio_motion_start()
+//Returns false if the axis queue is full, the axis is not set up, max_rate leaves less than a pulse width low,
+//or the highest max_rate running or queued per axis, summed over all axes, would exceed GPIO_MOTION_RATE_TOTAL_MAX
+bool gpio_motion_move(uint8_t axis, int32_t steps, uint32_t max_rate, uint32_t accel, bool hold);
+
+//Start the held moves of the axes in axis_mask together at t_abs_ns (0: now); an axis still running
+//its previous move gets its next held move released instead
+void gpio_motion_start(uint32_t axis_mask, uint64_t t_abs_ns);
+
+//Drop the queued moves of the axes in axis_mask and stop them, at once or decelerating along the current ramp
+void gpio_motion_stop(uint32_t axis_mask, bool ramp_down);
+
+//Snapshot of positions and queues, never waits for the axes
+void gpio_motion_status(gpio_motion_status_t *pstatus);
+
+//Log every output write of this process (gpio_set_level(), gpio_write_bankmask(), gpio_port_write(), gpio_schedule_write())
+//to a file, until gpio_record_stop(); scheduled writes are logged at their due time, so the log may be slightly out of order
+//Returns true if the file was created, false if it could not be or a recording is already running
+bool gpio_record_start(const char *path);
+void gpio_record_stop(void);
+
+//Replay a log at its recorded timing through scheduled writes, record time 0 mapped to t_start_ns (0: now)
+//Memory use is bounded whatever the log length, the driver's timer applies the writes (its coalescing window applies)
+//Blocks until the last write is queued, which is up to GPIO_REPLAY_LEAD_NS before it goes out
+//Replayed writes are not logged by a running gpio_record_start(); a full driver queue is waited out, any other refusal ends the replay
+//Returns true if the whole log was queued, false with errno set if the driver is not initialized (ENODEV), the file could not be opened,
+//is not a log (EINVAL) or the driver refused a write (writes queued before stay queued, gpio_schedule_cancel() drops them)
+bool gpio_replay(const char *path, uint64_t t_start_ns);
+
+//Timing helpers, CLOCK_MONOTONIC nanoseconds (the clock of gpio_event_t), usable without gpio_init()
+//Waits sleep in clock_nanosleep() and spin only for a short tail, sized from the wakeup lateness measured by the first gpio_init()
+uint64_t gpio_time_ns(void);
+
+//Wait until an absolute time, use it to pace loops without drift (next += period; gpio_sleep_until(next))
+void gpio_sleep_until(uint64_t abs_ns);
+
+void gpio_delay_ns(uint64_t time_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //GPIO_H
 
@@ -0,0 +1,294 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ * C++ Interface (header only, C++17)
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#ifndef GPIO_HPP
+#define GPIO_HPP
+
+#include "gpio.h"
+#include "mod/bcm2837_gpio_mmap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace gpio
+{
+	constexpr uint8_t PIN_MAX = 53u;
+
+	enum class Mode : uint8_t
+	{
+		Input = GPIO_PINMODE_INPUT,
+		Output = GPIO_PINMODE_OUTPUT,
+		AltFunc0 = GPIO_PINMODE_ALTFUNC0,
+		AltFunc1 = GPIO_PINMODE_ALTFUNC1,
+		AltFunc2 = GPIO_PINMODE_ALTFUNC2,
+		AltFunc3 = GPIO_PINMODE_ALTFUNC3,
+		AltFunc4 = GPIO_PINMODE_ALTFUNC4,
+		AltFunc5 = GPIO_PINMODE_ALTFUNC5
+	};
+
+	enum class Pull : uint8_t
+	{
+		None = GPIO_PUDCTRL_NOPULL,
+		Up = GPIO_PUDCTRL_PULLUP,
+		Down = GPIO_PUDCTRL_PULLDOWN
+	};
+
+	//Register layout of a single pin, fully resolved at compile time
+	//Instantiating it with an invalid pin fails to compile
+	template<uint8_t pin>
+	struct PinTraits
+	{
+		static_assert(pin <= PIN_MAX, "GPIO: pin out of range");
+
+		static constexpr uint8_t bank = (pin >> 5);
+		static constexpr uint32_t mask = (1u << (pin & 0x1f));
+
+		static constexpr size_t regindex32_set = bank ? __GPIO_REGINDEX32_OUTPUT1_SET : __GPIO_REGINDEX32_OUTPUT0_SET;
+		static constexpr size_t regindex32_clr = bank ? __GPIO_REGINDEX32_OUTPUT1_CLR : __GPIO_REGINDEX32_OUTPUT0_CLR;
+		static constexpr size_t regindex32_input = bank ? __GPIO_REGINDEX32_INPUT1 : __GPIO_REGINDEX32_INPUT0;
+	};
+
+	template<uint8_t... pins>
+	struct PortTraits
+	{
+		static_assert(sizeof...(pins) > 0u, "GPIO: empty port");
+		static_assert(sizeof...(pins) <= 32u, "GPIO: port wider than 32 bits");
+
+		static constexpr uint8_t n_pins = sizeof...(pins);
+		static constexpr uint32_t bank_mask[2] = {
+			(0u | ... | (PinTraits<pins>::bank ? 0u : PinTraits<pins>::mask)),
+			(0u | ... | (PinTraits<pins>::bank ? PinTraits<pins>::mask : 0u))
+		};
+
+		static constexpr bool unique(void)
+		{
+			constexpr uint8_t list[] = {pins...};
+			for(size_t i = 0u; i < n_pins; i++)
+				for(size_t j = i + 1u; j < n_pins; j++)
+					if(list[i] == list[j]) return false;
+			return true;
+		}
+
+		static_assert(unique(), "GPIO: duplicate pin in port");
+	};
+
+	template<uint8_t pin>
+	void set_pinmode(Mode mode)
+	{
+		static_assert(pin <= PIN_MAX, "GPIO: pin out of range");
+		gpio_set_pinmode(pin, static_cast<uint8_t>(mode));
+	}
+
+	//Data path through the kernel driver (/proc/gpioctrl), gpio_init() must have been called
+	struct Driver
+	{
+		static void write_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1)
+		{
+			gpio_write_bankmask(set0, clr0, set1, clr1);
+		}
+
+		static void read_banklevel(uint32_t *plevel0, uint32_t *plevel1)
+		{
+			gpio_read_banklevel(plevel0, plevel1);
+		}
+
+		template<uint8_t pin>
+		static void set(bool level)
+		{
+			gpio_set_level(pin, level);
+		}
+
+		template<uint8_t pin>
+		static bool get(void)
+		{
+			return gpio_get_level(pin);
+		}
+	};
+
+	//Data path through a directly mapped register page (/dev/gpiomem)
+	//Register offsets are compile time constants, set/clear/read are single unchecked MMIO accesses
+	//Only OUTPUTx_SET/CLR and INPUTx are reachable: the driver keeps no shadow of them, so its FSEL/pull/detect shadows
+	//and generation counter stay valid, and pin configuration still goes through the driver
+	//The driver never sees these writes though: they are not deferred by gpio_write_begin(), not logged by gpio_record_start(),
+	//and not ordered against scheduled writes or the motion engine driving the same pins
+	class Direct
+	{
+	private:
+		static inline volatile uint32_t *regs = nullptr;
+
+	public:
+		//Returns true if successful or already mapped, false else
+		static bool map(void)
+		{
+			int fd;
+			void *page;
+
+			if(regs != nullptr) return true;
+
+			fd = open("/dev/gpiomem", O_RDWR | O_SYNC);
+			if(fd < 0) return false;
+
+			page = mmap(nullptr, __GPIO_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+
+			if(page == MAP_FAILED) return false;
+
+			regs = static_cast<volatile uint32_t*>(page);
+			return true;
+		}
+
+		static void unmap(void)
+		{
+			if(regs == nullptr) return;
+
+			munmap(const_cast<uint32_t*>(regs), __GPIO_MMAP_SIZE);
+			regs = nullptr;
+		}
+
+		static void write_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1)
+		{
+			if(set0) regs[__GPIO_REGINDEX32_OUTPUT0_SET] = set0;
+			if(clr0) regs[__GPIO_REGINDEX32_OUTPUT0_CLR] = clr0;
+			if(set1) regs[__GPIO_REGINDEX32_OUTPUT1_SET] = set1;
+			if(clr1) regs[__GPIO_REGINDEX32_OUTPUT1_CLR] = clr1;
+		}
+
+		static void read_banklevel(uint32_t *plevel0, uint32_t *plevel1)
+		{
+			*plevel0 = regs[__GPIO_REGINDEX32_INPUT0];
+			*plevel1 = regs[__GPIO_REGINDEX32_INPUT1];
+		}
+
+		template<uint8_t pin>
+		static void set(bool level)
+		{
+			if(level) regs[PinTraits<pin>::regindex32_set] = PinTraits<pin>::mask;
+			else regs[PinTraits<pin>::regindex32_clr] = PinTraits<pin>::mask;
+		}
+
+		template<uint8_t pin>
+		static bool get(void)
+		{
+			return (regs[PinTraits<pin>::regindex32_input] & PinTraits<pin>::mask) != 0u;
+		}
+	};
+
+	template<uint8_t pin, typename Backend = Driver>
+	struct OutputPin
+	{
+		static_assert(pin <= PIN_MAX, "GPIO: pin out of range");
+
+		static void configure(void)
+		{
+			gpio_set_pinmode(pin, GPIO_PINMODE_OUTPUT);
+		}
+
+		static void set(void)
+		{
+			Backend::template set<pin>(true);
+		}
+
+		static void clear(void)
+		{
+			Backend::template set<pin>(false);
+		}
+
+		static void write(bool level)
+		{
+			Backend::template set<pin>(level);
+		}
+	};
+
+	template<uint8_t pin, typename Backend = Driver>
+	struct InputPin
+	{
+		static_assert(pin <= PIN_MAX, "GPIO: pin out of range");
+
+		static void configure(Pull pull = Pull::None)
+		{
+			gpio_set_pinmode(pin, GPIO_PINMODE_INPUT);
+			gpio_set_pudctrl(pin, static_cast<uint8_t>(pull));
+		}
+
+		static bool read(void)
+		{
+			return Backend::template get<pin>();
+		}
+	};
+
+	//Bit n of the port value maps to the n-th pin of the template argument list
+	template<typename Backend, uint8_t... pins>
+	struct BasicOutputPort
+	{
+		using traits = PortTraits<pins...>;
+		static_assert(traits::n_pins != 0u);
+
+		static void configure(void)
+		{
+			(gpio_set_pinmode(pins, GPIO_PINMODE_OUTPUT), ...);
+		}
+
+		static void write(uint32_t value)
+		{
+			uint32_t set[2] = {0u, 0u};
+			uint8_t bit = 0u;
+
+			((set[PinTraits<pins>::bank] |= ((value >> bit++) & 1u) ? PinTraits<pins>::mask : 0u), ...);
+
+			Backend::write_bankmask(set[0], (traits::bank_mask[0] & ~set[0]), set[1], (traits::bank_mask[1] & ~set[1]));
+		}
+	};
+
+	template<typename Backend, uint8_t... pins>
+	struct BasicInputPort
+	{
+		using traits = PortTraits<pins...>;
+		static_assert(traits::n_pins != 0u);
+
+		static void configure(Pull pull = Pull::None)
+		{
+			(gpio_set_pinmode(pins, GPIO_PINMODE_INPUT), ...);
+			(gpio_set_pudctrl(pins, static_cast<uint8_t>(pull)), ...);
+		}
+
+		static uint32_t read(void)
+		{
+			uint32_t level[2];
+			uint32_t value = 0u;
+			uint8_t bit = 0u;
+
+			Backend::read_banklevel(&level[0], &level[1]);
+
+			((value |= ((level[PinTraits<pins>::bank] & PinTraits<pins>::mask) ? 1u : 0u) << bit++), ...);
+			return value;
+		}
+	};
+
+	template<uint8_t... pins>
+	using OutputPort = BasicOutputPort<Driver, pins...>;
+
+	template<uint8_t... pins>
+	using InputPort = BasicInputPort<Driver, pins...>;
+
+	template<uint8_t... pins>
+	using DirectOutputPort = BasicOutputPort<Direct, pins...>;
+
+	template<uint8_t... pins>
+	using DirectInputPort = BasicInputPort<Direct, pins...>;
+
+	template<uint8_t pin>
+	using DirectOutputPin = OutputPin<pin, Direct>;
+
+	template<uint8_t pin>
+	using DirectInputPin = InputPin<pin, Direct>;
+}
+
+#endif //GPIO_HPP
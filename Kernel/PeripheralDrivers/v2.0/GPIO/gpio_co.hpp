@@ -0,0 +1,439 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ * C++ Coroutine Interface (header only, C++20)
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#ifndef GPIO_CO_HPP
+#define GPIO_CO_HPP
+
+#include "gpio.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace gpio
+{
+	enum Edge : uint8_t
+	{
+		Rising = GPIO_DETECT_REDGE,
+		Falling = GPIO_DETECT_FEDGE,
+		Both = (GPIO_DETECT_REDGE | GPIO_DETECT_FEDGE)
+	};
+
+	class Loop;
+
+	//Coroutine run by a Loop, it starts once given to Loop::spawn() and is destroyed when it returns
+	class Task
+	{
+	public:
+		struct promise_type
+		{
+			Task get_return_object(void)
+			{
+				return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+
+			std::suspend_always initial_suspend(void) noexcept { return {}; }
+			std::suspend_always final_suspend(void) noexcept { return {}; }
+			void return_void(void) {}
+			void unhandled_exception(void) { std::terminate(); }
+		};
+
+		Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+		Task(const Task&) = delete;
+		Task &operator=(const Task&) = delete;
+
+		~Task(void)
+		{
+			if(handle) handle.destroy();
+		}
+
+	private:
+		friend class Loop;
+
+		explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	//Runs any number of Tasks on the calling thread
+	//Between resumptions the thread sleeps in epoll_wait() on a gpio_poll_open() descriptor and a timerfd,
+	//a wakeup resumes every coroutine whose edge, level or time it was waiting for
+	class Loop
+	{
+	public:
+		enum class Kind : uint8_t
+		{
+			Edge,
+			Level,
+			Time
+		};
+
+		//One suspended co_await, lives in the coroutine frame
+		struct Waiter
+		{
+			std::coroutine_handle<> handle;
+			Kind kind;
+			uint8_t pin;
+			uint8_t edge;
+			uint64_t mask;
+			uint64_t value;
+			uint64_t deadline;
+			gpio_event_t event;
+		};
+
+		Loop(void) = default;
+
+		Loop(const Loop&) = delete;
+		Loop &operator=(const Loop&) = delete;
+
+		//Destroys the coroutines still suspended and disables the detectors the loop enabled
+		~Loop(void)
+		{
+			for(Waiter *pwaiter : waiters) pwaiter->handle.destroy();
+			for(std::coroutine_handle<> handle : ready) handle.destroy();
+
+			for(uint8_t pin = 0u; pin < GPIO_EVENT_LOOP_PINS; pin++)
+			{
+				if(detect[pin] & Rising) gpio_enable_redge_detect(pin, false);
+				if(detect[pin] & Falling) gpio_enable_fedge_detect(pin, false);
+			}
+
+			close_fds();
+		}
+
+		void spawn(Task &&task)
+		{
+			ready.push_back(std::exchange(task.handle, nullptr));
+			n_tasks++;
+		}
+
+		//Returns once every Task has returned or stop() was called, false if the descriptors could not be set up
+		bool run(void)
+		{
+			epoll_event events[2];
+
+			if(!open_fds()) return false;
+
+			current_loop = this;
+			stopping = false;
+
+			while(n_tasks && !stopping)
+			{
+				if(dispatch()) continue;
+
+				arm_timer();
+				epoll_wait(epoll_fd, events, 2, -1);
+
+				//Readiness is re-armed by the next gpio_poll_set()
+				poll_valid = false;
+			}
+
+			current_loop = nullptr;
+			return true;
+		}
+
+		void stop(void)
+		{
+			stopping = true;
+		}
+
+		//Loop running on the calling thread, nullptr outside of run()
+		static Loop *current(void)
+		{
+			return current_loop;
+		}
+
+		void add(Waiter *pwaiter)
+		{
+			if(pwaiter->kind == Kind::Edge)
+			{
+				if((pwaiter->edge & Rising) && !(detect[pwaiter->pin] & Rising)) gpio_enable_redge_detect(pwaiter->pin, true);
+				if((pwaiter->edge & Falling) && !(detect[pwaiter->pin] & Falling)) gpio_enable_fedge_detect(pwaiter->pin, true);
+
+				detect[pwaiter->pin] |= pwaiter->edge;
+			}
+
+			waiters.push_back(pwaiter);
+		}
+
+	private:
+		//One pass over the waiters, returns true if a coroutine ran
+		bool dispatch(void)
+		{
+			std::vector<std::coroutine_handle<>> resume;
+			gpio_event_t event = {0u, 0u, 0u};
+			uint64_t edge_mask = 0u;
+			uint64_t level_mask = 0u;
+			uint64_t level;
+			uint64_t now;
+			uint32_t level0;
+			uint32_t level1;
+			size_t n_waiter;
+			bool matched;
+
+			resume.swap(ready);
+
+			for(Waiter *pwaiter : waiters)
+			{
+				if(pwaiter->kind == Kind::Edge) edge_mask |= (1ULL << pwaiter->pin);
+				else if(pwaiter->kind == Kind::Level) level_mask |= pwaiter->mask;
+			}
+
+			//Events first: a level read afterwards is at least as recent as each event taken
+			if(edge_mask) gpio_wait_event(edge_mask, 0u, &event);
+
+			gpio_read_banklevel(&level0, &level1);
+			level = ((uint64_t) level0) | (((uint64_t) level1) << 32);
+
+			if(!poll_valid || (edge_mask != poll_edge_mask) || (level_mask != poll_level_mask) || ((level ^ poll_level) & level_mask))
+			{
+				poll_valid = gpio_poll_set(poll_fd, edge_mask, level_mask, level);
+				poll_edge_mask = edge_mask;
+				poll_level_mask = level_mask;
+				poll_level = level;
+			}
+
+			now = gpio_time_ns();
+
+			n_waiter = 0u;
+			while(n_waiter < waiters.size())
+			{
+				Waiter *pwaiter = waiters[n_waiter];
+
+				switch(pwaiter->kind)
+				{
+					case Kind::Edge:
+						//Event direction is not reported, with both detectors on the pin the level tells them apart
+						matched = ((event.pending >> pwaiter->pin) & 1u);
+						if(matched && (pwaiter->edge != Both) && (detect[pwaiter->pin] == Both))
+							matched = (((level >> pwaiter->pin) & 1u) == ((pwaiter->edge == Rising) ? 1u : 0u));
+
+						if(matched) pwaiter->event = event;
+						break;
+
+					case Kind::Level:
+						matched = ((level & pwaiter->mask) == pwaiter->value);
+						break;
+
+					default:
+						matched = (now >= pwaiter->deadline);
+						break;
+				}
+
+				if(!matched)
+				{
+					n_waiter++;
+					continue;
+				}
+
+				resume.push_back(pwaiter->handle);
+				waiters[n_waiter] = waiters.back();
+				waiters.pop_back();
+			}
+
+			for(std::coroutine_handle<> handle : resume)
+			{
+				handle.resume();
+				if(!handle.done()) continue;
+
+				handle.destroy();
+				n_tasks--;
+			}
+
+			return !resume.empty();
+		}
+
+		void arm_timer(void)
+		{
+			itimerspec spec = {{0, 0}, {0, 0}};
+			uint64_t deadline = UINT64_MAX;
+			uint64_t count;
+
+			read(timer_fd, &count, sizeof(count));
+
+			for(Waiter *pwaiter : waiters)
+				if((pwaiter->kind == Kind::Time) && (pwaiter->deadline < deadline)) deadline = pwaiter->deadline;
+
+			//A zero it_value disarms the timer, a deadline already passed fires at once
+			if(deadline != UINT64_MAX)
+			{
+				if(!deadline) deadline = 1u;
+
+				spec.it_value.tv_sec = (time_t) (deadline/1000000000ULL);
+				spec.it_value.tv_nsec = (long) (deadline%1000000000ULL);
+			}
+
+			timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+		}
+
+		bool open_fds(void)
+		{
+			epoll_event event;
+
+			if(epoll_fd >= 0) return true;
+
+			epoll_fd = epoll_create1(0);
+			timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+			poll_fd = gpio_poll_open();
+
+			if((epoll_fd < 0) || (timer_fd < 0) || (poll_fd < 0))
+			{
+				close_fds();
+				return false;
+			}
+
+			event.events = EPOLLIN;
+			event.data.fd = timer_fd;
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+
+			event.events = (EPOLLIN | EPOLLPRI);
+			event.data.fd = poll_fd;
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, poll_fd, &event);
+
+			poll_valid = false;
+			return true;
+		}
+
+		void close_fds(void)
+		{
+			if(poll_fd >= 0) gpio_poll_close(poll_fd);
+			if(timer_fd >= 0) close(timer_fd);
+			if(epoll_fd >= 0) close(epoll_fd);
+
+			poll_fd = -1;
+			timer_fd = -1;
+			epoll_fd = -1;
+		}
+
+		static inline thread_local Loop *current_loop = nullptr;
+
+		std::vector<Waiter*> waiters;
+		std::vector<std::coroutine_handle<>> ready;
+		size_t n_tasks = 0u;
+		bool stopping = false;
+
+		uint8_t detect[GPIO_EVENT_LOOP_PINS] = {};
+
+		int epoll_fd = -1;
+		int timer_fd = -1;
+		int poll_fd = -1;
+
+		//Last state given to gpio_poll_set(), the call is skipped while it holds and no wakeup consumed the readiness
+		bool poll_valid = false;
+		uint64_t poll_edge_mask = 0u;
+		uint64_t poll_level_mask = 0u;
+		uint64_t poll_level = 0u;
+	};
+
+	//co_await edge(pin, Rising): resumes with the event batch once an edge is detected on pin
+	//The loop enables the detectors on first use and leaves them on, an edge between two co_awaits is not lost
+	//Both directions awaited on one pin by different coroutines are told apart by the level after the event,
+	//a pulse shorter than the wakeup latency resumes only the waiters of its first edge
+	struct EdgeAwaiter
+	{
+		Loop::Waiter waiter;
+
+		bool await_ready(void) const noexcept
+		{
+			return (waiter.pin > GPIO_EVENT_LOOP_PINS - 1u) || (Loop::current() == nullptr);
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			waiter.handle = handle;
+			Loop::current()->add(&waiter);
+		}
+
+		gpio_event_t await_resume(void) const noexcept
+		{
+			return waiter.event;
+		}
+	};
+
+	//co_await level(mask, value): resumes once (input levels & mask) == value, at once if it already holds
+	struct LevelAwaiter
+	{
+		Loop::Waiter waiter;
+
+		bool await_ready(void) const noexcept
+		{
+			uint32_t level0;
+			uint32_t level1;
+
+			if(Loop::current() == nullptr) return true;
+
+			gpio_read_banklevel(&level0, &level1);
+			return ((((uint64_t) level0) | (((uint64_t) level1) << 32)) & waiter.mask) == waiter.value;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			waiter.handle = handle;
+			Loop::current()->add(&waiter);
+		}
+
+		void await_resume(void) const noexcept {}
+	};
+
+	//co_await sleep_until(t): resumes once gpio_time_ns() reaches t, with the wakeup latency of the loop's epoll_wait()
+	//For exact output timing, co_await write_at() instead
+	struct TimeAwaiter
+	{
+		Loop::Waiter waiter;
+		bool accepted;
+
+		bool await_ready(void) const noexcept
+		{
+			return !accepted || (Loop::current() == nullptr) || (gpio_time_ns() >= waiter.deadline);
+		}
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			waiter.handle = handle;
+			Loop::current()->add(&waiter);
+		}
+
+		bool await_resume(void) const noexcept
+		{
+			return accepted;
+		}
+	};
+
+	inline EdgeAwaiter edge(uint8_t pin, Edge direction)
+	{
+		return EdgeAwaiter{{nullptr, Loop::Kind::Edge, pin, static_cast<uint8_t>(direction), 0u, 0u, 0u, {0u, 0u, 0u}}};
+	}
+
+	inline LevelAwaiter level(uint64_t mask, uint64_t value)
+	{
+		return LevelAwaiter{{nullptr, Loop::Kind::Level, 0u, 0u, mask, (value & mask), 0u, {0u, 0u, 0u}}};
+	}
+
+	inline TimeAwaiter sleep_until(uint64_t t_abs_ns)
+	{
+		return TimeAwaiter{{nullptr, Loop::Kind::Time, 0u, 0u, 0u, 0u, t_abs_ns, {0u, 0u, 0u}}, true};
+	}
+
+	//co_await write_at(set, clr, t): the write is applied at t by the driver's timer (gpio_schedule_write()),
+	//the coroutine resumes after it; yields false at once if the driver's queue is full
+	inline TimeAwaiter write_at(uint64_t set_mask, uint64_t clr_mask, uint64_t t_abs_ns)
+	{
+		bool accepted = gpio_schedule_write(set_mask, clr_mask, t_abs_ns);
+		return TimeAwaiter{{nullptr, Loop::Kind::Time, 0u, 0u, 0u, 0u, t_abs_ns, {0u, 0u, 0u}}, accepted};
+	}
+}
+
+#endif //GPIO_CO_HPP
@@ -0,0 +1,1189 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ * Simulated Register Backend
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#include "gpio_sim.h"
+#include "mod/gpio_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define __GPIO_SIM_STATUS_PAGE_SIZE32 1024UL
+#define __GPIO_SIM_SCRIPT_LINE_MAX 128UL
+
+#define __GPIO_SIM_WIRE_NONE 0xffU
+
+//Same defaults as the module's sched_max and sched_coalesce_ns
+#define __GPIO_SIM_SCHED_MAX 1024UL
+#define __GPIO_SIM_SCHED_COALESCE_NS 2000ULL
+
+//Same default as the module's ring_idle_us
+#define __GPIO_SIM_RING_IDLE_NS 1000000ULL
+
+#define __GPIO_SIM_POLL_MAX 64UL
+
+typedef struct {
+	uint64_t time_ns;
+	uint32_t set[2];
+	uint32_t clr[2];
+} _gpio_sim_sched_entry_t;
+
+//Descriptor registered with POLL_SET, an eventfd opened by gpio_poll_open()
+typedef struct {
+	int fd;
+	bool signalled;
+	uint32_t event_mask[2];
+	uint32_t level_mask[2];
+	uint32_t level_snapshot[2];
+} _gpio_sim_poll_entry_t;
+
+//Defined in gpio.c, routes library commands to a backend instead of the proc file
+bool _gpio_attach_backend(uint8_t transport, void (*call)(uint8_t *data_io, size_t size), const volatile uint32_t *status_page, uint32_t *(*map_ring)(void));
+
+uint32_t _gpio_sim_regs[__GPIO_MMAP_SIZE32];
+uint32_t _gpio_sim_status_page[__GPIO_SIM_STATUS_PAGE_SIZE32];
+
+//Pin state outside the register file: output latch, external drive, applied pulls
+uint32_t _gpio_sim_latch[2];
+uint32_t _gpio_sim_drive_mask[2];
+uint32_t _gpio_sim_drive_level[2];
+uint32_t _gpio_sim_pullup[2];
+uint32_t _gpio_sim_pulldown[2];
+
+//Pins driven by the level of another pin (gpio_sim_connect()), __GPIO_SIM_WIRE_NONE if unwired
+uint8_t _gpio_sim_wire_src[__GPIO_PIN_MAX + 1u];
+bool _gpio_sim_wired = false;
+
+uint32_t _gpio_sim_read_latency_ns = 0u;
+uint32_t _gpio_sim_write_latency_ns = 0u;
+
+//Serializes register access between command dispatch and the script thread
+pthread_mutex_t _gpio_sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Simulated interrupt line, broadcast whenever the core latches new events (CLOCK_MONOTONIC, set up by gpio_init_sim())
+pthread_cond_t _gpio_sim_event_cond;
+bool _gpio_sim_event_cond_ready = false;
+
+//Scheduled writes sorted by time, applied by a scheduler thread started on first use (again after a fork)
+_gpio_sim_sched_entry_t _gpio_sim_sched[__GPIO_SIM_SCHED_MAX];
+size_t _gpio_sim_sched_count = 0u;
+pthread_cond_t _gpio_sim_sched_cond;
+pid_t _gpio_sim_sched_pid = 0;
+
+//Motion engine (mod/gpio_core.c) run by a thread started on first use (again after a fork), the module runs it from an hrtimer
+//_gpio_sim_motion_next is the time of the next edge, 0 while every axis is idle
+uint64_t _gpio_sim_motion_next = 0u;
+pthread_cond_t _gpio_sim_motion_cond;
+pid_t _gpio_sim_motion_pid = 0;
+
+//Rings handed to gpio_ring_enable(), executed by a ring thread started on first use (again after a fork) with the module's idle policy
+//The rings live as long as the process, indexes keep running across gpio_ring_disable()/gpio_ring_enable()
+uint32_t _gpio_sim_ring[__GPIO_RING_MMAP_SIZE/4UL] __attribute__((aligned(64)));
+pthread_cond_t _gpio_sim_ring_cond;
+pid_t _gpio_sim_ring_pid = 0;
+bool _gpio_sim_ring_kick = false;
+
+//Pollable descriptors, signalled once their POLL_SET readiness holds (re-armed by the next POLL_SET)
+_gpio_sim_poll_entry_t _gpio_sim_poll[__GPIO_SIM_POLL_MAX];
+size_t _gpio_sim_poll_count = 0u;
+
+//Subscriber queues by descriptor (an eventfd opened by gpio_subscribe()), the module keeps one per open file
+//The eventfd is signalled while records are queued, as the module's file polls readable
+int _gpio_sim_sub_fd[__GPIO_SUBSCRIBER_MAX];
+bool _gpio_sim_sub_signalled[__GPIO_SUBSCRIBER_MAX];
+struct _gpio_subscriber *_gpio_sim_sub[__GPIO_SUBSCRIBER_MAX];
+size_t _gpio_sim_sub_count = 0u;
+
+//Deferred writes between WRITE_BEGIN and WRITE_COMMIT, the simulator has a single client (the process)
+struct _gpio_write_batch _gpio_sim_batch;
+
+gpio_sim_event_t *_gpio_sim_script = NULL;
+size_t _gpio_sim_script_size = 0u;
+pthread_t _gpio_sim_script_thread;
+bool _gpio_sim_script_running = false;
+
+uint64_t _gpio_sim_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec)*1000000000ull + ((uint64_t) ts.tv_nsec);
+}
+
+void _gpio_sim_spin_ns(uint32_t time_ns)
+{
+	uint64_t end_time;
+
+	if(!time_ns) return;
+
+	end_time = _gpio_sim_now_ns() + time_ns;
+	while(_gpio_sim_now_ns() < end_time);
+	return;
+}
+
+void _gpio_sim_delay_us(uint32_t time_us)
+{
+	_gpio_sim_spin_ns(1000u*time_us);
+	return;
+}
+
+uint32_t _gpio_sim_output_mask(uint8_t n_bank)
+{
+	uint32_t mask = 0u;
+	uint8_t pin;
+	uint8_t pin_max;
+
+	pin = 32u*n_bank;
+	pin_max = n_bank ? __GPIO_PIN_MAX : 31u;
+
+	for(; pin <= pin_max; pin++)
+		if(((_gpio_sim_regs[__GPIO_REGINDEX32_FSEL0 + pin/10u] >> (3u*(pin%10u))) & 0x7) == __GPIO_PINMODE_OUTPUT) mask |= (1u << (pin & 0x1f));
+
+	return mask;
+}
+
+//Level sensitive detectors keep their status bit set while the level holds
+void _gpio_sim_assert_level_detect(void)
+{
+	uint32_t level;
+	uint8_t n_bank;
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		level = _gpio_sim_regs[__GPIO_REGINDEX32_INPUT0 + n_bank];
+
+		_gpio_sim_regs[__GPIO_REGINDEX32_EVENTDETECT0_STATUS + n_bank] |=
+			(level & _gpio_sim_regs[__GPIO_REGINDEX32_HIGHDETECT0_ENABLE + n_bank]) |
+			(~level & _gpio_sim_regs[__GPIO_REGINDEX32_LOWDETECT0_ENABLE + n_bank]);
+	}
+
+	return;
+}
+
+void _gpio_sim_compute_levels(const uint32_t *output_mask, uint32_t *plevel)
+{
+	uint8_t n_bank;
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		plevel[n_bank] = (_gpio_sim_latch[n_bank] & output_mask[n_bank]);
+		plevel[n_bank] |= (_gpio_sim_drive_level[n_bank] & _gpio_sim_drive_mask[n_bank] & ~output_mask[n_bank]);
+		plevel[n_bank] |= (_gpio_sim_pullup[n_bank] & ~_gpio_sim_drive_mask[n_bank] & ~output_mask[n_bank]);
+	}
+
+	plevel[1] &= __GPIO_BANK1_MASK;
+	return;
+}
+
+//Recompute the pin levels after any change to outputs, pin modes, pulls or external drive, and latch edge events
+//Wired pins take the level their source has after the first pass
+void _gpio_sim_update_levels(void)
+{
+	uint32_t output_mask[2];
+	uint32_t level[2];
+	uint32_t prev_level;
+	uint32_t rising;
+	uint32_t falling;
+	uint32_t bit_mask;
+	uint8_t n_bank;
+	uint8_t pin;
+	uint8_t src;
+
+	output_mask[0] = _gpio_sim_output_mask(0u);
+	output_mask[1] = _gpio_sim_output_mask(1u);
+
+	_gpio_sim_compute_levels(output_mask, level);
+
+	if(_gpio_sim_wired)
+	{
+		for(pin = 0u; pin <= __GPIO_PIN_MAX; pin++)
+		{
+			src = _gpio_sim_wire_src[pin];
+			if(src == __GPIO_SIM_WIRE_NONE) continue;
+
+			bit_mask = (1u << (pin & 0x1f));
+
+			if(level[src >> 5] & (1u << (src & 0x1f))) _gpio_sim_drive_level[pin >> 5] |= bit_mask;
+			else _gpio_sim_drive_level[pin >> 5] &= ~bit_mask;
+		}
+
+		_gpio_sim_compute_levels(output_mask, level);
+	}
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		prev_level = _gpio_sim_regs[__GPIO_REGINDEX32_INPUT0 + n_bank];
+		rising = (level[n_bank] & ~prev_level);
+		falling = (prev_level & ~level[n_bank]);
+
+		_gpio_sim_regs[__GPIO_REGINDEX32_INPUT0 + n_bank] = level[n_bank];
+
+		_gpio_sim_regs[__GPIO_REGINDEX32_EVENTDETECT0_STATUS + n_bank] |=
+			(rising & (_gpio_sim_regs[__GPIO_REGINDEX32_REDGEDETECT0_ENABLE + n_bank] | _gpio_sim_regs[__GPIO_REGINDEX32_ASYNC_REDGEDETECT0_ENABLE + n_bank])) |
+			(falling & (_gpio_sim_regs[__GPIO_REGINDEX32_FEDGEDETECT0_ENABLE + n_bank] | _gpio_sim_regs[__GPIO_REGINDEX32_ASYNC_FEDGEDETECT0_ENABLE + n_bank]));
+	}
+
+	_gpio_sim_assert_level_detect();
+	return;
+}
+
+uint32_t _gpio_sim_mmio_read(size_t regindex32)
+{
+	_gpio_sim_spin_ns(_gpio_sim_read_latency_ns);
+
+	if(regindex32 >= __GPIO_MMAP_SIZE32) return 0u;
+
+	return _gpio_sim_regs[regindex32];
+}
+
+void _gpio_sim_mmio_write(size_t regindex32, uint32_t value)
+{
+	uint8_t pudctrl;
+
+	_gpio_sim_spin_ns(_gpio_sim_write_latency_ns);
+
+	switch(regindex32)
+	{
+		case __GPIO_REGINDEX32_OUTPUT0_SET:
+		case __GPIO_REGINDEX32_OUTPUT1_SET:
+			_gpio_sim_latch[regindex32 - __GPIO_REGINDEX32_OUTPUT0_SET] |= value;
+			_gpio_sim_update_levels();
+			break;
+
+		case __GPIO_REGINDEX32_OUTPUT0_CLR:
+		case __GPIO_REGINDEX32_OUTPUT1_CLR:
+			_gpio_sim_latch[regindex32 - __GPIO_REGINDEX32_OUTPUT0_CLR] &= ~value;
+			_gpio_sim_update_levels();
+			break;
+
+		case __GPIO_REGINDEX32_INPUT0:
+		case __GPIO_REGINDEX32_INPUT1:
+			break;
+
+		case __GPIO_REGINDEX32_EVENTDETECT0_STATUS:
+		case __GPIO_REGINDEX32_EVENTDETECT1_STATUS:
+			_gpio_sim_regs[regindex32] &= ~value;
+			_gpio_sim_assert_level_detect();
+			break;
+
+		case __GPIO_REGINDEX32_PUDCTRL0:
+		case __GPIO_REGINDEX32_PUDCTRL1:
+			_gpio_sim_regs[regindex32] = value;
+			pudctrl = (_gpio_sim_regs[__GPIO_REGINDEX32_PUDCTRL_ENABLE] & 0x3);
+
+			_gpio_sim_pullup[regindex32 - __GPIO_REGINDEX32_PUDCTRL0] &= ~value;
+			_gpio_sim_pulldown[regindex32 - __GPIO_REGINDEX32_PUDCTRL0] &= ~value;
+
+			if(pudctrl == __GPIO_PUDCTRL_PULLUP) _gpio_sim_pullup[regindex32 - __GPIO_REGINDEX32_PUDCTRL0] |= value;
+			else if(pudctrl == __GPIO_PUDCTRL_PULLDOWN) _gpio_sim_pulldown[regindex32 - __GPIO_REGINDEX32_PUDCTRL0] |= value;
+
+			_gpio_sim_update_levels();
+			break;
+
+		default:
+			if(regindex32 >= __GPIO_MMAP_SIZE32) break;
+
+			_gpio_sim_regs[regindex32] = value;
+
+			if(regindex32 <= __GPIO_REGINDEX32_FSEL5) _gpio_sim_update_levels();
+			else _gpio_sim_assert_level_detect();
+			break;
+	}
+
+	return;
+}
+
+//Returns the subscriber slot of fd, _gpio_sim_sub_count if none
+//Caller holds _gpio_sim_mutex
+size_t _gpio_sim_subscriber_find(int fd)
+{
+	size_t n_sub;
+
+	for(n_sub = 0u; n_sub < _gpio_sim_sub_count; n_sub++)
+		if(_gpio_sim_sub_fd[n_sub] == fd) break;
+
+	return n_sub;
+}
+
+//Same readiness as the module's poll(), POLLIN and POLLPRI both show as the eventfd becoming readable
+//Caller holds _gpio_sim_mutex
+void _gpio_sim_poll_notify(void)
+{
+	_gpio_sim_poll_entry_t *pentry;
+	uint64_t one = 1u;
+	uint32_t level;
+	size_t n_entry;
+	size_t n_sub;
+	uint8_t n_bank;
+	bool ready;
+
+	for(n_entry = 0u; n_entry < _gpio_sim_poll_count; n_entry++)
+	{
+		pentry = &_gpio_sim_poll[n_entry];
+		if(pentry->signalled) continue;
+
+		ready = (bool) _gpio_event_pending(pentry->event_mask[0], pentry->event_mask[1]);
+
+		for(n_bank = 0u; n_bank < 2u; n_bank++)
+		{
+			level = _gpio_sim_regs[__GPIO_REGINDEX32_INPUT0 + n_bank];
+			if((level ^ pentry->level_snapshot[n_bank]) & pentry->level_mask[n_bank]) ready = true;
+		}
+
+		if(!ready) continue;
+
+		write(pentry->fd, &one, sizeof(one));
+		pentry->signalled = true;
+	}
+
+	for(n_sub = 0u; n_sub < _gpio_sim_sub_count; n_sub++)
+	{
+		if(_gpio_sim_sub_signalled[n_sub]) continue;
+		if(!_gpio_subscriber_pending(_gpio_sim_sub[n_sub])) continue;
+
+		write(_gpio_sim_sub_fd[n_sub], &one, sizeof(one));
+		_gpio_sim_sub_signalled[n_sub] = true;
+	}
+
+	return;
+}
+
+//Simulated interrupt: taken after every register side effect while an event detect status bit is set
+//Caller holds _gpio_sim_mutex
+void _gpio_sim_service_events(void)
+{
+	uint32_t pending[2];
+
+	if(_gpio_sim_regs[__GPIO_REGINDEX32_EVENTDETECT0_STATUS] | _gpio_sim_regs[__GPIO_REGINDEX32_EVENTDETECT1_STATUS])
+		if(_gpio_core_irq(_gpio_sim_now_ns(), pending)) pthread_cond_broadcast(&_gpio_sim_event_cond);
+
+	_gpio_sim_poll_notify();
+	return;
+}
+
+//Register, update or (all masks zero) remove the descriptor in word 7, byte 2 set if the table is full
+//Caller holds _gpio_sim_mutex
+void _gpio_sim_poll_set(uint32_t *data_io32)
+{
+	_gpio_sim_poll_entry_t *pentry = NULL;
+	uint64_t count;
+	size_t n_entry;
+	int fd = (int) data_io32[7];
+
+	for(n_entry = 0u; n_entry < _gpio_sim_poll_count; n_entry++)
+	{
+		if(_gpio_sim_poll[n_entry].fd != fd) continue;
+
+		pentry = &_gpio_sim_poll[n_entry];
+		break;
+	}
+
+	if(!(data_io32[1] | data_io32[2] | data_io32[3] | data_io32[4]))
+	{
+		if(pentry != NULL) *pentry = _gpio_sim_poll[--_gpio_sim_poll_count];
+
+		((uint8_t*) data_io32)[2] = 0u;
+		return;
+	}
+
+	if(pentry == NULL)
+	{
+		if(_gpio_sim_poll_count >= __GPIO_SIM_POLL_MAX)
+		{
+			((uint8_t*) data_io32)[2] = 1u;
+			return;
+		}
+
+		pentry = &_gpio_sim_poll[_gpio_sim_poll_count++];
+		pentry->fd = fd;
+	}
+
+	pentry->event_mask[0] = data_io32[1];
+	pentry->event_mask[1] = (data_io32[2] & __GPIO_BANK1_MASK);
+	pentry->level_mask[0] = data_io32[3];
+	pentry->level_mask[1] = (data_io32[4] & __GPIO_BANK1_MASK);
+	pentry->level_snapshot[0] = (data_io32[5] & pentry->level_mask[0]);
+	pentry->level_snapshot[1] = (data_io32[6] & pentry->level_mask[1]);
+
+	//Drop a signal of the previous state, the new one is evaluated at once
+	read(fd, &count, sizeof(count));
+	pentry->signalled = false;
+
+	_gpio_sim_poll_notify();
+
+	((uint8_t*) data_io32)[2] = 0u;
+	return;
+}
+
+//Same contract as the module's WAIT_EVENT, the wait releases _gpio_sim_mutex
+void _gpio_sim_wait_event(uint32_t *data_io32)
+{
+	struct timespec ts;
+	uint32_t mask0 = data_io32[1];
+	uint32_t mask1 = (data_io32[2] & __GPIO_BANK1_MASK);
+	uint32_t timeout_us = data_io32[3];
+	uint64_t deadline;
+	uint64_t irq_time;
+	uint64_t wake_time;
+
+	deadline = _gpio_sim_now_ns() + 1000ull*timeout_us;
+	ts.tv_sec = (time_t) (deadline/1000000000ull);
+	ts.tv_nsec = (long) (deadline%1000000000ull);
+
+	while(timeout_us && !_gpio_event_pending(mask0, mask1))
+		if(pthread_cond_timedwait(&_gpio_sim_event_cond, &_gpio_sim_mutex, &ts) == ETIMEDOUT) break;
+
+	wake_time = _gpio_sim_now_ns();
+
+	_gpio_event_consume(mask0, mask1, &data_io32[1], &irq_time);
+
+	data_io32[3] = (uint32_t) irq_time;
+	data_io32[4] = (uint32_t) (irq_time >> 32);
+	data_io32[5] = (uint32_t) wake_time;
+	data_io32[6] = (uint32_t) (wake_time >> 32);
+	return;
+}
+
+//Same contract as the module's WAIT_CONDITION, the wait releases _gpio_sim_mutex
+void _gpio_sim_wait_condition(uint32_t *data_io32)
+{
+	struct timespec ts;
+	uint32_t mask[2];
+	uint32_t value[2];
+	uint32_t level[2];
+	uint64_t timeout_ns;
+	uint64_t deadline;
+	uint8_t met;
+
+	mask[0] = data_io32[1];
+	mask[1] = (data_io32[2] & __GPIO_BANK1_MASK);
+	value[0] = (data_io32[3] & mask[0]);
+	value[1] = (data_io32[4] & mask[1]);
+
+	timeout_ns = ((uint64_t) data_io32[5]) | (((uint64_t) data_io32[6]) << 32);
+
+	deadline = _gpio_sim_now_ns();
+	if(timeout_ns > (UINT64_MAX - deadline)) deadline = UINT64_MAX;
+	else deadline += timeout_ns;
+
+	if(deadline/1000000000ull > (uint64_t) INT32_MAX) deadline = 1000000000ull*INT32_MAX;
+
+	ts.tv_sec = (time_t) (deadline/1000000000ull);
+	ts.tv_nsec = (long) (deadline%1000000000ull);
+
+	//Arming a level detector on a level that already holds raises its event at once
+	while(!(met = _gpio_condition_check(mask, value, level)) && timeout_ns)
+	{
+		_gpio_sim_service_events();
+		if(pthread_cond_timedwait(&_gpio_sim_event_cond, &_gpio_sim_mutex, &ts) == ETIMEDOUT)
+		{
+			met = _gpio_condition_check(mask, value, level);
+			break;
+		}
+	}
+
+	data_io32[1] = level[0];
+	data_io32[2] = level[1];
+	((uint8_t*) data_io32)[2] = met;
+	return;
+}
+
+//Same contract as the module's SUBSCRIBE, the descriptor is in word 7
+//Caller holds _gpio_sim_mutex
+void _gpio_sim_subscribe(uint32_t *data_io32)
+{
+	struct _gpio_subscriber *psub;
+	uint32_t mask0 = data_io32[1];
+	uint32_t mask1 = (data_io32[2] & __GPIO_BANK1_MASK);
+	size_t n_sub;
+	int fd = (int) data_io32[7];
+
+	((uint8_t*) data_io32)[2] = 0u;
+
+	n_sub = _gpio_sim_subscriber_find(fd);
+
+	if(!(mask0 | mask1))
+	{
+		if(n_sub == _gpio_sim_sub_count) return;
+
+		_gpio_subscriber_detach(_gpio_sim_sub[n_sub]);
+		free(_gpio_sim_sub[n_sub]);
+
+		_gpio_sim_sub_count--;
+		_gpio_sim_sub_fd[n_sub] = _gpio_sim_sub_fd[_gpio_sim_sub_count];
+		_gpio_sim_sub_signalled[n_sub] = _gpio_sim_sub_signalled[_gpio_sim_sub_count];
+		_gpio_sim_sub[n_sub] = _gpio_sim_sub[_gpio_sim_sub_count];
+
+		//Readers of the descriptor stop waiting
+		pthread_cond_broadcast(&_gpio_sim_event_cond);
+		return;
+	}
+
+	if(n_sub < _gpio_sim_sub_count)
+	{
+		_gpio_subscriber_attach(_gpio_sim_sub[n_sub], mask0, mask1);
+		return;
+	}
+
+	psub = (struct _gpio_subscriber*) calloc(1u, sizeof(struct _gpio_subscriber));
+
+	if((psub == NULL) || !_gpio_subscriber_attach(psub, mask0, mask1))
+	{
+		free(psub);
+		((uint8_t*) data_io32)[2] = 1u;
+		return;
+	}
+
+	_gpio_sim_sub_fd[_gpio_sim_sub_count] = fd;
+	_gpio_sim_sub_signalled[_gpio_sim_sub_count] = false;
+	_gpio_sim_sub[_gpio_sim_sub_count] = psub;
+	_gpio_sim_sub_count++;
+	return;
+}
+
+//Same contract as the module's EVENT_READ, the wait releases _gpio_sim_mutex
+void _gpio_sim_event_read(uint32_t *data_io32)
+{
+	struct timespec ts;
+	uint32_t n_max = data_io32[1];
+	uint32_t timeout_us = data_io32[2];
+	uint32_t n_dropped = 0u;
+	uint32_t level_max;
+	uint32_t n_read = 0u;
+	uint64_t deadline;
+	uint64_t wake_time;
+	uint64_t count;
+	size_t n_sub;
+	int fd = (int) data_io32[7];
+
+	if(n_max > __GPIO_EVENT_READ_MAX) n_max = __GPIO_EVENT_READ_MAX;
+
+	deadline = _gpio_sim_now_ns() + 1000ull*timeout_us;
+	ts.tv_sec = (time_t) (deadline/1000000000ull);
+	ts.tv_nsec = (long) (deadline%1000000000ull);
+
+	//Looked up again after each wakeup, another thread may unsubscribe the descriptor while this one waits
+	while(timeout_us)
+	{
+		n_sub = _gpio_sim_subscriber_find(fd);
+		if(n_sub == _gpio_sim_sub_count) break;
+		if(_gpio_subscriber_pending(_gpio_sim_sub[n_sub])) break;
+
+		if(pthread_cond_timedwait(&_gpio_sim_event_cond, &_gpio_sim_mutex, &ts) == ETIMEDOUT) break;
+	}
+
+	n_sub = _gpio_sim_subscriber_find(fd);
+	if(n_sub < _gpio_sim_sub_count)
+	{
+		n_read = _gpio_subscriber_read(_gpio_sim_sub[n_sub], &data_io32[__GPIO_EVENT_READ_RECORD_WORD], n_max, &n_dropped, &level_max);
+
+		if(_gpio_sim_sub_signalled[n_sub] && !_gpio_subscriber_pending(_gpio_sim_sub[n_sub]))
+		{
+			read(fd, &count, sizeof(count));
+			_gpio_sim_sub_signalled[n_sub] = false;
+		}
+	}
+
+	wake_time = _gpio_sim_now_ns();
+
+	data_io32[1] = n_read;
+	data_io32[2] = n_dropped;
+	data_io32[3] = (uint32_t) wake_time;
+	data_io32[4] = (uint32_t) (wake_time >> 32);
+	return;
+}
+
+//Same merge rules as the module (mod/gpio_sched.c): wake at the end of the coalescing window of the earliest write
+//(where the module's timer slack ends) and apply every write due by then, none goes out early
+void *_gpio_sim_sched_main(void *arg)
+{
+	struct timespec ts;
+	uint32_t set[2];
+	uint32_t clr[2];
+	uint64_t now;
+	size_t n_due;
+	uint8_t n_bank;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	while(true)
+	{
+		if(!_gpio_sim_sched_count)
+		{
+			pthread_cond_wait(&_gpio_sim_sched_cond, &_gpio_sim_mutex);
+			continue;
+		}
+
+		now = _gpio_sim_now_ns();
+
+		if((_gpio_sim_sched[0].time_ns + __GPIO_SIM_SCHED_COALESCE_NS) > now)
+		{
+			ts.tv_sec = (time_t) ((_gpio_sim_sched[0].time_ns + __GPIO_SIM_SCHED_COALESCE_NS)/1000000000ull);
+			ts.tv_nsec = (long) ((_gpio_sim_sched[0].time_ns + __GPIO_SIM_SCHED_COALESCE_NS)%1000000000ull);
+
+			pthread_cond_timedwait(&_gpio_sim_sched_cond, &_gpio_sim_mutex, &ts);
+			continue;
+		}
+
+		memset(set, 0, sizeof(set));
+		memset(clr, 0, sizeof(clr));
+
+		for(n_due = 0u; n_due < _gpio_sim_sched_count; n_due++)
+		{
+			if(_gpio_sim_sched[n_due].time_ns > now) break;
+
+			for(n_bank = 0u; n_bank < 2u; n_bank++)
+			{
+				set[n_bank] = (set[n_bank] & ~_gpio_sim_sched[n_due].clr[n_bank]) | (_gpio_sim_sched[n_due].set[n_bank] & ~_gpio_sim_sched[n_due].clr[n_bank]);
+				clr[n_bank] = (clr[n_bank] & ~_gpio_sim_sched[n_due].set[n_bank]) | _gpio_sim_sched[n_due].clr[n_bank];
+			}
+		}
+
+		_gpio_sim_sched_count -= n_due;
+		memmove(&_gpio_sim_sched[0], &_gpio_sim_sched[n_due], _gpio_sim_sched_count*sizeof(_gpio_sim_sched_entry_t));
+
+		_gpio_set_bankmask(set[0], clr[0], set[1], clr[1]);
+		_gpio_sim_service_events();
+	}
+
+	return NULL;
+}
+
+//Caller holds _gpio_sim_mutex, returns 1 if queued, 0 with the errno value in word 1 if not (ENOSPC: queue full, as the module)
+uint8_t _gpio_sim_schedule_write(uint32_t *data_io32)
+{
+	pthread_t thread;
+	uint64_t time_ns;
+	size_t n_entry;
+	int n_ret;
+
+	if(_gpio_sim_sched_count >= __GPIO_SIM_SCHED_MAX)
+	{
+		data_io32[1] = ENOSPC;
+		return 0u;
+	}
+
+	if(_gpio_sim_sched_pid != getpid())
+	{
+		n_ret = pthread_create(&thread, NULL, &_gpio_sim_sched_main, NULL);
+		if(n_ret)
+		{
+			data_io32[1] = (uint32_t) n_ret;
+			return 0u;
+		}
+
+		pthread_detach(thread);
+		_gpio_sim_sched_pid = getpid();
+	}
+
+	time_ns = ((uint64_t) data_io32[5]) | (((uint64_t) data_io32[6]) << 32);
+
+	//Insert after every entry due at or before time_ns, so equal times keep their submission order
+	n_entry = _gpio_sim_sched_count;
+	while(n_entry && (_gpio_sim_sched[n_entry - 1u].time_ns > time_ns))
+	{
+		_gpio_sim_sched[n_entry] = _gpio_sim_sched[n_entry - 1u];
+		n_entry--;
+	}
+
+	_gpio_sim_sched[n_entry].time_ns = time_ns;
+	_gpio_sim_sched[n_entry].set[0] = data_io32[1];
+	_gpio_sim_sched[n_entry].clr[0] = data_io32[2];
+	_gpio_sim_sched[n_entry].set[1] = (data_io32[3] & __GPIO_BANK1_MASK);
+	_gpio_sim_sched[n_entry].clr[1] = (data_io32[4] & __GPIO_BANK1_MASK);
+	_gpio_sim_sched_count++;
+
+	if(n_entry == 0u) pthread_cond_signal(&_gpio_sim_sched_cond);
+	return 1u;
+}
+
+void *_gpio_sim_motion_main(void *arg)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	while(true)
+	{
+		if(!_gpio_sim_motion_next)
+		{
+			pthread_cond_wait(&_gpio_sim_motion_cond, &_gpio_sim_mutex);
+			continue;
+		}
+
+		now = _gpio_sim_now_ns();
+
+		if(_gpio_sim_motion_next > now)
+		{
+			ts.tv_sec = (time_t) (_gpio_sim_motion_next/1000000000ull);
+			ts.tv_nsec = (long) (_gpio_sim_motion_next%1000000000ull);
+
+			pthread_cond_timedwait(&_gpio_sim_motion_cond, &_gpio_sim_mutex, &ts);
+			continue;
+		}
+
+		_gpio_sim_motion_next = _gpio_motion_run(now);
+		_gpio_sim_service_events();
+	}
+
+	return NULL;
+}
+
+//Caller holds _gpio_sim_mutex
+void _gpio_sim_motion(uint8_t *data_io, size_t size)
+{
+	pthread_t thread;
+
+	if(_gpio_sim_motion_pid != getpid())
+	{
+		if(pthread_create(&thread, NULL, &_gpio_sim_motion_main, NULL))
+		{
+			data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+			data_io[2] = 0u;
+			return;
+		}
+
+		pthread_detach(thread);
+		_gpio_sim_motion_pid = getpid();
+	}
+
+	_gpio_sim_motion_next = _gpio_motion_dispatch(data_io, size, _gpio_sim_now_ns());
+	_gpio_sim_service_events();
+
+	pthread_cond_signal(&_gpio_sim_motion_cond);
+	return;
+}
+
+//Same rules as the module's ring thread (mod/gpio_main.c)
+bool _gpio_sim_ring_cmd_allowed(uint8_t cmd)
+{
+	switch(cmd)
+	{
+		case __GPIO_CMD_WAIT_EVENT:
+		case __GPIO_CMD_WAIT_CONDITION:
+		case __GPIO_CMD_GET_CONFIG:
+		case __GPIO_CMD_CONFIGURE:
+		case __GPIO_CMD_POLL_SET:
+		case __GPIO_CMD_SUBSCRIBE:
+		case __GPIO_CMD_EVENT_READ:
+		case __GPIO_CMD_STATE_SAVE:
+		case __GPIO_CMD_STATE_RESTORE:
+		case __GPIO_CMD_MOTION_STATUS:
+			return false;
+	}
+
+	return true;
+}
+
+void _gpio_sim_call(uint8_t *data_io, size_t size);
+
+void *_gpio_sim_ring_main(void *arg)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4UL];
+	uint8_t *data_io = (uint8_t*) data_io32;
+	uint32_t *psqe;
+	uint32_t *pcqe;
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	uint64_t idle_start;
+	bool done;
+
+	sq_head = __atomic_load_n(&_gpio_sim_ring[__GPIO_RING_SQ_HEAD], __ATOMIC_ACQUIRE);
+	cq_tail = __atomic_load_n(&_gpio_sim_ring[__GPIO_RING_CQ_TAIL], __ATOMIC_ACQUIRE);
+	idle_start = _gpio_sim_now_ns();
+
+	while(true)
+	{
+		sq_tail = __atomic_load_n(&_gpio_sim_ring[__GPIO_RING_SQ_TAIL], __ATOMIC_ACQUIRE);
+		cq_head = __atomic_load_n(&_gpio_sim_ring[__GPIO_RING_CQ_HEAD], __ATOMIC_ACQUIRE);
+		done = false;
+
+		while((sq_head != sq_tail) && ((cq_tail - cq_head) < __GPIO_RING_ENTRIES))
+		{
+			psqe = &_gpio_sim_ring[__GPIO_RING_PAGE_WORDS + (sq_head & (__GPIO_RING_ENTRIES - 1u))*__GPIO_RING_ENTRY_WORDS];
+			pcqe = &_gpio_sim_ring[2u*__GPIO_RING_PAGE_WORDS + (cq_tail & (__GPIO_RING_ENTRIES - 1u))*__GPIO_RING_ENTRY_WORDS];
+
+			memset(data_io32, 0, sizeof(data_io32));
+			memcpy(data_io32, psqe, __GPIO_RING_ENTRY_PAYLOAD);
+
+			if(_gpio_sim_ring_cmd_allowed(data_io[0])) _gpio_sim_call(data_io, __GPIO_RING_ENTRY_PAYLOAD);
+			else data_io[0] = __GPIO_RING_REJECTED;
+
+			memcpy(pcqe, data_io32, __GPIO_RING_ENTRY_PAYLOAD);
+			pcqe[__GPIO_RING_ENTRY_TAG] = psqe[__GPIO_RING_ENTRY_TAG];
+
+			sq_head++;
+			cq_tail++;
+			done = true;
+
+			__atomic_store_n(&_gpio_sim_ring[__GPIO_RING_SQ_HEAD], sq_head, __ATOMIC_RELEASE);
+			__atomic_store_n(&_gpio_sim_ring[__GPIO_RING_CQ_TAIL], cq_tail, __ATOMIC_RELEASE);
+		}
+
+		if(done)
+		{
+			idle_start = _gpio_sim_now_ns();
+			continue;
+		}
+
+		//Unlike the module's thread on an isolated core, the simulator's shares the CPUs with its submitters
+		if((_gpio_sim_now_ns() - idle_start) < __GPIO_SIM_RING_IDLE_NS)
+		{
+			sched_yield();
+			continue;
+		}
+
+		pthread_mutex_lock(&_gpio_sim_mutex);
+
+		__atomic_store_n(&_gpio_sim_ring[__GPIO_RING_FLAGS], __GPIO_RING_FLAG_NEED_WAKEUP, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if(__atomic_load_n(&_gpio_sim_ring[__GPIO_RING_SQ_TAIL], __ATOMIC_RELAXED) == sq_head)
+			while(!_gpio_sim_ring_kick) pthread_cond_wait(&_gpio_sim_ring_cond, &_gpio_sim_mutex);
+
+		_gpio_sim_ring_kick = false;
+		__atomic_store_n(&_gpio_sim_ring[__GPIO_RING_FLAGS], 0u, __ATOMIC_RELAXED);
+
+		pthread_mutex_unlock(&_gpio_sim_mutex);
+
+		idle_start = _gpio_sim_now_ns();
+	}
+
+	return NULL;
+}
+
+uint32_t *_gpio_sim_map_ring(void)
+{
+	pthread_t thread;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	if(_gpio_sim_ring_pid != getpid())
+	{
+		_gpio_sim_ring_kick = false;
+		__atomic_store_n(&_gpio_sim_ring[__GPIO_RING_FLAGS], __GPIO_RING_FLAG_NEED_WAKEUP, __ATOMIC_RELAXED);
+
+		if(pthread_create(&thread, NULL, &_gpio_sim_ring_main, NULL))
+		{
+			pthread_mutex_unlock(&_gpio_sim_mutex);
+			return NULL;
+		}
+
+		pthread_detach(thread);
+		_gpio_sim_ring_pid = getpid();
+	}
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+	return _gpio_sim_ring;
+}
+
+void _gpio_sim_call(uint8_t *data_io, size_t size)
+{
+	if(size > __GPIO_DATAIO_SIZE_MAX) size = __GPIO_DATAIO_SIZE_MAX;
+	if(size < __GPIO_DATAIO_SIZE) size = __GPIO_DATAIO_SIZE;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	if((data_io[0] == __GPIO_CMD_WAIT_EVENT) && (size >= __GPIO_DATAIO_WAIT_EVENT_SIZE))
+	{
+		_gpio_sim_wait_event((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((data_io[0] == __GPIO_CMD_SCHEDULE_WRITE) && (size >= __GPIO_DATAIO_SCHEDULE_WRITE_SIZE))
+	{
+		data_io[2] = _gpio_sim_schedule_write((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if(data_io[0] == __GPIO_CMD_SCHEDULE_CANCEL)
+	{
+		_gpio_sim_sched_count = 0u;
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((data_io[0] == __GPIO_CMD_WAIT_CONDITION) && (size >= __GPIO_DATAIO_WAIT_CONDITION_SIZE))
+	{
+		_gpio_sim_wait_condition((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if(data_io[0] == __GPIO_CMD_RING_ENTER)
+	{
+		_gpio_sim_ring_kick = true;
+		pthread_cond_signal(&_gpio_sim_ring_cond);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((data_io[0] >= __GPIO_CMD_MOTION_SETUP) && (data_io[0] <= __GPIO_CMD_MOTION_STATUS))
+	{
+		_gpio_sim_motion(data_io, size);
+	}
+	else if((data_io[0] == __GPIO_CMD_POLL_SET) && (size >= __GPIO_DATAIO_POLL_SET_SIZE))
+	{
+		_gpio_sim_poll_set((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((data_io[0] == __GPIO_CMD_SUBSCRIBE) && (size >= __GPIO_DATAIO_SUBSCRIBE_SIZE))
+	{
+		_gpio_sim_subscribe((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((data_io[0] == __GPIO_CMD_EVENT_READ) && (size >= __GPIO_DATAIO_EVENT_READ_SIZE))
+	{
+		_gpio_sim_event_read((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else
+	{
+		if(!_gpio_batch_dispatch(&_gpio_sim_batch, data_io, size)) _gpio_core_dispatch(data_io, size);
+		_gpio_sim_service_events();
+	}
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+	return;
+}
+
+bool gpio_init_sim(void)
+{
+	pthread_condattr_t cond_attr;
+	size_t n_sub;
+	uint8_t pin;
+
+	if(gpio_get_transport() == GPIO_TRANSPORT_SIM) return true;
+	if(gpio_is_active()) return false;
+
+	if(!_gpio_sim_event_cond_ready)
+	{
+		pthread_condattr_init(&cond_attr);
+		pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&_gpio_sim_event_cond, &cond_attr);
+		pthread_cond_init(&_gpio_sim_sched_cond, &cond_attr);
+		pthread_cond_init(&_gpio_sim_ring_cond, &cond_attr);
+		pthread_cond_init(&_gpio_sim_motion_cond, &cond_attr);
+		pthread_condattr_destroy(&cond_attr);
+
+		_gpio_sim_event_cond_ready = true;
+	}
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	memset(_gpio_sim_regs, 0, sizeof(_gpio_sim_regs));
+	memset(_gpio_sim_status_page, 0, sizeof(_gpio_sim_status_page));
+	memset(_gpio_sim_latch, 0, sizeof(_gpio_sim_latch));
+	memset(_gpio_sim_drive_mask, 0, sizeof(_gpio_sim_drive_mask));
+	memset(_gpio_sim_drive_level, 0, sizeof(_gpio_sim_drive_level));
+	memset(_gpio_sim_pullup, 0, sizeof(_gpio_sim_pullup));
+	memset(_gpio_sim_pulldown, 0, sizeof(_gpio_sim_pulldown));
+
+	for(pin = 0u; pin <= __GPIO_PIN_MAX; pin++) _gpio_sim_wire_src[pin] = __GPIO_SIM_WIRE_NONE;
+	_gpio_sim_wired = false;
+
+	_gpio_sim_sched_count = 0u;
+	_gpio_sim_poll_count = 0u;
+	_gpio_sim_motion_next = 0u;
+
+	for(n_sub = 0u; n_sub < _gpio_sim_sub_count; n_sub++) free(_gpio_sim_sub[n_sub]);
+	_gpio_sim_sub_count = 0u;
+
+	memset(&_gpio_sim_batch, 0, sizeof(_gpio_sim_batch));
+
+	_gpio_mmap = _gpio_sim_regs;
+	_gpio_status_page = _gpio_sim_status_page;
+	_gpio_core_init();
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+
+	return _gpio_attach_backend(GPIO_TRANSPORT_SIM, &_gpio_sim_call, _gpio_sim_status_page, &_gpio_sim_map_ring);
+}
+
+void gpio_sim_set_latency(uint32_t read_ns, uint32_t write_ns)
+{
+	_gpio_sim_read_latency_ns = read_ns;
+	_gpio_sim_write_latency_ns = write_ns;
+	return;
+}
+
+void gpio_sim_drive(uint8_t pin, bool level)
+{
+	if(pin > __GPIO_PIN_MAX) return;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	_gpio_sim_wire_src[pin] = __GPIO_SIM_WIRE_NONE;
+	_gpio_sim_drive_mask[pin >> 5] |= (1u << (pin & 0x1f));
+
+	if(level) _gpio_sim_drive_level[pin >> 5] |= (1u << (pin & 0x1f));
+	else _gpio_sim_drive_level[pin >> 5] &= ~(1u << (pin & 0x1f));
+
+	_gpio_sim_update_levels();
+	_gpio_sim_service_events();
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+	return;
+}
+
+void gpio_sim_release(uint8_t pin)
+{
+	if(pin > __GPIO_PIN_MAX) return;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	_gpio_sim_wire_src[pin] = __GPIO_SIM_WIRE_NONE;
+	_gpio_sim_drive_mask[pin >> 5] &= ~(1u << (pin & 0x1f));
+	_gpio_sim_update_levels();
+	_gpio_sim_service_events();
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+	return;
+}
+
+void gpio_sim_connect(uint8_t src_pin, uint8_t dst_pin)
+{
+	if(src_pin > __GPIO_PIN_MAX) return;
+	if(dst_pin > __GPIO_PIN_MAX) return;
+	if(src_pin == dst_pin) return;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+
+	_gpio_sim_wire_src[dst_pin] = src_pin;
+	_gpio_sim_drive_mask[dst_pin >> 5] |= (1u << (dst_pin & 0x1f));
+	_gpio_sim_wired = true;
+
+	_gpio_sim_update_levels();
+	_gpio_sim_service_events();
+
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+	return;
+}
+
+void *_gpio_sim_script_main(void *arg)
+{
+	struct timespec ts;
+	uint64_t start_time;
+	uint64_t event_time;
+	size_t n_event;
+
+	start_time = _gpio_sim_now_ns();
+
+	for(n_event = 0u; n_event < _gpio_sim_script_size; n_event++)
+	{
+		event_time = start_time + _gpio_sim_script[n_event].time_ns;
+
+		ts.tv_sec = (time_t) (event_time/1000000000ull);
+		ts.tv_nsec = (long) (event_time%1000000000ull);
+
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+
+		gpio_sim_drive(_gpio_sim_script[n_event].pin, _gpio_sim_script[n_event].level);
+	}
+
+	return NULL;
+}
+
+bool gpio_sim_play(const gpio_sim_event_t *events, size_t n_events)
+{
+	if(events == NULL) return false;
+	if(_gpio_sim_script_running) return false;
+
+	_gpio_sim_script = (gpio_sim_event_t*) malloc(n_events*sizeof(gpio_sim_event_t) + 1u);
+	if(_gpio_sim_script == NULL) return false;
+
+	memcpy(_gpio_sim_script, events, n_events*sizeof(gpio_sim_event_t));
+	_gpio_sim_script_size = n_events;
+
+	if(pthread_create(&_gpio_sim_script_thread, NULL, &_gpio_sim_script_main, NULL))
+	{
+		free(_gpio_sim_script);
+		_gpio_sim_script = NULL;
+		return false;
+	}
+
+	_gpio_sim_script_running = true;
+	return true;
+}
+
+bool gpio_sim_play_file(const char *path)
+{
+	FILE *file;
+	gpio_sim_event_t *events = NULL;
+	gpio_sim_event_t *events_new;
+	size_t n_events = 0u;
+	size_t n_alloc = 0u;
+	char line[__GPIO_SIM_SCRIPT_LINE_MAX];
+	unsigned long long time_us;
+	unsigned int pin;
+	unsigned int level;
+	bool ret;
+
+	if(path == NULL) return false;
+
+	file = fopen(path, "r");
+	if(file == NULL) return false;
+
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		if(strchr(line, '#') != NULL) *strchr(line, '#') = '\0';
+		if(sscanf(line, "%llu %u %u", &time_us, &pin, &level) != 3) continue;
+		if(pin > __GPIO_PIN_MAX) continue;
+
+		if(n_events == n_alloc)
+		{
+			n_alloc = n_alloc ? 2u*n_alloc : 64u;
+			events_new = (gpio_sim_event_t*) realloc(events, n_alloc*sizeof(gpio_sim_event_t));
+			if(events_new == NULL)
+			{
+				free(events);
+				fclose(file);
+				return false;
+			}
+
+			events = events_new;
+		}
+
+		events[n_events].time_ns = 1000ull*time_us;
+		events[n_events].pin = (uint8_t) pin;
+		events[n_events].level = (level != 0u);
+		n_events++;
+	}
+
+	fclose(file);
+
+	if(events == NULL) return false;
+
+	ret = gpio_sim_play(events, n_events);
+	free(events);
+	return ret;
+}
+
+void gpio_sim_wait(void)
+{
+	if(!_gpio_sim_script_running) return;
+
+	pthread_join(_gpio_sim_script_thread, NULL);
+
+	free(_gpio_sim_script);
+	_gpio_sim_script = NULL;
+	_gpio_sim_script_size = 0u;
+	_gpio_sim_script_running = false;
+	return;
+}
+
+uint32_t gpio_sim_peek(size_t regindex32)
+{
+	uint32_t value;
+
+	if(regindex32 >= __GPIO_MMAP_SIZE32) return 0u;
+
+	pthread_mutex_lock(&_gpio_sim_mutex);
+	value = _gpio_sim_regs[regindex32];
+	pthread_mutex_unlock(&_gpio_sim_mutex);
+
+	return value;
+}
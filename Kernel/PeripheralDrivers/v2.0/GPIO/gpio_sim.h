@@ -0,0 +1,63 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ * Simulated Register Backend
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#ifndef GPIO_SIM_H
+#define GPIO_SIM_H
+
+#include "gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//External level change applied by a script, time is relative to the start of the script
+typedef struct {
+	uint64_t time_ns;
+	uint8_t pin;
+	bool level;
+} gpio_sim_event_t;
+
+//Initializes the GPIO Interface on an in-memory model of the BCM2837 GPIO registers
+//Commands run through the same register logic and dispatch as the kernel module (mod/gpio_core.c)
+//Event detection raises a simulated interrupt, so gpio_wait_event() behaves as on the module
+//Returns true if successful or already initialized on the simulator, false else
+bool gpio_init_sim(void);
+
+//Latency added to every simulated register read/write, in nanoseconds (default 0)
+void gpio_sim_set_latency(uint32_t read_ns, uint32_t write_ns);
+
+//Drive a pin from outside the chip, as a connected device would (no effect while the pin is an output)
+//Level changes trigger the enabled edge/level detectors
+void gpio_sim_drive(uint8_t pin, bool level);
+
+//Stop driving a pin from outside, its level then follows its pull (low if unpulled)
+void gpio_sim_release(uint8_t pin);
+
+//Wire dst_pin to src_pin, dst_pin then follows the level of src_pin (e.g. an output looped back to an input)
+//gpio_sim_drive() or gpio_sim_release() on dst_pin removes the wire
+void gpio_sim_connect(uint8_t src_pin, uint8_t dst_pin);
+
+//Play a sequence of external level changes (sorted by time) on a background thread
+//Returns true if the script was started, false else (invalid arguments or a script already running)
+bool gpio_sim_play(const gpio_sim_event_t *events, size_t n_events);
+
+//Play a script from a text file, one event per line: "<time_us> <pin> <level>", '#' starts a comment
+//Returns true if the script was loaded and started, false else
+bool gpio_sim_play_file(const char *path);
+
+//Wait for the running script to finish
+void gpio_sim_wait(void);
+
+//Read a simulated register without side effects or injected latency
+uint32_t gpio_sim_peek(size_t regindex32);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //GPIO_SIM_H
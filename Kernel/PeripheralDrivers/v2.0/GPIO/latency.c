@@ -0,0 +1,356 @@
+/*
+ * GPIO Driver Edge-to-Userspace Latency
+ *
+ * Loopback harness: the output pin (-a) must be wired to the input pin (-b), the simulator wires them itself.
+ * The main thread toggles the output, a waiter thread detects the edge on the input through
+ * the polling path (gpio_event_detected) or the interrupt path (gpio_wait_event).
+ *
+ * Segments, all CLOCK_MONOTONIC:
+ *  write_to_user: output write issued to waiter back in userspace (both modes)
+ *  write_to_irq: output write issued to event latched by the interrupt (irq mode)
+ *  irq_to_wake: interrupt to waiter woken in the driver (irq mode)
+ *  wake_to_user: waiter woken in the driver to waiter back in userspace (irq mode)
+ *
+ * Output is one JSON object per line on stdout, one line per transport, mode and segment.
+ *
+ * Usage: latency.elf [-t transport] [-m mode] [-n iterations] [-a out_pin] [-b in_pin] [-g gap_us] [-l label]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "gpio.h"
+#include "gpio_sim.h"
+
+#define LATENCY_DRIVER_VERSION "2.0"
+
+#define LATENCY_ITERATIONS_DEFAULT 2000UL
+#define LATENCY_OUT_PIN_DEFAULT 20U
+#define LATENCY_IN_PIN_DEFAULT 21U
+#define LATENCY_GAP_US_DEFAULT 200UL
+
+//An edge not seen within this time is counted as lost
+#define LATENCY_TIMEOUT_US 1000000UL
+
+#define LATENCY_HIST_BUCKETS 32U
+
+#define LATENCY_MODE_POLL 0U
+#define LATENCY_MODE_IRQ 1U
+
+#define LATENCY_SEG_WRITE_TO_USER 0U
+#define LATENCY_SEG_WRITE_TO_IRQ 1U
+#define LATENCY_SEG_IRQ_TO_WAKE 2U
+#define LATENCY_SEG_WAKE_TO_USER 3U
+
+#define LATENCY_SEG_COUNT 4U
+
+typedef struct {
+	const char *name;
+	bool (*init)(void);
+} latency_transport_t;
+
+const latency_transport_t latency_transports[] = {
+	{"procfs", &gpio_init},
+	{"sim", &gpio_init_sim}
+};
+
+#define LATENCY_N_TRANSPORTS (sizeof(latency_transports)/sizeof(latency_transport_t))
+
+const char *latency_mode_names[] = {"poll", "irq"};
+const char *latency_seg_names[LATENCY_SEG_COUNT] = {"write_to_user", "write_to_irq", "irq_to_wake", "wake_to_user"};
+
+uint8_t latency_out_pin = LATENCY_OUT_PIN_DEFAULT;
+uint8_t latency_in_pin = LATENCY_IN_PIN_DEFAULT;
+uint32_t latency_n_iter = LATENCY_ITERATIONS_DEFAULT;
+uint32_t latency_gap_us = LATENCY_GAP_US_DEFAULT;
+const char *latency_label = "";
+
+//Handshake between the toggling thread and the waiter, one round per iteration
+uint32_t latency_armed = 0u;
+uint32_t latency_done = 0u;
+uint64_t latency_write_time = 0u;
+
+uint8_t latency_mode;
+uint32_t *latency_samples[LATENCY_SEG_COUNT];
+uint32_t latency_n_samples[LATENCY_SEG_COUNT];
+uint32_t latency_lost;
+
+uint64_t now_ns(void);
+int cmp_u32(const void *a, const void *b);
+void sleep_us(uint32_t time_us);
+void add_sample(uint8_t seg, uint64_t t0, uint64_t t1);
+void report(const char *transport, uint8_t seg);
+void *waiter_main(void *arg);
+bool run_mode(const char *transport, uint8_t mode);
+
+int main(int argc, char **argv)
+{
+	const char *transport_name = NULL;
+	const char *mode_name = NULL;
+	size_t n_transport;
+	uint8_t mode;
+	uint8_t seg;
+	bool ran = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:m:n:a:b:g:l:")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				transport_name = optarg;
+				break;
+
+			case 'm':
+				mode_name = optarg;
+				break;
+
+			case 'n':
+				latency_n_iter = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'a':
+				latency_out_pin = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'b':
+				latency_in_pin = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'g':
+				latency_gap_us = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'l':
+				latency_label = optarg;
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-t transport] [-m mode] [-n iterations] [-a out_pin] [-b in_pin] [-g gap_us] [-l label]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(latency_n_iter == 0u) latency_n_iter = 1u;
+
+	for(seg = 0u; seg < LATENCY_SEG_COUNT; seg++)
+	{
+		latency_samples[seg] = malloc(latency_n_iter*sizeof(uint32_t));
+		if(latency_samples[seg] == NULL) return 1;
+	}
+
+	for(n_transport = 0u; n_transport < LATENCY_N_TRANSPORTS; n_transport++)
+	{
+		if((transport_name != NULL) && strcmp(transport_name, latency_transports[n_transport].name)) continue;
+
+		if(!latency_transports[n_transport].init())
+		{
+			fprintf(stderr, "LATENCY: transport %s not available, skipped\n", latency_transports[n_transport].name);
+			continue;
+		}
+
+		if(gpio_get_transport() == GPIO_TRANSPORT_SIM) gpio_sim_connect(latency_out_pin, latency_in_pin);
+
+		for(mode = LATENCY_MODE_POLL; mode <= LATENCY_MODE_IRQ; mode++)
+		{
+			if((mode_name != NULL) && strcmp(mode_name, latency_mode_names[mode])) continue;
+
+			if(run_mode(latency_transports[n_transport].name, mode)) ran = true;
+		}
+
+		gpio_reset_pin(latency_out_pin);
+		gpio_reset_pin(latency_in_pin);
+		gpio_deinit();
+	}
+
+	if(!ran)
+	{
+		fprintf(stderr, "LATENCY: nothing measured\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec)*1000000000ull + ((uint64_t) ts.tv_nsec);
+}
+
+int cmp_u32(const void *a, const void *b)
+{
+	uint32_t va = *((const uint32_t*) a);
+	uint32_t vb = *((const uint32_t*) b);
+
+	if(va < vb) return -1;
+	if(va > vb) return 1;
+	return 0;
+}
+
+void sleep_us(uint32_t time_us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = time_us/1000000u;
+	ts.tv_nsec = 1000l*(time_us%1000000u);
+
+	while(nanosleep(&ts, &ts));
+	return;
+}
+
+//Timestamps from different clocks' points of view can be out of order by a few ns, clamp to 0
+void add_sample(uint8_t seg, uint64_t t0, uint64_t t1)
+{
+	uint64_t delta = (t1 > t0) ? (t1 - t0) : 0u;
+
+	latency_samples[seg][latency_n_samples[seg]++] = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t) delta;
+	return;
+}
+
+void report(const char *transport, uint8_t seg)
+{
+	uint32_t hist[LATENCY_HIST_BUCKETS];
+	uint32_t *samples = latency_samples[seg];
+	uint32_t n = latency_n_samples[seg];
+	uint32_t i;
+	uint8_t bucket;
+
+	if(n == 0u) return;
+
+	qsort(samples, n, sizeof(uint32_t), &cmp_u32);
+
+	memset(hist, 0, sizeof(hist));
+	for(i = 0u; i < n; i++)
+	{
+		bucket = samples[i] ? (31u - __builtin_clz(samples[i])) : 0u;
+		hist[bucket]++;
+	}
+
+	printf("{\"bench\":\"gpio_latency\",\"driver\":\"%s\",\"label\":\"%s\",\"transport\":\"%s\",\"mode\":\"%s\",\"segment\":\"%s\",\"samples\":%u,\"lost\":%u,"
+		"\"lat_ns\":{\"min\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},\"hist_log2_ns\":[",
+		LATENCY_DRIVER_VERSION, latency_label, transport, latency_mode_names[latency_mode], latency_seg_names[seg], n, latency_lost,
+		samples[0], samples[n/2u], samples[(n*90u)/100u], samples[(n*99u)/100u], samples[(n*999u)/1000u], samples[n - 1u]);
+
+	for(bucket = 0u; bucket < LATENCY_HIST_BUCKETS; bucket++) printf((bucket ? ",%u" : "%u"), hist[bucket]);
+
+	printf("]}\n");
+	fflush(stdout);
+	return;
+}
+
+void *waiter_main(void *arg)
+{
+	gpio_event_t event;
+	uint64_t in_mask = (1ull << latency_in_pin);
+	uint64_t deadline;
+	uint64_t user_time;
+	uint64_t write_time;
+	uint32_t n;
+	bool detected;
+
+	for(n = 1u; n <= latency_n_iter; n++)
+	{
+		__atomic_store_n(&latency_armed, n, __ATOMIC_RELEASE);
+
+		if(latency_mode == LATENCY_MODE_IRQ)
+		{
+			detected = gpio_wait_event(in_mask, LATENCY_TIMEOUT_US, &event);
+		}
+		else
+		{
+			deadline = now_ns() + 1000ull*LATENCY_TIMEOUT_US;
+			do{
+				detected = gpio_event_detected(latency_in_pin);
+			}while(!detected && (now_ns() < deadline));
+		}
+
+		user_time = now_ns();
+		write_time = __atomic_load_n(&latency_write_time, __ATOMIC_ACQUIRE);
+
+		if(!detected)
+		{
+			latency_lost++;
+		}
+		else
+		{
+			add_sample(LATENCY_SEG_WRITE_TO_USER, write_time, user_time);
+
+			if(latency_mode == LATENCY_MODE_IRQ)
+			{
+				add_sample(LATENCY_SEG_WRITE_TO_IRQ, write_time, event.irq_time_ns);
+				add_sample(LATENCY_SEG_IRQ_TO_WAKE, event.irq_time_ns, event.wake_time_ns);
+				add_sample(LATENCY_SEG_WAKE_TO_USER, event.wake_time_ns, user_time);
+			}
+		}
+
+		__atomic_store_n(&latency_done, n, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+bool run_mode(const char *transport, uint8_t mode)
+{
+	pthread_t waiter;
+	uint32_t n;
+	uint8_t seg;
+	bool level = false;
+
+	gpio_reset_pin(latency_out_pin);
+	gpio_reset_pin(latency_in_pin);
+
+	gpio_set_pinmode(latency_out_pin, GPIO_PINMODE_OUTPUT);
+	gpio_set_level(latency_out_pin, false);
+
+	gpio_set_pinmode(latency_in_pin, GPIO_PINMODE_INPUT);
+	gpio_enable_redge_detect(latency_in_pin, true);
+	gpio_enable_fedge_detect(latency_in_pin, true);
+
+	gpio_event_detected(latency_in_pin);
+	gpio_wait_event((1ull << latency_in_pin), 0u, NULL);
+
+	latency_mode = mode;
+	latency_lost = 0u;
+	latency_armed = 0u;
+	latency_done = 0u;
+
+	for(seg = 0u; seg < LATENCY_SEG_COUNT; seg++) latency_n_samples[seg] = 0u;
+
+	if(pthread_create(&waiter, NULL, &waiter_main, NULL)) return false;
+
+	for(n = 1u; n <= latency_n_iter; n++)
+	{
+		while(__atomic_load_n(&latency_armed, __ATOMIC_ACQUIRE) != n);
+
+		//Let the waiter reach its sleep (irq) or its polling loop before the edge
+		sleep_us(latency_gap_us);
+
+		level = !level;
+
+		__atomic_store_n(&latency_write_time, now_ns(), __ATOMIC_RELEASE);
+		gpio_set_level(latency_out_pin, level);
+
+		while(__atomic_load_n(&latency_done, __ATOMIC_ACQUIRE) != n) sched_yield();
+	}
+
+	pthread_join(waiter, NULL);
+
+	if(latency_lost == latency_n_iter)
+	{
+		fprintf(stderr, "LATENCY: no edge seen on pin %u in %s mode, check the loopback wiring\n", latency_in_pin, latency_mode_names[mode]);
+		return false;
+	}
+
+	for(seg = 0u; seg < LATENCY_SEG_COUNT; seg++) report(transport, seg);
+
+	return true;
+}
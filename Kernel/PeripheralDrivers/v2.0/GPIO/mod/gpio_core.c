@@ -0,0 +1,1434 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#include "gpio_core.h"
+
+uint32_t *_gpio_mmap = NULL;
+
+//Shadow copies of the configuration registers, only written by this driver
+//Getters read them from RAM and setters do a single MMIO store when the value changes
+static uint32_t _gpio_shadow_fsel[__GPIO_FSEL_COUNT];
+static uint32_t _gpio_shadow_detect[__GPIO_DETECT_COUNT][2];
+
+//Pull state cannot be read back from the hardware, pins are reported unpulled until set
+//Pins never set by this driver are not in _gpio_shadow_pull_known, their actual pull may be anything (firmware, earlier users)
+static uint32_t _gpio_shadow_pullup[2];
+static uint32_t _gpio_shadow_pulldown[2];
+static uint32_t _gpio_shadow_pull_known[2];
+
+//Configuration generation counter, bumped on any change to FSEL/pull/detect state
+uint32_t *_gpio_status_page = NULL;
+
+//Event detect bits taken from the hardware by the interrupt path, until consumed by a command
+//Level detectors of latched pins stay disabled in hardware (not in the shadow), so a held level cannot retrigger the interrupt
+static uint32_t _gpio_event_latched[2];
+static uint64_t _gpio_event_time[__GPIO_PIN_MAX + 1u];
+
+//Level detectors armed by condition waiters on top of the shadow, each arm is dropped by the interrupt path once it fires
+//Their events wake the waiters but are only latched for pins with a user detector of the matching kind
+static uint32_t _gpio_cond_armed_high[2];
+static uint32_t _gpio_cond_armed_low[2];
+
+//Attached subscribers and the union of their masks
+//Level detectors of subscribed pins stay disabled from their event until a subscriber of the pin reads its queue
+static struct _gpio_subscriber *_gpio_subscribers[__GPIO_SUBSCRIBER_MAX];
+static uint32_t _gpio_subscriber_count = 0u;
+static uint32_t _gpio_subscribed[2];
+static uint32_t _gpio_subscriber_held[2];
+
+//Stepper axes of the motion engine, serialized by the platform against its motion timer
+static struct _gpio_motion_axis _gpio_motion_axes[__GPIO_MOTION_AXES];
+
+#ifdef __KERNEL__
+DEFINE_SPINLOCK(_gpio_event_lock);
+#endif
+
+static const size_t _gpio_detect_regindex32[__GPIO_DETECT_COUNT][2] = {
+	{__GPIO_REGINDEX32_REDGEDETECT0_ENABLE, __GPIO_REGINDEX32_REDGEDETECT1_ENABLE},
+	{__GPIO_REGINDEX32_FEDGEDETECT0_ENABLE, __GPIO_REGINDEX32_FEDGEDETECT1_ENABLE},
+	{__GPIO_REGINDEX32_ASYNC_REDGEDETECT0_ENABLE, __GPIO_REGINDEX32_ASYNC_REDGEDETECT1_ENABLE},
+	{__GPIO_REGINDEX32_ASYNC_FEDGEDETECT0_ENABLE, __GPIO_REGINDEX32_ASYNC_FEDGEDETECT1_ENABLE},
+	{__GPIO_REGINDEX32_HIGHDETECT0_ENABLE, __GPIO_REGINDEX32_HIGHDETECT1_ENABLE},
+	{__GPIO_REGINDEX32_LOWDETECT0_ENABLE, __GPIO_REGINDEX32_LOWDETECT1_ENABLE}
+};
+
+void _gpio_config_changed(void)
+{
+	smp_wmb();
+	WRITE_ONCE(_gpio_status_page[__GPIO_STATUS_GENERATION], _gpio_status_page[__GPIO_STATUS_GENERATION] + 1u);
+	return;
+}
+
+//Write a detect enable register from its shadow, level detectors of latched or held pins left disabled, condition arms added
+//Caller holds the event lock
+static void _gpio_detect_write(uint8_t detect, uint8_t n_bank)
+{
+	uint32_t value;
+	uint32_t masked;
+
+	value = _gpio_shadow_detect[detect][n_bank];
+	masked = (_gpio_event_latched[n_bank] | _gpio_subscriber_held[n_bank]);
+
+	if(detect == __GPIO_DETECT_HIGH) value = (value & ~masked) | _gpio_cond_armed_high[n_bank];
+	else if(detect == __GPIO_DETECT_LOW) value = (value & ~masked) | _gpio_cond_armed_low[n_bank];
+
+	__GPIO_MMIO_WRITE(_gpio_detect_regindex32[detect][n_bank], value);
+	return;
+}
+
+static void _gpio_level_detect_rearm(uint8_t n_bank)
+{
+	_gpio_detect_write(__GPIO_DETECT_HIGH, n_bank);
+	_gpio_detect_write(__GPIO_DETECT_LOW, n_bank);
+	return;
+}
+
+void _gpio_set_level(uint8_t pin, uint8_t level)
+{
+	size_t regindex32;
+	uint8_t bit_offset;
+
+	if(pin > __GPIO_PIN_MAX) return;
+
+	bit_offset = (pin & 0x1f);
+
+	if(pin < 32u)
+	{
+		if(level) regindex32 = __GPIO_REGINDEX32_OUTPUT0_SET;
+		else regindex32 = __GPIO_REGINDEX32_OUTPUT0_CLR;
+	}
+	else
+	{
+		if(level) regindex32 = __GPIO_REGINDEX32_OUTPUT1_SET;
+		else regindex32 = __GPIO_REGINDEX32_OUTPUT1_CLR;
+	}
+
+	__GPIO_MMIO_WRITE(regindex32, (1u << bit_offset));
+	return;
+}
+
+uint8_t _gpio_get_level(uint8_t pin)
+{
+	size_t regindex32;
+	uint8_t bit_offset;
+
+	if(pin > __GPIO_PIN_MAX) return 0u;
+
+	bit_offset = (pin & 0x1f);
+
+	if(pin < 32u) regindex32 = __GPIO_REGINDEX32_INPUT0;
+	else regindex32 = __GPIO_REGINDEX32_INPUT1;
+
+	if(__GPIO_MMIO_READ(regindex32) & (1u << bit_offset)) return 1u;
+	return 0u;
+}
+
+void _gpio_set_pinmode(uint8_t pin, uint8_t pinmode)
+{
+	size_t n_fsel;
+	uint8_t bit_offset;
+	uint32_t value;
+
+	if(pin > __GPIO_PIN_MAX) return;
+	if(pinmode > __GPIO_PINMODE_MAX) return;
+
+	n_fsel = pin/10u;
+	bit_offset = 3u*(pin%10u);
+
+	value = (_gpio_shadow_fsel[n_fsel] & ~(0x7 << bit_offset)) | (pinmode << bit_offset);
+	if(value == _gpio_shadow_fsel[n_fsel]) return;
+
+	_gpio_shadow_fsel[n_fsel] = value;
+	__GPIO_MMIO_WRITE(__GPIO_REGINDEX32_FSEL0 + n_fsel, value);
+
+	_gpio_config_changed();
+	return;
+}
+
+uint8_t _gpio_get_pinmode(uint8_t pin)
+{
+	if(pin > __GPIO_PIN_MAX) return 0u;
+
+	return ((_gpio_shadow_fsel[pin/10u] >> (3u*(pin%10u))) & 0x7);
+}
+
+//Apply one pull value to every pin in the bank masks with a single PUD/PUDCLK sequence
+//Sequence per datasheet: set PUD, wait 150 cycles, clock the pins in, wait 150 cycles, release PUD and PUDCLK
+void _gpio_apply_pudctrl(uint8_t pudctrl, uint32_t mask0, uint32_t mask1)
+{
+	mask1 &= __GPIO_BANK1_MASK;
+
+	if(!(mask0 | mask1)) return;
+
+	__GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL_ENABLE, pudctrl);
+	__GPIO_DELAY_US(1u);
+
+	if(mask0) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL0, mask0);
+	if(mask1) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL1, mask1);
+	__GPIO_DELAY_US(1u);
+
+	__GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL_ENABLE, __GPIO_PUDCTRL_NOPULL);
+	if(mask0) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL0, 0u);
+	if(mask1) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_PUDCTRL1, 0u);
+
+	_gpio_shadow_pullup[0] &= ~mask0;
+	_gpio_shadow_pullup[1] &= ~mask1;
+	_gpio_shadow_pulldown[0] &= ~mask0;
+	_gpio_shadow_pulldown[1] &= ~mask1;
+	_gpio_shadow_pull_known[0] |= mask0;
+	_gpio_shadow_pull_known[1] |= mask1;
+
+	if(pudctrl == __GPIO_PUDCTRL_PULLUP)
+	{
+		_gpio_shadow_pullup[0] |= mask0;
+		_gpio_shadow_pullup[1] |= mask1;
+	}
+	else if(pudctrl == __GPIO_PUDCTRL_PULLDOWN)
+	{
+		_gpio_shadow_pulldown[0] |= mask0;
+		_gpio_shadow_pulldown[1] |= mask1;
+	}
+
+	return;
+}
+
+void _gpio_set_pudctrl(uint8_t pin, uint8_t pudctrl)
+{
+	if(pin > __GPIO_PIN_MAX) return;
+	if(pudctrl > __GPIO_PUDCTRL_MAX) return;
+
+	if(pin < 32u) _gpio_apply_pudctrl(pudctrl, (1u << pin), 0u);
+	else _gpio_apply_pudctrl(pudctrl, 0u, (1u << (pin & 0x1f)));
+
+	_gpio_config_changed();
+	return;
+}
+
+uint8_t _gpio_get_pudctrl(uint8_t pin)
+{
+	uint32_t bit_mask;
+
+	if(pin > __GPIO_PIN_MAX) return __GPIO_PUDCTRL_NOPULL;
+
+	bit_mask = (1u << (pin & 0x1f));
+
+	if(_gpio_shadow_pullup[pin >> 5] & bit_mask) return __GPIO_PUDCTRL_PULLUP;
+	if(_gpio_shadow_pulldown[pin >> 5] & bit_mask) return __GPIO_PUDCTRL_PULLDOWN;
+
+	return __GPIO_PUDCTRL_NOPULL;
+}
+
+//An event counts whether the interrupt path has already latched it or it is still pending in hardware
+//Returns 1 if detected, 0 if not, __GPIO_EVENT_SUBSCRIBED if the pin's events go to subscribers (nothing consumed)
+uint8_t _gpio_event_detected(uint8_t pin)
+{
+	size_t regindex32;
+	uint32_t bit_mask;
+	unsigned long flags;
+	uint8_t n_bank;
+	uint8_t detected = 0u;
+
+	if(pin > __GPIO_PIN_MAX) return 0u;
+
+	n_bank = (pin >> 5);
+	bit_mask = (1u << (pin & 0x1f));
+
+	if(pin < 32u) regindex32 = __GPIO_REGINDEX32_EVENTDETECT0_STATUS;
+	else regindex32 = __GPIO_REGINDEX32_EVENTDETECT1_STATUS;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	//Events of subscribed pins belong to the subscribers
+	if(_gpio_subscribed[n_bank] & bit_mask)
+	{
+		__GPIO_EVENT_UNLOCK(flags);
+		return __GPIO_EVENT_SUBSCRIBED;
+	}
+
+	if(__GPIO_MMIO_READ(regindex32) & bit_mask)
+	{
+		__GPIO_MMIO_WRITE(regindex32, bit_mask);
+		detected = 1u;
+	}
+
+	if(_gpio_event_latched[n_bank] & bit_mask)
+	{
+		_gpio_event_latched[n_bank] &= ~bit_mask;
+		_gpio_level_detect_rearm(n_bank);
+		detected = 1u;
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+	return detected;
+}
+
+//Queue one record on every subscriber whose mask it intersects, a full queue counts the record as dropped
+//Caller holds the event lock
+static void _gpio_subscriber_dispatch(const uint32_t *pbits, uint64_t time_ns)
+{
+	struct _gpio_subscriber *psub;
+	struct _gpio_event_record *precord;
+	uint32_t bits[2];
+	uint32_t level;
+	uint32_t n_sub;
+
+	for(n_sub = 0u; n_sub < _gpio_subscriber_count; n_sub++)
+	{
+		psub = _gpio_subscribers[n_sub];
+
+		bits[0] = (pbits[0] & psub->mask[0]);
+		bits[1] = (pbits[1] & psub->mask[1]);
+		if(!(bits[0] | bits[1])) continue;
+
+		level = (psub->tail - psub->head);
+		if(level >= __GPIO_SUBSCRIBER_QUEUE)
+		{
+			psub->n_dropped++;
+			continue;
+		}
+
+		precord = &psub->records[psub->tail & (__GPIO_SUBSCRIBER_QUEUE - 1u)];
+		precord->pending[0] = bits[0];
+		precord->pending[1] = bits[1];
+		precord->time_ns = time_ns;
+
+		WRITE_ONCE(psub->tail, psub->tail + 1u);
+		if(level >= psub->level_max) psub->level_max = level + 1u;
+	}
+
+	return;
+}
+
+//Pins with any detector enabled by this driver, from the shadow or a condition arm
+//Status bits of other pins belong to whoever enabled their detection and are left alone
+//Caller holds the event lock
+static uint32_t _gpio_detect_armed(uint8_t n_bank)
+{
+	uint32_t armed;
+	uint8_t detect;
+
+	armed = (_gpio_cond_armed_high[n_bank] | _gpio_cond_armed_low[n_bank]);
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++) armed |= _gpio_shadow_detect[detect][n_bank];
+
+	return armed;
+}
+
+//Interrupt side: move pending event detect bits of armed pins from the hardware to the latch (or the subscriber queues), time stamped
+//Returns 1 and the newly pending bank masks if there were any events, 0 else
+uint8_t _gpio_core_irq(uint64_t time_ns, uint32_t *ppending)
+{
+	uint32_t pending[2];
+	uint32_t sub_bits[2] = {0u, 0u};
+	uint32_t new_bits;
+	uint32_t cond_bits;
+	uint32_t cond_high;
+	uint32_t cond_low;
+	uint32_t rise;
+	uint32_t fall;
+	uint32_t level;
+	uint32_t latch_bits;
+	unsigned long flags;
+	uint8_t n_bank;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	pending[0] = (__GPIO_MMIO_READ(__GPIO_REGINDEX32_EVENTDETECT0_STATUS) & _gpio_detect_armed(0u));
+	pending[1] = (__GPIO_MMIO_READ(__GPIO_REGINDEX32_EVENTDETECT1_STATUS) & _gpio_detect_armed(1u) & __GPIO_BANK1_MASK);
+
+	if(!(pending[0] | pending[1]))
+	{
+		__GPIO_EVENT_UNLOCK(flags);
+		return 0u;
+	}
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		if(!pending[n_bank]) continue;
+
+		cond_bits = (pending[n_bank] & (_gpio_cond_armed_high[n_bank] | _gpio_cond_armed_low[n_bank]));
+		latch_bits = pending[n_bank];
+
+		//A status bit of a condition armed pin only counts as a user event if a user detector of the same kind could have set it:
+		//a rise (or held high) for a high arm, a fall (or held low) for a low arm
+		//A pin already back at the other level has seen both, so the other kind matches too
+		if(cond_bits)
+		{
+			cond_high = (cond_bits & _gpio_cond_armed_high[n_bank]);
+			cond_low = (cond_bits & _gpio_cond_armed_low[n_bank]);
+
+			_gpio_cond_armed_high[n_bank] &= ~cond_bits;
+			_gpio_cond_armed_low[n_bank] &= ~cond_bits;
+
+			rise = (_gpio_shadow_detect[__GPIO_DETECT_REDGE][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_ASYNC_REDGE][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_HIGH][n_bank]);
+			fall = (_gpio_shadow_detect[__GPIO_DETECT_FEDGE][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_ASYNC_FEDGE][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_LOW][n_bank]);
+			level = __GPIO_MMIO_READ(__GPIO_REGINDEX32_INPUT0 + n_bank);
+
+			latch_bits &= ~(cond_bits & ~((cond_high & (rise | (fall & ~level))) | (cond_low & (fall | (rise & level)))));
+		}
+
+		sub_bits[n_bank] = (latch_bits & _gpio_subscribed[n_bank]);
+		latch_bits &= ~sub_bits[n_bank];
+		_gpio_subscriber_held[n_bank] |= (sub_bits[n_bank] & (_gpio_shadow_detect[__GPIO_DETECT_HIGH][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_LOW][n_bank]));
+
+		new_bits = (latch_bits & ~_gpio_event_latched[n_bank]);
+		_gpio_event_latched[n_bank] |= latch_bits;
+
+		while(new_bits)
+		{
+			_gpio_event_time[32u*n_bank + __builtin_ctz(new_bits)] = time_ns;
+			new_bits &= (new_bits - 1u);
+		}
+
+		if(cond_bits || ((latch_bits | sub_bits[n_bank]) & (_gpio_shadow_detect[__GPIO_DETECT_HIGH][n_bank] | _gpio_shadow_detect[__GPIO_DETECT_LOW][n_bank]))) _gpio_level_detect_rearm(n_bank);
+
+		//Cleared after the level detectors are masked, a held level would set the status again
+		__GPIO_MMIO_WRITE(__GPIO_REGINDEX32_EVENTDETECT0_STATUS + n_bank, pending[n_bank]);
+	}
+
+	if(sub_bits[0] | sub_bits[1]) _gpio_subscriber_dispatch(sub_bits, time_ns);
+
+	smp_wmb();
+	WRITE_ONCE(_gpio_status_page[__GPIO_STATUS_EVENT_SEQ], _gpio_status_page[__GPIO_STATUS_EVENT_SEQ] + 1u);
+
+	__GPIO_EVENT_UNLOCK(flags);
+
+	ppending[0] = pending[0];
+	ppending[1] = pending[1];
+	return 1u;
+}
+
+//Lockless check for waiters, returns 1 if any latched event matches the masks
+uint8_t _gpio_event_pending(uint32_t mask0, uint32_t mask1)
+{
+	if((READ_ONCE(_gpio_event_latched[0]) & mask0) | (READ_ONCE(_gpio_event_latched[1]) & mask1)) return 1u;
+	return 0u;
+}
+
+//Take the latched events matching the masks, *ptime_ns is the interrupt time of the earliest of them (0 if none)
+void _gpio_event_consume(uint32_t mask0, uint32_t mask1, uint32_t *ppending, uint64_t *ptime_ns)
+{
+	uint32_t bits;
+	unsigned long flags;
+	uint64_t time_ns = 0u;
+	uint8_t n_bank;
+	uint8_t pin;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	ppending[0] = (_gpio_event_latched[0] & mask0);
+	ppending[1] = (_gpio_event_latched[1] & mask1);
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		if(!ppending[n_bank]) continue;
+
+		_gpio_event_latched[n_bank] &= ~ppending[n_bank];
+		_gpio_level_detect_rearm(n_bank);
+
+		bits = ppending[n_bank];
+		while(bits)
+		{
+			pin = 32u*n_bank + __builtin_ctz(bits);
+			if(!time_ns || (_gpio_event_time[pin] < time_ns)) time_ns = _gpio_event_time[pin];
+			bits &= (bits - 1u);
+		}
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+
+	*ptime_ns = time_ns;
+	return;
+}
+
+//Condition waiters: returns 1 and the bank levels if (INPUT & mask) == value on both banks
+//Else arms level detection of every mismatched pin on the level it waits for and returns 0
+//A level detector fires as soon as it is enabled if its level already holds, so a change between the read and the arm is not missed
+uint8_t _gpio_condition_check(const uint32_t *pmask, const uint32_t *pvalue, uint32_t *plevel)
+{
+	uint32_t mismatch[2];
+	uint32_t bits;
+	unsigned long flags;
+	uint8_t n_bank;
+
+	_gpio_get_banklevel(&plevel[0], &plevel[1]);
+
+	mismatch[0] = ((plevel[0] ^ pvalue[0]) & pmask[0]);
+	mismatch[1] = ((plevel[1] ^ pvalue[1]) & pmask[1] & __GPIO_BANK1_MASK);
+
+	if(!(mismatch[0] | mismatch[1])) return 1u;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		bits = (mismatch[n_bank] & pvalue[n_bank] & ~_gpio_cond_armed_high[n_bank]);
+		if(bits)
+		{
+			_gpio_cond_armed_high[n_bank] |= bits;
+			_gpio_detect_write(__GPIO_DETECT_HIGH, n_bank);
+		}
+
+		bits = (mismatch[n_bank] & ~pvalue[n_bank] & ~_gpio_cond_armed_low[n_bank]);
+		if(bits)
+		{
+			_gpio_cond_armed_low[n_bank] |= bits;
+			_gpio_detect_write(__GPIO_DETECT_LOW, n_bank);
+		}
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+	return 0u;
+}
+
+//Recompute the union of the subscriber masks, release held pins no longer subscribed
+//Caller holds the event lock
+static void _gpio_subscriber_update(void)
+{
+	uint32_t n_sub;
+	uint8_t n_bank;
+
+	_gpio_subscribed[0] = 0u;
+	_gpio_subscribed[1] = 0u;
+
+	for(n_sub = 0u; n_sub < _gpio_subscriber_count; n_sub++)
+	{
+		_gpio_subscribed[0] |= _gpio_subscribers[n_sub]->mask[0];
+		_gpio_subscribed[1] |= _gpio_subscribers[n_sub]->mask[1];
+	}
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		if(!(_gpio_subscriber_held[n_bank] & ~_gpio_subscribed[n_bank])) continue;
+
+		_gpio_subscriber_held[n_bank] &= _gpio_subscribed[n_bank];
+		_gpio_level_detect_rearm(n_bank);
+	}
+
+	return;
+}
+
+//Attach psub with the given masks, or change the masks if it is attached already
+//Returns 1 if successful, 0 if every subscriber slot is taken
+uint8_t _gpio_subscriber_attach(struct _gpio_subscriber *psub, uint32_t mask0, uint32_t mask1)
+{
+	unsigned long flags;
+	uint32_t n_sub;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	for(n_sub = 0u; n_sub < _gpio_subscriber_count; n_sub++)
+		if(_gpio_subscribers[n_sub] == psub) break;
+
+	if(n_sub == _gpio_subscriber_count)
+	{
+		if(_gpio_subscriber_count >= __GPIO_SUBSCRIBER_MAX)
+		{
+			__GPIO_EVENT_UNLOCK(flags);
+			return 0u;
+		}
+
+		_gpio_subscribers[_gpio_subscriber_count++] = psub;
+	}
+
+	psub->mask[0] = mask0;
+	psub->mask[1] = (mask1 & __GPIO_BANK1_MASK);
+	_gpio_subscriber_update();
+
+	__GPIO_EVENT_UNLOCK(flags);
+	return 1u;
+}
+
+void _gpio_subscriber_detach(struct _gpio_subscriber *psub)
+{
+	unsigned long flags;
+	uint32_t n_sub;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	for(n_sub = 0u; n_sub < _gpio_subscriber_count; n_sub++)
+	{
+		if(_gpio_subscribers[n_sub] != psub) continue;
+
+		_gpio_subscribers[n_sub] = _gpio_subscribers[--_gpio_subscriber_count];
+		_gpio_subscriber_update();
+		break;
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+	return;
+}
+
+//Lockless check for waiters, returns 1 if the queue holds a record (or dropped a record since the last read)
+uint8_t _gpio_subscriber_pending(const struct _gpio_subscriber *psub)
+{
+	if(READ_ONCE(psub->tail) != READ_ONCE(psub->head)) return 1u;
+	if(READ_ONCE(psub->n_dropped)) return 1u;
+	return 0u;
+}
+
+//Move up to n_max records to pwords (__GPIO_EVENT_READ_RECORD_WORDS each), returns the number moved
+//*pn_dropped and *plevel_max take the records dropped and the highest fill level since the last read, both then restart
+//Held level detectors of the subscriber's pins are enabled again
+uint32_t _gpio_subscriber_read(struct _gpio_subscriber *psub, uint32_t *pwords, uint32_t n_max, uint32_t *pn_dropped, uint32_t *plevel_max)
+{
+	const struct _gpio_event_record *precord;
+	unsigned long flags;
+	uint32_t n_read = 0u;
+	uint8_t n_bank;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	while((n_read < n_max) && (psub->head != psub->tail))
+	{
+		precord = &psub->records[psub->head & (__GPIO_SUBSCRIBER_QUEUE - 1u)];
+
+		pwords[0] = precord->pending[0];
+		pwords[1] = precord->pending[1];
+		pwords[2] = (uint32_t) precord->time_ns;
+		pwords[3] = (uint32_t) (precord->time_ns >> 32);
+
+		pwords += __GPIO_EVENT_READ_RECORD_WORDS;
+		psub->head++;
+		n_read++;
+	}
+
+	*pn_dropped = psub->n_dropped;
+	*plevel_max = psub->level_max;
+	psub->n_dropped = 0u;
+	psub->level_max = (psub->tail - psub->head);
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		if(!(_gpio_subscriber_held[n_bank] & psub->mask[n_bank])) continue;
+
+		_gpio_subscriber_held[n_bank] &= ~psub->mask[n_bank];
+		_gpio_level_detect_rearm(n_bank);
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+	return n_read;
+}
+
+void _gpio_enable_detect(uint8_t detect, uint8_t pin, uint8_t enable)
+{
+	uint8_t n_bank;
+	uint32_t value;
+	unsigned long flags;
+
+	if(pin > __GPIO_PIN_MAX) return;
+	if(detect >= __GPIO_DETECT_COUNT) return;
+
+	n_bank = (pin >> 5);
+
+	if(enable) value = _gpio_shadow_detect[detect][n_bank] | (1u << (pin & 0x1f));
+	else value = _gpio_shadow_detect[detect][n_bank] & ~(1u << (pin & 0x1f));
+
+	if(value == _gpio_shadow_detect[detect][n_bank]) return;
+
+	__GPIO_EVENT_LOCK(flags);
+
+	_gpio_shadow_detect[detect][n_bank] = value;
+	_gpio_detect_write(detect, n_bank);
+
+	__GPIO_EVENT_UNLOCK(flags);
+
+	_gpio_config_changed();
+	return;
+}
+
+uint8_t _gpio_detect_is_enabled(uint8_t detect, uint8_t pin)
+{
+	if(pin > __GPIO_PIN_MAX) return 0u;
+	if(detect >= __GPIO_DETECT_COUNT) return 0u;
+
+	if(_gpio_shadow_detect[detect][pin >> 5] & (1u << (pin & 0x1f))) return 1u;
+
+	return 0u;
+}
+
+//Load the shadow registers from hardware (once, at initialization)
+void _gpio_shadow_load(void)
+{
+	size_t n_reg;
+	uint8_t detect;
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++)
+		_gpio_shadow_fsel[n_reg] = __GPIO_MMIO_READ(__GPIO_REGINDEX32_FSEL0 + n_reg);
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		_gpio_shadow_detect[detect][0] = __GPIO_MMIO_READ(_gpio_detect_regindex32[detect][0]);
+		_gpio_shadow_detect[detect][1] = __GPIO_MMIO_READ(_gpio_detect_regindex32[detect][1]);
+	}
+
+	_gpio_shadow_pull_known[0] = 0u;
+	_gpio_shadow_pull_known[1] = 0u;
+	return;
+}
+
+//Fill a word payload with the whole configuration: generation, FSEL0-5, detect enables, pull up/down masks
+void _gpio_get_config(uint32_t *pwords)
+{
+	size_t n_reg;
+	uint8_t detect;
+
+	pwords[0] = READ_ONCE(_gpio_status_page[__GPIO_STATUS_GENERATION]);
+	smp_rmb();
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++) pwords[1u + n_reg] = _gpio_shadow_fsel[n_reg];
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		pwords[7u + 2u*detect] = _gpio_shadow_detect[detect][0];
+		pwords[8u + 2u*detect] = _gpio_shadow_detect[detect][1];
+	}
+
+	pwords[19] = _gpio_shadow_pullup[0];
+	pwords[20] = _gpio_shadow_pullup[1];
+	pwords[21] = _gpio_shadow_pulldown[0];
+	pwords[22] = _gpio_shadow_pulldown[1];
+	return;
+}
+
+//Apply a bulk configuration, the word payload holds:
+//FSEL0-5 masks, FSEL0-5 values, configured pin masks (2), pin masks per pull value (3x2), detect enable values (6x2)
+//Each FSEL and detect enable register is written at most once, each pull value costs one PUD sequence
+void _gpio_configure(const uint32_t *pwords)
+{
+	const uint32_t *fsel_mask = &pwords[0];
+	const uint32_t *fsel_value = &pwords[6];
+	const uint32_t *pin_mask = &pwords[12];
+	const uint32_t *pud_mask = &pwords[14];
+	const uint32_t *detect_value = &pwords[20];
+	size_t n_reg;
+	uint8_t n_bank;
+	uint8_t detect;
+	uint8_t pudctrl;
+	uint32_t value;
+	unsigned long flags;
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++)
+	{
+		value = (_gpio_shadow_fsel[n_reg] & ~fsel_mask[n_reg]) | (fsel_value[n_reg] & fsel_mask[n_reg]);
+		if(value == _gpio_shadow_fsel[n_reg]) continue;
+
+		_gpio_shadow_fsel[n_reg] = value;
+		__GPIO_MMIO_WRITE(__GPIO_REGINDEX32_FSEL0 + n_reg, value);
+	}
+
+	for(pudctrl = 0u; pudctrl <= __GPIO_PUDCTRL_MAX; pudctrl++)
+		_gpio_apply_pudctrl(pudctrl, pud_mask[2u*pudctrl], pud_mask[2u*pudctrl + 1u]);
+
+	__GPIO_EVENT_LOCK(flags);
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		for(n_bank = 0u; n_bank < 2u; n_bank++)
+		{
+			value = (_gpio_shadow_detect[detect][n_bank] & ~pin_mask[n_bank]) | (detect_value[2u*detect + n_bank] & pin_mask[n_bank]);
+			if(n_bank) value &= __GPIO_BANK1_MASK;
+
+			if(value == _gpio_shadow_detect[detect][n_bank]) continue;
+
+			_gpio_shadow_detect[detect][n_bank] = value;
+			_gpio_detect_write(detect, n_bank);
+		}
+	}
+
+	__GPIO_EVENT_UNLOCK(flags);
+
+	_gpio_config_changed();
+	return;
+}
+
+//Snapshot of everything a test profile sets up, see __GPIO_DATAIO_STATE_SIZE for the layout
+//Pulls cannot be read back from the hardware, they come from the shadow like in _gpio_get_config()
+void _gpio_state_save(uint32_t *pwords)
+{
+	size_t n_reg;
+	uint8_t detect;
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++) pwords[n_reg] = _gpio_shadow_fsel[n_reg];
+
+	_gpio_get_banklevel(&pwords[6], &pwords[7]);
+
+	pwords[8] = _gpio_shadow_pullup[0];
+	pwords[9] = _gpio_shadow_pullup[1];
+	pwords[10] = _gpio_shadow_pulldown[0];
+	pwords[11] = _gpio_shadow_pulldown[1];
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		pwords[12u + 2u*detect] = _gpio_shadow_detect[detect][0];
+		pwords[13u + 2u*detect] = _gpio_shadow_detect[detect][1];
+	}
+
+	return;
+}
+
+//Reapply a snapshot taken by _gpio_state_save()
+//Output levels are written first so pins turned into outputs come up at their saved level,
+//the rest goes through _gpio_configure(), with PUD sequences only for pins whose pull changes or was never set by this driver
+void _gpio_state_restore(const uint32_t *pwords)
+{
+	uint32_t cfg_words[(__GPIO_DATAIO_CONFIGURE_SIZE - 4UL)/4UL];
+	uint32_t output_mask[2] = {0u, 0u};
+	uint32_t pullup[2];
+	uint32_t pulldown[2];
+	size_t n_reg;
+	uint8_t n_bank;
+	uint8_t pin;
+	uint8_t detect;
+
+	for(pin = 0u; pin <= __GPIO_PIN_MAX; pin++)
+		if(((pwords[pin/10u] >> (3u*(pin%10u))) & 0x7) == __GPIO_PINMODE_OUTPUT) output_mask[pin >> 5] |= (1u << (pin & 0x1f));
+
+	_gpio_set_bankmask((pwords[6] & output_mask[0]), (~pwords[6] & output_mask[0]), (pwords[7] & output_mask[1]), (~pwords[7] & output_mask[1]));
+
+	for(n_reg = 0u; n_reg < __GPIO_FSEL_COUNT; n_reg++)
+	{
+		cfg_words[n_reg] = (n_reg < (__GPIO_FSEL_COUNT - 1u)) ? 0x3fffffffu : 0xfffu;
+		cfg_words[6u + n_reg] = pwords[n_reg];
+	}
+
+	cfg_words[12] = 0xffffffffu;
+	cfg_words[13] = __GPIO_BANK1_MASK;
+
+	for(n_bank = 0u; n_bank < 2u; n_bank++)
+	{
+		pullup[n_bank] = pwords[8u + n_bank];
+		pulldown[n_bank] = (pwords[10u + n_bank] & ~pullup[n_bank]);
+
+		cfg_words[14u + 2u*__GPIO_PUDCTRL_NOPULL + n_bank] = (~(pullup[n_bank] | pulldown[n_bank]) & (_gpio_shadow_pullup[n_bank] | _gpio_shadow_pulldown[n_bank] | ~_gpio_shadow_pull_known[n_bank]));
+		cfg_words[14u + 2u*__GPIO_PUDCTRL_PULLUP + n_bank] = (pullup[n_bank] & ~(_gpio_shadow_pullup[n_bank] & _gpio_shadow_pull_known[n_bank]));
+		cfg_words[14u + 2u*__GPIO_PUDCTRL_PULLDOWN + n_bank] = (pulldown[n_bank] & ~(_gpio_shadow_pulldown[n_bank] & _gpio_shadow_pull_known[n_bank]));
+	}
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++)
+	{
+		cfg_words[20u + 2u*detect] = pwords[12u + 2u*detect];
+		cfg_words[21u + 2u*detect] = pwords[13u + 2u*detect];
+	}
+
+	_gpio_configure(cfg_words);
+	return;
+}
+
+//Apply a whole port write: at most one store per bank to OUTPUTx_SET and OUTPUTx_CLR
+void _gpio_set_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1)
+{
+	set1 &= __GPIO_BANK1_MASK;
+	clr1 &= __GPIO_BANK1_MASK;
+
+	if(set0) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_OUTPUT0_SET, set0);
+	if(clr0) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_OUTPUT0_CLR, clr0);
+	if(set1) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_OUTPUT1_SET, set1);
+	if(clr1) __GPIO_MMIO_WRITE(__GPIO_REGINDEX32_OUTPUT1_CLR, clr1);
+	return;
+}
+
+void _gpio_get_banklevel(uint32_t *plevel0, uint32_t *plevel1)
+{
+	*plevel0 = __GPIO_MMIO_READ(__GPIO_REGINDEX32_INPUT0);
+	*plevel1 = (__GPIO_MMIO_READ(__GPIO_REGINDEX32_INPUT1) & __GPIO_BANK1_MASK);
+	return;
+}
+
+void _gpio_reset_pin(uint8_t pin)
+{
+	uint8_t detect;
+
+	if(pin > __GPIO_PIN_MAX) return;
+
+	for(detect = 0u; detect < __GPIO_DETECT_COUNT; detect++) _gpio_enable_detect(detect, pin, 0u);
+
+	_gpio_set_pudctrl(pin, __GPIO_PUDCTRL_NOPULL);
+	_gpio_set_pinmode(pin, __GPIO_PINMODE_INPUT);
+
+	_gpio_event_detected(pin);
+	return;
+}
+
+void _gpio_core_init(void)
+{
+	uint8_t axis;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		_gpio_motion_axes[axis].configured = 0u;
+		_gpio_motion_axes[axis].state = __GPIO_MOTION_STATE_IDLE;
+		_gpio_motion_axes[axis].position = 0;
+		_gpio_motion_axes[axis].head = 0u;
+		_gpio_motion_axes[axis].tail = 0u;
+	}
+
+	_gpio_subscriber_count = 0u;
+	_gpio_subscribed[0] = 0u;
+	_gpio_subscribed[1] = 0u;
+	_gpio_subscriber_held[0] = 0u;
+	_gpio_subscriber_held[1] = 0u;
+
+	_gpio_shadow_load();
+	return;
+}
+
+//Clear wins within one write, as in _gpio_set_bankmask()
+static void _gpio_batch_add(struct _gpio_write_batch *pbatch, uint8_t n_bank, uint32_t set, uint32_t clr)
+{
+	set &= ~clr;
+
+	pbatch->set[n_bank] = (pbatch->set[n_bank] & ~clr) | set;
+	pbatch->clr[n_bank] = (pbatch->clr[n_bank] & ~set) | clr;
+	return;
+}
+
+void _gpio_batch_commit(struct _gpio_write_batch *pbatch)
+{
+	_gpio_set_bankmask(pbatch->set[0], pbatch->clr[0], pbatch->set[1], pbatch->clr[1]);
+
+	pbatch->active = 0u;
+	pbatch->set[0] = 0u;
+	pbatch->set[1] = 0u;
+	pbatch->clr[0] = 0u;
+	pbatch->clr[1] = 0u;
+	return;
+}
+
+uint8_t _gpio_batch_dispatch(struct _gpio_write_batch *pbatch, uint8_t *data_io, size_t size)
+{
+	const uint32_t *data_io32 = (const uint32_t*) data_io;
+	uint32_t bit_mask;
+
+	switch(data_io[0])
+	{
+		case __GPIO_CMD_WRITE_BEGIN:
+			pbatch->active = 1u;
+			break;
+
+		case __GPIO_CMD_WRITE_COMMIT:
+			_gpio_batch_commit(pbatch);
+			break;
+
+		case __GPIO_CMD_SET_LEVEL:
+			if(!pbatch->active) return 0u;
+			if(data_io[1] > __GPIO_PIN_MAX) break;
+
+			bit_mask = (1u << (data_io[1] & 0x1f));
+
+			if(data_io[2]) _gpio_batch_add(pbatch, (data_io[1] >> 5), bit_mask, 0u);
+			else _gpio_batch_add(pbatch, (data_io[1] >> 5), 0u, bit_mask);
+			break;
+
+		case __GPIO_CMD_SET_BANKMASK:
+			if(!pbatch->active) return 0u;
+			if(size < __GPIO_DATAIO_BANKMASK_SIZE) break;
+
+			_gpio_batch_add(pbatch, 0u, data_io32[1], data_io32[2]);
+			_gpio_batch_add(pbatch, 1u, (data_io32[3] & __GPIO_BANK1_MASK), (data_io32[4] & __GPIO_BANK1_MASK));
+			break;
+
+		default:
+			return 0u;
+	}
+
+	data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	return 1u;
+}
+
+static uint64_t _gpio_isqrt64(uint64_t value)
+{
+	uint64_t root = 0u;
+	uint64_t bit = (1ULL << 62);
+
+	while(bit > value) bit >>= 2;
+
+	while(bit)
+	{
+		if(value >= (root + bit))
+		{
+			value -= (root + bit);
+			root = (root >> 1) + bit;
+		}
+		else root >>= 1;
+
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+//Drive a pin through the set/clr masks of the current engine pass
+static void _gpio_motion_pin(uint32_t *set, uint32_t *clr, uint8_t pin, uint8_t level)
+{
+	if(level) set[pin >> 5] |= (1u << (pin & 0x1f));
+	else clr[pin >> 5] |= (1u << (pin & 0x1f));
+	return;
+}
+
+//Load the next queued move, its dir edge is due at time_ns; moves flagged HOLD wait for MOTION_START
+static void _gpio_motion_begin(struct _gpio_motion_axis *paxis, uint64_t time_ns)
+{
+	if(paxis->head == paxis->tail)
+	{
+		paxis->state = __GPIO_MOTION_STATE_IDLE;
+		return;
+	}
+
+	paxis->move = paxis->queue[paxis->head % __GPIO_MOTION_QUEUE];
+	paxis->head++;
+
+	paxis->ramp_n = 0u;
+	paxis->c = paxis->move.c0;
+	paxis->t_next = time_ns;
+	paxis->state = paxis->move.hold ? __GPIO_MOTION_STATE_HELD : __GPIO_MOTION_STATE_DIR;
+	return;
+}
+
+//Interval to the next step, move.steps holds the steps left after the one just emitted
+//Acceleration: c_n = c_(n-1)*(4n - 1)/(4n + 1) from c_0 (AVR446), clamped at c_min
+//Deceleration starts once the steps left fit in the ramp taken so far, and walks the same recurrence back
+static uint64_t _gpio_motion_interval(struct _gpio_motion_axis *paxis)
+{
+	uint64_t c;
+	uint32_t m;
+
+	if(paxis->move.steps <= paxis->ramp_n)
+	{
+		while(paxis->ramp_n > paxis->move.steps)
+		{
+			m = paxis->ramp_n - 1u;
+			paxis->c = __GPIO_DIV64(paxis->c*(4ULL*m + 1u), (4ULL*m - 1u));
+			paxis->ramp_n--;
+		}
+	}
+	else if((paxis->c > paxis->move.c_min) || !paxis->ramp_n)
+	{
+		if(paxis->ramp_n) c = __GPIO_DIV64(paxis->c*(4ULL*paxis->ramp_n - 1u), (4ULL*paxis->ramp_n + 1u));
+		else c = paxis->move.c0;
+
+		if(c < paxis->move.c_min) paxis->c = paxis->move.c_min;
+		else
+		{
+			paxis->c = c;
+			paxis->ramp_n++;
+		}
+	}
+
+	return (paxis->c >> __GPIO_MOTION_FRAC);
+}
+
+uint64_t _gpio_motion_run(uint64_t now)
+{
+	struct _gpio_motion_axis *paxis;
+	uint32_t set[2] = {0u, 0u};
+	uint32_t clr[2] = {0u, 0u};
+	uint64_t next = 0u;
+	uint8_t axis;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		paxis = &_gpio_motion_axes[axis];
+
+		if((paxis->state == __GPIO_MOTION_STATE_IDLE) || (paxis->state == __GPIO_MOTION_STATE_HELD)) continue;
+
+		if(paxis->t_next <= now)
+		{
+			switch(paxis->state)
+			{
+				//The dir level is set up one pulse width ahead of the first step
+				case __GPIO_MOTION_STATE_DIR:
+					_gpio_motion_pin(set, clr, paxis->dir_pin, paxis->move.reverse);
+					paxis->t_next += paxis->pulse_ns;
+					paxis->state = __GPIO_MOTION_STATE_RISE;
+					break;
+
+				case __GPIO_MOTION_STATE_RISE:
+					_gpio_motion_pin(set, clr, paxis->step_pin, 1u);
+					paxis->position += paxis->move.reverse ? -1 : 1;
+					paxis->move.steps--;
+
+					if(paxis->move.steps) paxis->t_rise = paxis->t_next + _gpio_motion_interval(paxis);
+
+					paxis->t_next += paxis->pulse_ns;
+					paxis->state = __GPIO_MOTION_STATE_FALL;
+					break;
+
+				case __GPIO_MOTION_STATE_FALL:
+					_gpio_motion_pin(set, clr, paxis->step_pin, 0u);
+
+					if(paxis->move.steps)
+					{
+						paxis->t_next = paxis->t_rise;
+						paxis->state = __GPIO_MOTION_STATE_RISE;
+					}
+					else _gpio_motion_begin(paxis, paxis->t_next);
+					break;
+			}
+
+			if((paxis->state == __GPIO_MOTION_STATE_IDLE) || (paxis->state == __GPIO_MOTION_STATE_HELD)) continue;
+		}
+
+		if(!next || (paxis->t_next < next)) next = paxis->t_next;
+	}
+
+	_gpio_set_bankmask(set[0], clr[0], set[1], clr[1]);
+	return next;
+}
+
+//Step and dir pins must already be outputs and not driven by another axis
+static uint8_t _gpio_motion_setup(uint8_t axis, const uint32_t *pwords)
+{
+	struct _gpio_motion_axis *paxis;
+	uint8_t n_axis;
+
+	if(axis >= __GPIO_MOTION_AXES) return 0u;
+	if((pwords[0] > __GPIO_PIN_MAX) || (pwords[1] > __GPIO_PIN_MAX) || (pwords[0] == pwords[1])) return 0u;
+	if((pwords[2] < __GPIO_MOTION_PULSE_NS_MIN) || (pwords[2] > __GPIO_MOTION_PULSE_NS_MAX)) return 0u;
+	if(_gpio_get_pinmode((uint8_t) pwords[0]) != __GPIO_PINMODE_OUTPUT) return 0u;
+	if(_gpio_get_pinmode((uint8_t) pwords[1]) != __GPIO_PINMODE_OUTPUT) return 0u;
+
+	for(n_axis = 0u; n_axis < __GPIO_MOTION_AXES; n_axis++)
+	{
+		if((n_axis == axis) || !_gpio_motion_axes[n_axis].configured) continue;
+
+		paxis = &_gpio_motion_axes[n_axis];
+		if((paxis->step_pin == pwords[0]) || (paxis->step_pin == pwords[1])) return 0u;
+		if((paxis->dir_pin == pwords[0]) || (paxis->dir_pin == pwords[1])) return 0u;
+	}
+
+	paxis = &_gpio_motion_axes[axis];
+	if((paxis->state != __GPIO_MOTION_STATE_IDLE) || (paxis->head != paxis->tail)) return 0u;
+
+	paxis->step_pin = (uint8_t) pwords[0];
+	paxis->dir_pin = (uint8_t) pwords[1];
+	paxis->pulse_ns = pwords[2];
+	paxis->position = 0;
+	paxis->configured = 1u;
+	return 1u;
+}
+
+//Highest max rate among the current and queued moves of an axis, rate counts as one more queued move (0: none)
+static uint32_t _gpio_motion_peak_rate(const struct _gpio_motion_axis *paxis, uint32_t rate)
+{
+	uint32_t n_move;
+
+	if((paxis->state != __GPIO_MOTION_STATE_IDLE) && (paxis->move.rate > rate)) rate = paxis->move.rate;
+
+	for(n_move = paxis->head; n_move != paxis->tail; n_move++)
+		if(paxis->queue[n_move % __GPIO_MOTION_QUEUE].rate > rate) rate = paxis->queue[n_move % __GPIO_MOTION_QUEUE].rate;
+
+	return rate;
+}
+
+//c_0 = 0.676*sqrt(2/accel) s, the first interval corrected for the error of the recurrence at n = 1 (AVR446)
+//The rate is bounded so the step pin spends at least a pulse width low, and so all axes together stay within __GPIO_MOTION_RATE_TOTAL_MAX
+static uint8_t _gpio_motion_move(uint8_t axis, const uint32_t *pwords, uint64_t now)
+{
+	struct _gpio_motion_axis *paxis;
+	struct _gpio_motion_move *pmove;
+	int32_t steps = (int32_t) pwords[0];
+	uint32_t rate = pwords[1];
+	uint32_t accel = pwords[2];
+	uint32_t rate_total = 0u;
+	uint8_t n_axis;
+
+	if(axis >= __GPIO_MOTION_AXES) return 0u;
+
+	paxis = &_gpio_motion_axes[axis];
+	if(!paxis->configured) return 0u;
+	if(!steps || !rate || !accel) return 0u;
+	if(rate > (1000000000u/(2u*paxis->pulse_ns))) return 0u;
+	if((paxis->tail - paxis->head) >= __GPIO_MOTION_QUEUE) return 0u;
+
+	for(n_axis = 0u; n_axis < __GPIO_MOTION_AXES; n_axis++)
+		rate_total += _gpio_motion_peak_rate(&_gpio_motion_axes[n_axis], (n_axis == axis) ? rate : 0u);
+
+	if(rate_total > __GPIO_MOTION_RATE_TOTAL_MAX) return 0u;
+
+	pmove = &paxis->queue[paxis->tail % __GPIO_MOTION_QUEUE];
+	pmove->rate = rate;
+	pmove->reverse = (steps < 0);
+	pmove->steps = (steps < 0) ? (uint32_t) -((int64_t) steps) : (uint32_t) steps;
+	pmove->hold = (pwords[3] & __GPIO_MOTION_FLAG_HOLD) ? 1u : 0u;
+	pmove->c0 = (__GPIO_DIV64(676ULL*_gpio_isqrt64(__GPIO_DIV64(2000000000000000000ULL, accel)), 1000u) << __GPIO_MOTION_FRAC);
+	pmove->c_min = __GPIO_DIV64((1000000000ULL << __GPIO_MOTION_FRAC), rate);
+	paxis->tail++;
+
+	if(paxis->state == __GPIO_MOTION_STATE_IDLE) _gpio_motion_begin(paxis, now);
+	return 1u;
+}
+
+//Held axes start together at time_ns, an axis still busy gets the hold of its next held move released instead
+static void _gpio_motion_start(uint32_t axis_mask, uint64_t time_ns)
+{
+	struct _gpio_motion_axis *paxis;
+	uint32_t n_move;
+	uint8_t axis;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		if(!(axis_mask & (1u << axis))) continue;
+
+		paxis = &_gpio_motion_axes[axis];
+
+		if(paxis->state == __GPIO_MOTION_STATE_HELD)
+		{
+			paxis->move.hold = 0u;
+			paxis->t_next = time_ns;
+			paxis->state = __GPIO_MOTION_STATE_DIR;
+			continue;
+		}
+
+		for(n_move = paxis->head; n_move != paxis->tail; n_move++)
+		{
+			if(!paxis->queue[n_move % __GPIO_MOTION_QUEUE].hold) continue;
+
+			paxis->queue[n_move % __GPIO_MOTION_QUEUE].hold = 0u;
+			break;
+		}
+	}
+
+	return;
+}
+
+//Queued moves are dropped; the current one stops at once, or with STOP_RAMP decelerates over the steps of its ramp
+static void _gpio_motion_stop(uint32_t axis_mask, uint32_t flags, uint32_t *set, uint32_t *clr)
+{
+	struct _gpio_motion_axis *paxis;
+	uint8_t axis;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		if(!(axis_mask & (1u << axis))) continue;
+
+		paxis = &_gpio_motion_axes[axis];
+		paxis->head = paxis->tail;
+
+		switch(paxis->state)
+		{
+			case __GPIO_MOTION_STATE_RISE:
+			case __GPIO_MOTION_STATE_FALL:
+				if(flags & __GPIO_MOTION_STOP_RAMP)
+				{
+					if(paxis->move.steps > paxis->ramp_n) paxis->move.steps = paxis->ramp_n;
+					if(paxis->move.steps || (paxis->state == __GPIO_MOTION_STATE_FALL)) break;
+				}
+
+				//Step drivers latch on the rising edge, a pulse in progress is just ended
+				if(paxis->state == __GPIO_MOTION_STATE_FALL) _gpio_motion_pin(set, clr, paxis->step_pin, 0u);
+				paxis->state = __GPIO_MOTION_STATE_IDLE;
+				break;
+
+			default:
+				paxis->state = __GPIO_MOTION_STATE_IDLE;
+				break;
+		}
+	}
+
+	return;
+}
+
+static void _gpio_motion_status(uint32_t *pwords)
+{
+	struct _gpio_motion_axis *paxis;
+	uint8_t axis;
+
+	pwords[0] = 0u;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		paxis = &_gpio_motion_axes[axis];
+
+		if(paxis->state != __GPIO_MOTION_STATE_IDLE) pwords[0] |= (1u << axis);
+
+		pwords[1u + __GPIO_MOTION_STATUS_WORDS*axis] = (uint32_t) paxis->position;
+		pwords[2u + __GPIO_MOTION_STATUS_WORDS*axis] = (paxis->state == __GPIO_MOTION_STATE_IDLE) ? 0u : paxis->move.steps;
+		pwords[3u + __GPIO_MOTION_STATUS_WORDS*axis] = (paxis->tail - paxis->head);
+	}
+
+	return;
+}
+
+//The earliest pending edge, the platform's timer is (re)armed at it after every command
+static uint64_t _gpio_motion_next(void)
+{
+	uint64_t next = 0u;
+	uint8_t axis;
+
+	for(axis = 0u; axis < __GPIO_MOTION_AXES; axis++)
+	{
+		if((_gpio_motion_axes[axis].state == __GPIO_MOTION_STATE_IDLE) || (_gpio_motion_axes[axis].state == __GPIO_MOTION_STATE_HELD)) continue;
+		if(!next || (_gpio_motion_axes[axis].t_next < next)) next = _gpio_motion_axes[axis].t_next;
+	}
+
+	return next;
+}
+
+uint64_t _gpio_motion_dispatch(uint8_t *data_io, size_t size, uint64_t now)
+{
+	uint32_t *data_io32 = (uint32_t*) data_io;
+	uint32_t set[2] = {0u, 0u};
+	uint32_t clr[2] = {0u, 0u};
+	uint64_t time_ns;
+
+	switch(data_io[0])
+	{
+		case __GPIO_CMD_MOTION_SETUP:
+			data_io[2] = 0u;
+			if(size < __GPIO_DATAIO_MOTION_SETUP_SIZE) break;
+			data_io[2] = _gpio_motion_setup(data_io[1], &data_io32[1]);
+			break;
+
+		case __GPIO_CMD_MOTION_MOVE:
+			data_io[2] = 0u;
+			if(size < __GPIO_DATAIO_MOTION_MOVE_SIZE) break;
+			data_io[2] = _gpio_motion_move(data_io[1], &data_io32[1], now);
+			break;
+
+		case __GPIO_CMD_MOTION_START:
+			if(size < __GPIO_DATAIO_MOTION_START_SIZE) break;
+
+			time_ns = ((uint64_t) data_io32[2]) | (((uint64_t) data_io32[3]) << 32);
+			if(time_ns < now) time_ns = now;
+
+			_gpio_motion_start(data_io32[1], time_ns);
+			break;
+
+		case __GPIO_CMD_MOTION_STOP:
+			if(size < __GPIO_DATAIO_MOTION_STOP_SIZE) break;
+
+			_gpio_motion_stop(data_io32[1], data_io32[2], set, clr);
+			_gpio_set_bankmask(set[0], clr[0], set[1], clr[1]);
+			break;
+
+		case __GPIO_CMD_MOTION_STATUS:
+			if(size < __GPIO_DATAIO_MOTION_STATUS_SIZE) break;
+			_gpio_motion_status(&data_io32[1]);
+			break;
+	}
+
+	data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	return _gpio_motion_next();
+}
+
+void _gpio_core_dispatch(uint8_t *data_io, size_t size)
+{
+	uint32_t *data_io32 = (uint32_t*) data_io;
+
+	switch(data_io[0])
+	{
+		case __GPIO_CMD_RESET_PIN:
+			_gpio_reset_pin(data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_LEVEL:
+			_gpio_set_level(data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_LEVEL:
+			data_io[2] = _gpio_get_level(data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_PINMODE:
+			_gpio_set_pinmode(data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_PINMODE:
+			data_io[2] = _gpio_get_pinmode(data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_PUDCTRL:
+			_gpio_set_pudctrl(data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_EVENTDETECTED:
+			data_io[2] = _gpio_event_detected(data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_REDGEDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_REDGE, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_REDGEDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_REDGE, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_FEDGEDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_FEDGE, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_FEDGEDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_FEDGE, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_ASYNC_REDGEDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_ASYNC_REDGE, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_ASYNC_REDGEDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_ASYNC_REDGE, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_ASYNC_FEDGEDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_ASYNC_FEDGE, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_ASYNC_FEDGEDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_ASYNC_FEDGE, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_HIGHDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_HIGH, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_HIGHDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_HIGH, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_ENABLE_LOWDETECT:
+			_gpio_enable_detect(__GPIO_DETECT_LOW, data_io[1], data_io[2]);
+			break;
+
+		case __GPIO_CMD_GET_ENABLE_LOWDETECT:
+			data_io[2] = _gpio_detect_is_enabled(__GPIO_DETECT_LOW, data_io[1]);
+			break;
+
+		case __GPIO_CMD_SET_BANKMASK:
+			if(size < __GPIO_DATAIO_BANKMASK_SIZE) break;
+			_gpio_set_bankmask(data_io32[1], data_io32[2], data_io32[3], data_io32[4]);
+			break;
+
+		case __GPIO_CMD_GET_BANKLEVEL:
+			_gpio_get_banklevel(&data_io32[1], &data_io32[2]);
+			break;
+
+		case __GPIO_CMD_GET_PUDCTRL:
+			data_io[2] = _gpio_get_pudctrl(data_io[1]);
+			break;
+
+		case __GPIO_CMD_GET_CONFIG:
+			_gpio_get_config(&data_io32[1]);
+			break;
+
+		case __GPIO_CMD_CONFIGURE:
+			if(size < __GPIO_DATAIO_CONFIGURE_SIZE) break;
+			_gpio_configure(&data_io32[1]);
+			break;
+
+		case __GPIO_CMD_STATE_SAVE:
+			_gpio_state_save(&data_io32[1]);
+			break;
+
+		case __GPIO_CMD_STATE_RESTORE:
+			if(size < __GPIO_DATAIO_STATE_SIZE) break;
+			_gpio_state_restore(&data_io32[1]);
+			break;
+	}
+
+	data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	return;
+}
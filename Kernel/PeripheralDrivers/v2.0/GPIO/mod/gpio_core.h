@@ -0,0 +1,375 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+//Register logic and command dispatch shared by the kernel module (gpio_main.c) and the userspace simulator (../gpio_sim.c)
+//Nothing in here may depend on the kernel beyond the platform section below
+
+#ifndef GPIO_CORE_H
+#define GPIO_CORE_H
+
+#include "bcm2837_gpio_mmap.h"
+
+#ifdef __KERNEL__
+
+#include <linux/compiler.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <asm/barrier.h>
+#include "gpio_trace.h"
+
+#define __GPIO_MMIO_READ(regindex32) (_gpio_mmap[regindex32])
+#define __GPIO_MMIO_WRITE(regindex32, value) _gpio_mmio_write((regindex32), (value))
+#define __GPIO_DELAY_US(time_us) udelay(time_us)
+#define __GPIO_DIV64(dividend, divisor) div64_u64((dividend), (divisor))
+
+//Event state is shared with the interrupt handler
+extern spinlock_t _gpio_event_lock;
+
+#define __GPIO_EVENT_LOCK(flags) spin_lock_irqsave(&_gpio_event_lock, flags)
+#define __GPIO_EVENT_UNLOCK(flags) spin_unlock_irqrestore(&_gpio_event_lock, flags)
+
+#else
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//Register accesses go through the simulator hooks, which model the hardware side effects and injected latency
+uint32_t _gpio_sim_mmio_read(size_t regindex32);
+void _gpio_sim_mmio_write(size_t regindex32, uint32_t value);
+void _gpio_sim_delay_us(uint32_t time_us);
+
+#define __GPIO_MMIO_READ(regindex32) _gpio_sim_mmio_read(regindex32)
+#define __GPIO_MMIO_WRITE(regindex32, value) _gpio_sim_mmio_write((regindex32), (value))
+#define __GPIO_DELAY_US(time_us) _gpio_sim_delay_us(time_us)
+#define __GPIO_DIV64(dividend, divisor) ((dividend)/(divisor))
+
+//The simulator serializes commands and its interrupt on one mutex
+#define __GPIO_EVENT_LOCK(flags) ((void) (flags))
+#define __GPIO_EVENT_UNLOCK(flags) ((void) (flags))
+
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define WRITE_ONCE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#define READ_ONCE(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+#endif
+
+#define __GPIO_PINMODE_INPUT 0U
+#define __GPIO_PINMODE_OUTPUT 1U
+#define __GPIO_PINMODE_ALTFUNC0 4U
+#define __GPIO_PINMODE_ALTFUNC1 5U
+#define __GPIO_PINMODE_ALTFUNC2 6U
+#define __GPIO_PINMODE_ALTFUNC3 7U
+#define __GPIO_PINMODE_ALTFUNC4 3U
+#define __GPIO_PINMODE_ALTFUNC5 2U
+
+#define __GPIO_PINMODE_MAX 7U
+
+#define __GPIO_PUDCTRL_NOPULL 0U
+#define __GPIO_PUDCTRL_PULLUP 2U
+#define __GPIO_PUDCTRL_PULLDOWN 1U
+
+#define __GPIO_PUDCTRL_MAX 2U
+
+#define __GPIO_PIN_MAX 53U
+
+#define __GPIO_FSEL_COUNT 6U
+
+#define __GPIO_DETECT_REDGE 0U
+#define __GPIO_DETECT_FEDGE 1U
+#define __GPIO_DETECT_ASYNC_REDGE 2U
+#define __GPIO_DETECT_ASYNC_FEDGE 3U
+#define __GPIO_DETECT_HIGH 4U
+#define __GPIO_DETECT_LOW 5U
+
+#define __GPIO_DETECT_COUNT 6U
+
+//GET_EVENTDETECTED response for a pin whose events go to subscribers
+#define __GPIO_EVENT_SUBSCRIBED 0xffU
+
+#define __GPIO_DATAIO_SIZE 3UL
+#define __GPIO_DATAIO_SIZE_MAX 256UL
+
+//Commands with a word payload carry it as 32 bit words starting at byte 4
+#define __GPIO_DATAIO_BANKMASK_SIZE 20UL
+#define __GPIO_DATAIO_BANKLEVEL_SIZE 12UL
+
+#define __GPIO_DATAIO_CONFIG_SIZE 96UL
+#define __GPIO_DATAIO_CONFIGURE_SIZE 132UL
+
+//WAIT_EVENT: mask0, mask1, timeout_us in, pending0, pending1, irq time (64 bit), wake time (64 bit) out
+#define __GPIO_DATAIO_WAIT_EVENT_SIZE 28UL
+
+//SCHEDULE_WRITE: set0, clr0, set1, clr1, time (64 bit) in, accepted flag in byte 2 out, errno value in word 1 out if refused
+#define __GPIO_DATAIO_SCHEDULE_WRITE_SIZE 28UL
+
+//WAIT_CONDITION: mask0, mask1, value0, value1, timeout_ns (64 bit) in, level0, level1 out, condition met flag in byte 2 out
+#define __GPIO_DATAIO_WAIT_CONDITION_SIZE 28UL
+
+//POLL_SET: event mask0, mask1, level mask0, mask1, level snapshot0, snapshot1 in, descriptor of in-process backends in word 7
+//The open file then polls readable (POLLIN) while events are pending on the event mask,
+//and urgent (POLLPRI) while a pin of the level mask differs from the snapshot
+#define __GPIO_DATAIO_POLL_SET_SIZE 32UL
+
+//SUBSCRIBE: mask0, mask1 in (both zero: unsubscribe), descriptor of in-process backends in word 7, refused flag in byte 2 out
+#define __GPIO_DATAIO_SUBSCRIBE_SIZE 32UL
+
+//EVENT_READ: max records, timeout_us in, descriptor of in-process backends in word 7
+//Record count, dropped count, wake time (64 bit) out, then the records from word __GPIO_EVENT_READ_RECORD_WORD,
+//each pending0, pending1, irq time (64 bit)
+#define __GPIO_DATAIO_EVENT_READ_SIZE __GPIO_DATAIO_SIZE_MAX
+#define __GPIO_EVENT_READ_RECORD_WORD 5U
+#define __GPIO_EVENT_READ_RECORD_WORDS 4U
+#define __GPIO_EVENT_READ_MAX 14U
+
+//STATE_SAVE out, STATE_RESTORE in: FSEL0-5, level0, level1, pullup0, pullup1, pulldown0, pulldown1, detect enables (6x2)
+#define __GPIO_DATAIO_STATE_SIZE 100UL
+
+//MOTION_SETUP: axis in byte 1, step pin, dir pin, pulse_ns in, accepted flag in byte 2 out
+#define __GPIO_DATAIO_MOTION_SETUP_SIZE 16UL
+
+//MOTION_MOVE: axis in byte 1, steps (signed), max rate (steps/s), acceleration (steps/s^2), flags in, accepted flag in byte 2 out
+#define __GPIO_DATAIO_MOTION_MOVE_SIZE 20UL
+
+//MOTION_START: axis mask, start time (64 bit, 0: now) in
+#define __GPIO_DATAIO_MOTION_START_SIZE 16UL
+
+//MOTION_STOP: axis mask, flags in
+#define __GPIO_DATAIO_MOTION_STOP_SIZE 12UL
+
+//MOTION_STATUS: running axis mask out, then per axis from word __GPIO_MOTION_STATUS_WORD: position (signed), steps left in the move, queued moves
+#define __GPIO_DATAIO_MOTION_STATUS_SIZE 104UL
+#define __GPIO_MOTION_STATUS_WORD 2U
+#define __GPIO_MOTION_STATUS_WORDS 3U
+
+#define __GPIO_BANK1_MASK 0x3fffffU
+
+//Submission/completion rings userspace may mmap (offset __GPIO_RING_MMAP_OFFSET, __GPIO_RING_MMAP_SIZE bytes, one pair per open file)
+//Page 0 holds the ring indexes, one per cache line; page 1 the submission entries, page 2 the completion entries
+//Indexes are free running counters, an entry is the first __GPIO_RING_ENTRY_PAYLOAD bytes of a command buffer plus a tag word
+#define __GPIO_RING_MMAP_OFFSET 4096UL
+#define __GPIO_RING_MMAP_SIZE 12288UL
+#define __GPIO_RING_PAGE_WORDS 1024U
+
+#define __GPIO_RING_SQ_HEAD 0U
+#define __GPIO_RING_SQ_TAIL 16U
+#define __GPIO_RING_CQ_HEAD 32U
+#define __GPIO_RING_CQ_TAIL 48U
+#define __GPIO_RING_FLAGS 64U
+
+//Set while the ring thread sleeps, submitters then issue RING_ENTER after publishing their entries
+#define __GPIO_RING_FLAG_NEED_WAKEUP 0x1U
+
+#define __GPIO_RING_ENTRIES 128U
+#define __GPIO_RING_ENTRY_WORDS 8U
+#define __GPIO_RING_ENTRY_PAYLOAD 28UL
+#define __GPIO_RING_ENTRY_TAG 7U
+
+//Response byte of ring entries holding a command the ring cannot run (blocking, or larger than an entry)
+#define __GPIO_RING_REJECTED 0xfe
+
+//Word indexes of the read-only status page userspace may mmap (offset 0)
+#define __GPIO_STATUS_GENERATION 0U
+#define __GPIO_STATUS_EVENT_SEQ 1U
+
+#define __GPIO_CMD_RESET_PIN 0U
+#define __GPIO_CMD_SET_LEVEL 1U
+#define __GPIO_CMD_GET_LEVEL 2U
+#define __GPIO_CMD_SET_PINMODE 3U
+#define __GPIO_CMD_GET_PINMODE 4U
+#define __GPIO_CMD_SET_PUDCTRL 5U
+#define __GPIO_CMD_GET_EVENTDETECTED 6U
+#define __GPIO_CMD_SET_ENABLE_REDGEDETECT 7U
+#define __GPIO_CMD_GET_ENABLE_REDGEDETECT 8U
+#define __GPIO_CMD_SET_ENABLE_FEDGEDETECT 9U
+#define __GPIO_CMD_GET_ENABLE_FEDGEDETECT 10U
+#define __GPIO_CMD_SET_ENABLE_ASYNC_REDGEDETECT 11U
+#define __GPIO_CMD_GET_ENABLE_ASYNC_REDGEDETECT 12U
+#define __GPIO_CMD_SET_ENABLE_ASYNC_FEDGEDETECT 13U
+#define __GPIO_CMD_GET_ENABLE_ASYNC_FEDGEDETECT 14U
+#define __GPIO_CMD_SET_ENABLE_HIGHDETECT 15U
+#define __GPIO_CMD_GET_ENABLE_HIGHDETECT 16U
+#define __GPIO_CMD_SET_ENABLE_LOWDETECT 17U
+#define __GPIO_CMD_GET_ENABLE_LOWDETECT 18U
+#define __GPIO_CMD_SET_BANKMASK 19U
+#define __GPIO_CMD_GET_BANKLEVEL 20U
+#define __GPIO_CMD_GET_PUDCTRL 21U
+#define __GPIO_CMD_GET_CONFIG 22U
+#define __GPIO_CMD_CONFIGURE 23U
+
+//Commands needing sleeps or timers are executed by the platform (gpio_main.c, gpio_sim.c) outside the command lock
+#define __GPIO_CMD_WAIT_EVENT 24U
+#define __GPIO_CMD_SCHEDULE_WRITE 25U
+#define __GPIO_CMD_SCHEDULE_CANCEL 26U
+#define __GPIO_CMD_WAIT_CONDITION 27U
+#define __GPIO_CMD_RING_ENTER 28U
+#define __GPIO_CMD_POLL_SET 29U
+#define __GPIO_CMD_SUBSCRIBE 30U
+#define __GPIO_CMD_EVENT_READ 31U
+
+#define __GPIO_CMD_STATE_SAVE 32U
+#define __GPIO_CMD_STATE_RESTORE 33U
+
+//Between WRITE_BEGIN and WRITE_COMMIT the SET_LEVEL and SET_BANKMASK commands of a client are deferred, see struct _gpio_write_batch
+#define __GPIO_CMD_WRITE_BEGIN 34U
+#define __GPIO_CMD_WRITE_COMMIT 35U
+
+//Stepper motion engine, executed by the platform, which runs the engine from a timer (gpio_motion.c, gpio_sim.c)
+#define __GPIO_CMD_MOTION_SETUP 36U
+#define __GPIO_CMD_MOTION_MOVE 37U
+#define __GPIO_CMD_MOTION_START 38U
+#define __GPIO_CMD_MOTION_STOP 39U
+#define __GPIO_CMD_MOTION_STATUS 40U
+
+#define __GPIO_CMD_COUNT 41U
+
+#define __GPIO_CMD_KERNEL_RESPONSE 0xff
+
+//Event subscribers: each has its own queue, filled by the interrupt path with the events of the pins in its mask
+//Events of subscribed pins go to every subscriber of the pin instead of the shared latch
+#define __GPIO_SUBSCRIBER_MAX 32U
+#define __GPIO_SUBSCRIBER_QUEUE 256U
+
+struct _gpio_event_record {
+	uint32_t pending[2];
+	uint64_t time_ns;
+};
+
+//Allocated by the platform, head and tail are free running counters
+struct _gpio_subscriber {
+	uint32_t mask[2];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t n_dropped;
+	uint32_t level_max;
+	struct _gpio_event_record records[__GPIO_SUBSCRIBER_QUEUE];
+};
+
+//Deferred output writes of one client (open file), merged per bank in submission order: a later write to a pin overrides an earlier one
+//Set and clear masks stay disjoint, so the commit is at most one OUTPUTx_SET and one OUTPUTx_CLR store per bank
+struct _gpio_write_batch {
+	uint8_t active;
+	uint32_t set[2];
+	uint32_t clr[2];
+};
+
+//Stepper axes: step/dir pins driven from a timer, moves follow a trapezoidal profile (AVR446 integer recurrence)
+//Each axis runs its queue of moves back to back, a move flagged HOLD waits for MOTION_START, which starts several axes in sync
+#define __GPIO_MOTION_AXES 8U
+#define __GPIO_MOTION_QUEUE 16U
+
+#define __GPIO_MOTION_FLAG_HOLD 0x1U
+#define __GPIO_MOTION_STOP_RAMP 0x1U
+
+//Pulse width and dir setup time, bounded so a bad value cannot stall the timer
+#define __GPIO_MOTION_PULSE_NS_MIN 1000U
+#define __GPIO_MOTION_PULSE_NS_MAX 100000U
+
+//Sum over all axes of the highest max rate each has running or queued, every step costs the timer two expiries
+#define __GPIO_MOTION_RATE_TOTAL_MAX 40000U
+
+//Step intervals are kept in ns with __GPIO_MOTION_FRAC fractional bits, the recurrence would drift on whole ns
+#define __GPIO_MOTION_FRAC 8U
+
+#define __GPIO_MOTION_STATE_IDLE 0U
+#define __GPIO_MOTION_STATE_HELD 1U
+#define __GPIO_MOTION_STATE_DIR 2U
+#define __GPIO_MOTION_STATE_RISE 3U
+#define __GPIO_MOTION_STATE_FALL 4U
+
+struct _gpio_motion_move {
+	uint32_t steps;
+	uint32_t rate;
+	uint8_t reverse;
+	uint8_t hold;
+	uint64_t c0;
+	uint64_t c_min;
+};
+
+struct _gpio_motion_axis {
+	uint8_t configured;
+	uint8_t step_pin;
+	uint8_t dir_pin;
+	uint8_t state;
+	uint32_t pulse_ns;
+	int32_t position;
+	uint64_t t_next;
+	uint64_t t_rise;
+	struct _gpio_motion_move move;
+	uint32_t ramp_n;
+	uint64_t c;
+	uint32_t head;
+	uint32_t tail;
+	struct _gpio_motion_move queue[__GPIO_MOTION_QUEUE];
+};
+
+//Register page and status page, set up by the platform before _gpio_core_init()
+extern uint32_t *_gpio_mmap;
+extern uint32_t *_gpio_status_page;
+
+#ifdef __KERNEL__
+static inline void _gpio_mmio_write(size_t regindex32, uint32_t value)
+{
+	trace_gpioctrl_mmio_write(regindex32, value);
+	_gpio_mmap[regindex32] = value;
+	return;
+}
+#endif
+
+//Load the shadow registers from the hardware
+void _gpio_core_init(void);
+
+//Execute the command held in a word aligned command buffer of __GPIO_DATAIO_SIZE_MAX bytes, size is the byte count received
+//Callers must serialize calls, the response replaces the command in the same buffer
+void _gpio_core_dispatch(uint8_t *data_io, size_t size);
+
+//Run WRITE_BEGIN/WRITE_COMMIT, and output writes while the batch is active, returns 1 if the command was consumed
+//Platforms call it before _gpio_core_dispatch(), under the same serialization
+uint8_t _gpio_batch_dispatch(struct _gpio_write_batch *pbatch, uint8_t *data_io, size_t size);
+
+//Apply and reset the batch, also used by the platform to flush the batch of a client going away
+void _gpio_batch_commit(struct _gpio_write_batch *pbatch);
+
+//Motion engine, callers serialize it against the platform's motion timer
+//Execute a MOTION_* command, returns the time the engine next needs to run (0: idle)
+uint64_t _gpio_motion_dispatch(uint8_t *data_io, size_t size, uint64_t now);
+
+//Emit the step/dir edges due at now, at most one per axis, returns the time of the next one (0: idle)
+uint64_t _gpio_motion_run(uint64_t now);
+
+void _gpio_set_level(uint8_t pin, uint8_t level);
+uint8_t _gpio_get_level(uint8_t pin);
+void _gpio_set_pinmode(uint8_t pin, uint8_t pinmode);
+uint8_t _gpio_get_pinmode(uint8_t pin);
+void _gpio_apply_pudctrl(uint8_t pudctrl, uint32_t mask0, uint32_t mask1);
+void _gpio_set_pudctrl(uint8_t pin, uint8_t pudctrl);
+uint8_t _gpio_get_pudctrl(uint8_t pin);
+uint8_t _gpio_event_detected(uint8_t pin);
+void _gpio_enable_detect(uint8_t detect, uint8_t pin, uint8_t enable);
+uint8_t _gpio_detect_is_enabled(uint8_t detect, uint8_t pin);
+void _gpio_get_config(uint32_t *pwords);
+void _gpio_configure(const uint32_t *pwords);
+void _gpio_state_save(uint32_t *pwords);
+void _gpio_state_restore(const uint32_t *pwords);
+void _gpio_set_bankmask(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1);
+void _gpio_get_banklevel(uint32_t *plevel0, uint32_t *plevel1);
+void _gpio_reset_pin(uint8_t pin);
+
+uint8_t _gpio_core_irq(uint64_t time_ns, uint32_t *ppending);
+uint8_t _gpio_event_pending(uint32_t mask0, uint32_t mask1);
+void _gpio_event_consume(uint32_t mask0, uint32_t mask1, uint32_t *ppending, uint64_t *ptime_ns);
+uint8_t _gpio_condition_check(const uint32_t *pmask, const uint32_t *pvalue, uint32_t *plevel);
+
+uint8_t _gpio_subscriber_attach(struct _gpio_subscriber *psub, uint32_t mask0, uint32_t mask1);
+void _gpio_subscriber_detach(struct _gpio_subscriber *psub);
+uint8_t _gpio_subscriber_pending(const struct _gpio_subscriber *psub);
+uint32_t _gpio_subscriber_read(struct _gpio_subscriber *psub, uint32_t *pwords, uint32_t n_max, uint32_t *pn_dropped, uint32_t *plevel_max);
+
+#endif //GPIO_CORE_H
@@ -0,0 +1,1070 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#define CREATE_TRACE_POINTS
+#include "gpio_trace.h"
+
+#include "gpio_core.h"
+#include "gpio_sched.h"
+#include "gpio_motion.h"
+#include "gpio_stats.h"
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/firmware.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/of_irq.h>
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <asm/io.h>
+
+static struct proc_dir_entry *_gpio_proc = NULL;
+
+//Serializes register and shadow access between concurrent callers
+static DEFINE_MUTEX(_gpio_mutex);
+
+//Woken whenever the interrupt path latches new events
+static DECLARE_WAIT_QUEUE_HEAD(_gpio_event_wq);
+
+//Set at unload before the proc file goes away, sleepers on the event queue give up so proc_remove() does not wait on them
+static bool _gpio_shutdown = false;
+
+//Bank 0/1 interrupts, looked up in the device tree unless given at load time
+static int _gpio_irq[2] = {0, 0};
+module_param_array_named(irq, _gpio_irq, int, NULL, 0444);
+MODULE_PARM_DESC(irq, "GPIO bank 0,1 interrupt numbers (default: from the brcm,bcm2835-gpio device tree node)");
+
+static bool _gpio_irq_requested[2] = {false, false};
+
+//Without an interrupt (e.g. held exclusively by the pinctrl driver) the event status is polled from an hrtimer
+//The timer only runs while someone can consume events: a sleeping waiter, a subscribed file or a file with poll masks set
+static unsigned int _gpio_poll_us = 100U;
+module_param_named(poll_us, _gpio_poll_us, uint, 0444);
+MODULE_PARM_DESC(poll_us, "Event status polling period in microseconds when no interrupt is available, only while events are waited on (default 100)");
+
+static struct hrtimer _gpio_poll_timer;
+static bool _gpio_poll_active = false;
+static DEFINE_SPINLOCK(_gpio_poll_lock);
+static unsigned int _gpio_poll_users = 0U;
+static bool _gpio_poll_running = false;
+
+//Boot profile applied before the proc file appears: a saved state (gpio_state_t) as 24 words, or the name of a firmware file holding one
+//The firmware file takes precedence, see __GPIO_DATAIO_STATE_SIZE for the layout
+static unsigned int _gpio_profile[(__GPIO_DATAIO_STATE_SIZE - 4UL)/4UL];
+static int _gpio_profile_words = 0;
+module_param_array_named(profile, _gpio_profile, uint, &_gpio_profile_words, 0444);
+MODULE_PARM_DESC(profile, "Initial state of all pins: FSEL0-5, level0-1, pullup0-1, pulldown0-1, detect enables (6x2), 24 words");
+
+static char *_gpio_profile_fw = NULL;
+module_param_named(profile_fw, _gpio_profile_fw, charp, 0444);
+MODULE_PARM_DESC(profile_fw, "Firmware file holding the initial state of all pins, as written from a gpio_state_t (96 bytes)");
+
+//Shared submission/completion rings of one open file, sq_head and cq_tail are only trusted from here
+struct _gpio_ring {
+	struct list_head list;
+	uint32_t *pheader;
+	uint32_t *psq;
+	uint32_t *pcq;
+	uint32_t sq_head;
+	uint32_t cq_tail;
+	struct _gpio_write_batch *pbatch;
+};
+
+//Per open file state, the command buffer comes first so it stays word aligned
+//The write batch is shared by the file's writes and its ring, both run it under _gpio_mutex
+//The subscriber queue is allocated by the first SUBSCRIBE and kept until release, unsubscribing only detaches it
+//subscribed and the queue are changed and read under sub_mutex, EVENT_READ drops it while sleeping
+//poll_user is set while the file holds a reference on the polling timer (subscribed or poll masks set), under sub_mutex
+struct _gpio_file {
+	uint8_t data_io[__GPIO_DATAIO_SIZE_MAX];
+	struct _gpio_ring *pring;
+	uint32_t poll_event_mask[2];
+	uint32_t poll_level_mask[2];
+	uint32_t poll_level_snapshot[2];
+	struct _gpio_subscriber *psub;
+	struct mutex sub_mutex;
+	bool subscribed;
+	bool poll_user;
+	struct _gpio_write_batch batch;
+};
+
+//Rings are executed by one kernel thread, which polls them for ring_idle_us after the last command and then sleeps until RING_ENTER
+static int _gpio_ring_cpu = -1;
+module_param_named(ring_cpu, _gpio_ring_cpu, int, 0444);
+MODULE_PARM_DESC(ring_cpu, "CPU the ring thread is bound to, e.g. one isolated with isolcpus= (default -1: not bound)");
+
+static unsigned int _gpio_ring_idle_us = 1000U;
+module_param_named(ring_idle_us, _gpio_ring_idle_us, uint, 0644);
+MODULE_PARM_DESC(ring_idle_us, "Time the ring thread keeps polling after the last command before it sleeps, 0: sleep at once (default 1000)");
+
+static LIST_HEAD(_gpio_ring_list);
+static DEFINE_MUTEX(_gpio_ring_mutex);
+
+static struct task_struct *_gpio_ring_task = NULL;
+static DECLARE_WAIT_QUEUE_HEAD(_gpio_ring_wq);
+static bool _gpio_ring_kick = false;
+
+static int _gpio_mod_usropen(struct inode *pinode, struct file *pfile);
+static int _gpio_mod_usrrelease(struct inode *pinode, struct file *pfile);
+static ssize_t _gpio_mod_usrread(struct file *pfile, char __user *usrbuf, size_t size, loff_t *poffset64);
+static ssize_t _gpio_mod_usrwrite(struct file *pfile, const char __user *usrbuf, size_t size, loff_t *poffset64);
+static int _gpio_mod_usrmmap(struct file *pfile, struct vm_area_struct *vma);
+static __poll_t _gpio_mod_usrpoll(struct file *pfile, struct poll_table_struct *pwait);
+
+static const struct proc_ops _gpio_proc_ops = {
+	.proc_open = &_gpio_mod_usropen,
+	.proc_release = &_gpio_mod_usrrelease,
+	.proc_read = &_gpio_mod_usrread,
+	.proc_write = &_gpio_mod_usrwrite,
+	.proc_mmap = &_gpio_mod_usrmmap,
+	.proc_poll = &_gpio_mod_usrpoll
+};
+
+static irqreturn_t _gpio_mod_irq(int irq, void *dev_id);
+static enum hrtimer_restart _gpio_mod_poll(struct hrtimer *ptimer);
+static void _gpio_mod_poll_get(void);
+static void _gpio_mod_poll_put(void);
+
+static int __init _gpio_mod_enable(void);
+static void __exit _gpio_mod_disable(void);
+
+//Each open file gets its own command buffer, so concurrent clients never see each other's responses
+static int _gpio_mod_usropen(struct inode *pinode, struct file *pfile)
+{
+	struct _gpio_file *pgpiofile;
+
+	pgpiofile = kzalloc(sizeof(struct _gpio_file), GFP_KERNEL);
+	if(pgpiofile == NULL) return -ENOMEM;
+
+	mutex_init(&pgpiofile->sub_mutex);
+
+	pfile->private_data = pgpiofile;
+	return 0;
+}
+
+//Called once the last descriptor and mapping of the file are gone (a mapping holds the file), or at proc_remove() for files still open
+//Ring mappings also pin the module, so the rings are only freed once the last mapping and file are gone
+static int _gpio_mod_usrrelease(struct inode *pinode, struct file *pfile)
+{
+	struct _gpio_file *pgpiofile = (struct _gpio_file*) pfile->private_data;
+
+	if(pgpiofile->pring != NULL)
+	{
+		mutex_lock(&_gpio_ring_mutex);
+		list_del(&pgpiofile->pring->list);
+		mutex_unlock(&_gpio_ring_mutex);
+
+		free_pages_exact(pgpiofile->pring->pheader, __GPIO_RING_MMAP_SIZE);
+		kfree(pgpiofile->pring);
+	}
+
+	if(pgpiofile->subscribed) _gpio_subscriber_detach(pgpiofile->psub);
+	kfree(pgpiofile->psub);
+
+	if(pgpiofile->poll_user) _gpio_mod_poll_put();
+
+	//Writes deferred by a client that never committed still go out
+	mutex_lock(&_gpio_mutex);
+	if(pgpiofile->batch.active) _gpio_batch_commit(&pgpiofile->batch);
+	mutex_unlock(&_gpio_mutex);
+
+	kfree(pgpiofile);
+	pfile->private_data = NULL;
+	return 0;
+}
+
+static ssize_t _gpio_mod_usrread(struct file *pfile, char __user *usrbuf, size_t size, loff_t *poffset64)
+{
+	uint8_t *data_io = ((struct _gpio_file*) pfile->private_data)->data_io;
+	ssize_t n_ret;
+
+	if(size > __GPIO_DATAIO_SIZE_MAX) size = __GPIO_DATAIO_SIZE_MAX;
+	if(size < __GPIO_DATAIO_SIZE) size = __GPIO_DATAIO_SIZE;
+
+	n_ret = copy_to_user(usrbuf, data_io, size);
+	return n_ret;
+}
+
+//Latch pending events and wake the waiters, shared by the interrupt handler and the polling timer
+static uint8_t _gpio_mod_service_events(void)
+{
+	uint32_t pending[2];
+
+	if(!_gpio_core_irq(ktime_get_ns(), pending)) return 0U;
+
+	trace_gpioctrl_irq(pending[0], pending[1]);
+	_gpio_stats_irq();
+
+	wake_up_interruptible_all(&_gpio_event_wq);
+	return 1U;
+}
+
+static irqreturn_t _gpio_mod_irq(int irq, void *dev_id)
+{
+	if(_gpio_mod_service_events()) return IRQ_HANDLED;
+	return IRQ_NONE;
+}
+
+//Stops once the last user is gone, the next _gpio_mod_poll_get() starts it again
+static enum hrtimer_restart _gpio_mod_poll(struct hrtimer *ptimer)
+{
+	unsigned long flags;
+
+	_gpio_mod_service_events();
+
+	spin_lock_irqsave(&_gpio_poll_lock, flags);
+
+	if(!_gpio_poll_users)
+	{
+		_gpio_poll_running = false;
+		spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	hrtimer_forward_now(ptimer, ns_to_ktime(1000ULL*_gpio_poll_us));
+	spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+	return HRTIMER_RESTART;
+}
+
+//Take a reference on the polling timer, starting it if needed (no-op with interrupts available)
+//Events already pending are serviced at once, a waiter checking right after does not wait for the first period
+static void _gpio_mod_poll_get(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&_gpio_poll_lock, flags);
+
+	if(!_gpio_poll_active)
+	{
+		spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+		return;
+	}
+
+	_gpio_poll_users++;
+
+	if(!_gpio_poll_running)
+	{
+		_gpio_poll_running = true;
+		hrtimer_start(&_gpio_poll_timer, ns_to_ktime(1000ULL*_gpio_poll_us), HRTIMER_MODE_REL);
+	}
+
+	spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+
+	_gpio_mod_service_events();
+	return;
+}
+
+static void _gpio_mod_poll_put(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&_gpio_poll_lock, flags);
+	if(_gpio_poll_active && _gpio_poll_users) _gpio_poll_users--;
+	spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+	return;
+}
+
+//Hold a polling reference while the file is subscribed or has poll masks set
+//Caller holds sub_mutex
+static void _gpio_mod_poll_update(struct _gpio_file *pgpiofile)
+{
+	bool poll_user;
+
+	poll_user = (pgpiofile->subscribed || pgpiofile->poll_event_mask[0] || pgpiofile->poll_event_mask[1] ||
+		pgpiofile->poll_level_mask[0] || pgpiofile->poll_level_mask[1]);
+
+	if(poll_user == pgpiofile->poll_user) return;
+
+	if(poll_user) _gpio_mod_poll_get();
+	else _gpio_mod_poll_put();
+
+	pgpiofile->poll_user = poll_user;
+	return;
+}
+
+//Sleep (without the command mutex) until an event is latched on one of the requested pins, or the timeout elapses
+//Returns 0, -ERESTARTSYS if interrupted by a signal or -ENODEV if the module is unloading (no response written)
+static int _gpio_mod_wait_event(uint32_t *data_io32)
+{
+	uint32_t mask0 = data_io32[1];
+	uint32_t mask1 = (data_io32[2] & __GPIO_BANK1_MASK);
+	uint32_t timeout_us = data_io32[3];
+	uint64_t irq_time;
+	uint64_t wake_time;
+	int n_ret = 0;
+
+	_gpio_mod_poll_get();
+	if(timeout_us) n_ret = wait_event_interruptible_hrtimeout(_gpio_event_wq, (_gpio_event_pending(mask0, mask1) || READ_ONCE(_gpio_shutdown)), ns_to_ktime(1000ULL*timeout_us));
+	_gpio_mod_poll_put();
+
+	if(n_ret == -ERESTARTSYS) return n_ret;
+	if(READ_ONCE(_gpio_shutdown)) return -ENODEV;
+
+	wake_time = ktime_get_ns();
+
+	mutex_lock(&_gpio_mutex);
+	_gpio_event_consume(mask0, mask1, &data_io32[1], &irq_time);
+	mutex_unlock(&_gpio_mutex);
+
+	data_io32[3] = (uint32_t) irq_time;
+	data_io32[4] = (uint32_t) (irq_time >> 32);
+	data_io32[5] = (uint32_t) wake_time;
+	data_io32[6] = (uint32_t) (wake_time >> 32);
+	return 0;
+}
+
+//Sleep (without the command mutex) until (INPUT & mask) == value on both banks, or the timeout elapses
+//Every wakeup of the event queue re-reads the levels and re-arms detection of the pins still mismatched
+//A timeout of KTIME_MAX or more waits without a timer, only the condition, a signal or unloading end it
+//Returns 0, -ERESTARTSYS if interrupted by a signal or -ENODEV if the module is unloading (no response written)
+static int _gpio_mod_wait_condition(uint32_t *data_io32)
+{
+	uint32_t mask[2];
+	uint32_t value[2];
+	uint32_t level[2];
+	uint64_t timeout_ns;
+	uint8_t met;
+	int n_ret;
+
+	mask[0] = data_io32[1];
+	mask[1] = (data_io32[2] & __GPIO_BANK1_MASK);
+	value[0] = (data_io32[3] & mask[0]);
+	value[1] = (data_io32[4] & mask[1]);
+
+	timeout_ns = ((uint64_t) data_io32[5]) | (((uint64_t) data_io32[6]) << 32);
+	if(timeout_ns > (uint64_t) KTIME_MAX) timeout_ns = (uint64_t) KTIME_MAX;
+
+	met = _gpio_condition_check(mask, value, level);
+
+	if(!met && timeout_ns)
+	{
+		_gpio_mod_poll_get();
+		n_ret = wait_event_interruptible_hrtimeout(_gpio_event_wq, (_gpio_condition_check(mask, value, level) || READ_ONCE(_gpio_shutdown)), ns_to_ktime(timeout_ns));
+		_gpio_mod_poll_put();
+
+		if(n_ret == -ERESTARTSYS) return n_ret;
+		if(READ_ONCE(_gpio_shutdown)) return -ENODEV;
+
+		met = _gpio_condition_check(mask, value, level);
+	}
+
+	data_io32[1] = level[0];
+	data_io32[2] = level[1];
+	((uint8_t*) data_io32)[2] = met;
+	return 0;
+}
+
+//A refused write reports why in word 1 (ENOSPC: queue full, ENOMEM, ENODEV: unloading)
+static void _gpio_mod_schedule_write(uint32_t *data_io32)
+{
+	uint64_t time_ns;
+	int n_ret;
+
+	time_ns = ((uint64_t) data_io32[5]) | (((uint64_t) data_io32[6]) << 32);
+
+	n_ret = _gpio_sched_write(data_io32[1], data_io32[2], data_io32[3], data_io32[4], time_ns);
+
+	if(n_ret)
+	{
+		data_io32[1] = (uint32_t) -n_ret;
+		((uint8_t*) data_io32)[2] = 0U;
+	}
+	else ((uint8_t*) data_io32)[2] = 1U;
+
+	return;
+}
+
+static void _gpio_mod_poll_set(struct _gpio_file *pgpiofile, const uint32_t *data_io32)
+{
+	pgpiofile->poll_event_mask[0] = data_io32[1];
+	pgpiofile->poll_event_mask[1] = (data_io32[2] & __GPIO_BANK1_MASK);
+	pgpiofile->poll_level_mask[0] = data_io32[3];
+	pgpiofile->poll_level_mask[1] = (data_io32[4] & __GPIO_BANK1_MASK);
+	pgpiofile->poll_level_snapshot[0] = (data_io32[5] & pgpiofile->poll_level_mask[0]);
+	pgpiofile->poll_level_snapshot[1] = (data_io32[6] & pgpiofile->poll_level_mask[1]);
+
+	mutex_lock(&pgpiofile->sub_mutex);
+	_gpio_mod_poll_update(pgpiofile);
+	mutex_unlock(&pgpiofile->sub_mutex);
+
+	//Pollers sleeping on the previous masks re-evaluate the new ones
+	wake_up_interruptible_all(&_gpio_event_wq);
+	return;
+}
+
+//Subscribe the file to the pins of the masks, or unsubscribe it (both masks zero)
+static void _gpio_mod_subscribe(struct _gpio_file *pgpiofile, uint32_t *data_io32)
+{
+	uint32_t mask0 = data_io32[1];
+	uint32_t mask1 = (data_io32[2] & __GPIO_BANK1_MASK);
+
+	((uint8_t*) data_io32)[2] = 0U;
+
+	mutex_lock(&pgpiofile->sub_mutex);
+
+	if(!(mask0 | mask1))
+	{
+		if(pgpiofile->subscribed)
+		{
+			_gpio_subscriber_detach(pgpiofile->psub);
+			WRITE_ONCE(pgpiofile->subscribed, false);
+
+			//A reader sleeping on the queue returns empty
+			wake_up_interruptible_all(&_gpio_event_wq);
+		}
+
+		_gpio_mod_poll_update(pgpiofile);
+		mutex_unlock(&pgpiofile->sub_mutex);
+		return;
+	}
+
+	if(pgpiofile->psub == NULL) pgpiofile->psub = kzalloc(sizeof(struct _gpio_subscriber), GFP_KERNEL);
+
+	//A new subscription starts with an empty queue, a detached queue is not touched by the interrupt path
+	if((pgpiofile->psub != NULL) && !pgpiofile->subscribed) memset(pgpiofile->psub, 0, sizeof(struct _gpio_subscriber));
+
+	//Only a file not yet subscribed can fail (no memory, subscriber table full), it stays unsubscribed
+	if((pgpiofile->psub != NULL) && _gpio_subscriber_attach(pgpiofile->psub, mask0, mask1)) WRITE_ONCE(pgpiofile->subscribed, true);
+	else ((uint8_t*) data_io32)[2] = 1U;
+
+	_gpio_mod_poll_update(pgpiofile);
+	mutex_unlock(&pgpiofile->sub_mutex);
+	return;
+}
+
+//Sleep (without the command mutex nor sub_mutex) until the file's queue holds records, the file unsubscribes or the timeout elapses,
+//then move the records to the buffer
+//The queue stays allocated until release, which cannot run during a write to the file
+//Returns 0, -ERESTARTSYS if interrupted by a signal or -ENODEV if the module is unloading (no response written)
+static int _gpio_mod_event_read(struct _gpio_file *pgpiofile, uint32_t *data_io32)
+{
+	struct _gpio_subscriber *psub;
+	uint32_t n_max = data_io32[1];
+	uint32_t timeout_us = data_io32[2];
+	uint32_t n_dropped = 0U;
+	uint32_t level_max = 0U;
+	uint32_t n_read = 0U;
+	uint64_t wake_time;
+	int n_ret = 0;
+
+	if(n_max > __GPIO_EVENT_READ_MAX) n_max = __GPIO_EVENT_READ_MAX;
+
+	mutex_lock(&pgpiofile->sub_mutex);
+	psub = pgpiofile->subscribed ? pgpiofile->psub : NULL;
+	mutex_unlock(&pgpiofile->sub_mutex);
+
+	//The file's subscription already holds a polling reference
+	if((psub != NULL) && timeout_us)
+		n_ret = wait_event_interruptible_hrtimeout(_gpio_event_wq, (_gpio_subscriber_pending(psub) || !READ_ONCE(pgpiofile->subscribed) || READ_ONCE(_gpio_shutdown)), ns_to_ktime(1000ULL*timeout_us));
+
+	if(n_ret == -ERESTARTSYS) return n_ret;
+	if(READ_ONCE(_gpio_shutdown)) return -ENODEV;
+
+	mutex_lock(&pgpiofile->sub_mutex);
+
+	if(pgpiofile->subscribed)
+	{
+		n_read = _gpio_subscriber_read(pgpiofile->psub, &data_io32[__GPIO_EVENT_READ_RECORD_WORD], n_max, &n_dropped, &level_max);
+		_gpio_stats_queue_level(level_max);
+	}
+
+	mutex_unlock(&pgpiofile->sub_mutex);
+
+	wake_time = ktime_get_ns();
+
+	data_io32[1] = n_read;
+	data_io32[2] = n_dropped;
+	data_io32[3] = (uint32_t) wake_time;
+	data_io32[4] = (uint32_t) (wake_time >> 32);
+	return 0;
+}
+
+static void _gpio_mod_ring_enter(void)
+{
+	WRITE_ONCE(_gpio_ring_kick, true);
+	wake_up_interruptible(&_gpio_ring_wq);
+	return;
+}
+
+//Execute one command from a file write or a ring entry (pgpiofile NULL), size is the byte count received
+//pbatch is the write batch of the file the command came from
+//Returns 0, or the error of a sleeping command that ended without a response (signal, unloading)
+static int _gpio_mod_execute(struct _gpio_file *pgpiofile, struct _gpio_write_batch *pbatch, uint8_t *data_io, size_t size)
+{
+	u64 start_time;
+	uint8_t cmd;
+	int n_ret = 0;
+
+	//Latency includes the wait for the mutex, which is where contending clients show up
+	start_time = ktime_get_ns();
+	cmd = data_io[0];
+
+	trace_gpioctrl_cmd_entry(cmd, data_io[1], data_io[2]);
+
+	if((cmd == __GPIO_CMD_WAIT_EVENT) && (size >= __GPIO_DATAIO_WAIT_EVENT_SIZE))
+	{
+		n_ret = _gpio_mod_wait_event((uint32_t*) data_io);
+		if(!n_ret) data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((cmd == __GPIO_CMD_SCHEDULE_WRITE) && (size >= __GPIO_DATAIO_SCHEDULE_WRITE_SIZE))
+	{
+		_gpio_mod_schedule_write((uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if(cmd == __GPIO_CMD_SCHEDULE_CANCEL)
+	{
+		_gpio_sched_cancel();
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((cmd == __GPIO_CMD_WAIT_CONDITION) && (size >= __GPIO_DATAIO_WAIT_CONDITION_SIZE))
+	{
+		n_ret = _gpio_mod_wait_condition((uint32_t*) data_io);
+		if(!n_ret) data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if(cmd == __GPIO_CMD_RING_ENTER)
+	{
+		_gpio_mod_ring_enter();
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((cmd >= __GPIO_CMD_MOTION_SETUP) && (cmd <= __GPIO_CMD_MOTION_STATUS))
+	{
+		_gpio_motion_execute(data_io, size);
+	}
+	else if((cmd == __GPIO_CMD_POLL_SET) && (pgpiofile != NULL) && (size >= __GPIO_DATAIO_POLL_SET_SIZE))
+	{
+		_gpio_mod_poll_set(pgpiofile, (const uint32_t*) data_io);
+		data_io[2] = 0U;
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((cmd == __GPIO_CMD_SUBSCRIBE) && (pgpiofile != NULL) && (size >= __GPIO_DATAIO_SUBSCRIBE_SIZE))
+	{
+		_gpio_mod_subscribe(pgpiofile, (uint32_t*) data_io);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else if((cmd == __GPIO_CMD_EVENT_READ) && (pgpiofile != NULL) && (size >= __GPIO_DATAIO_EVENT_READ_SIZE))
+	{
+		n_ret = _gpio_mod_event_read(pgpiofile, (uint32_t*) data_io);
+		if(!n_ret) data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+	}
+	else
+	{
+		mutex_lock(&_gpio_mutex);
+		if(!_gpio_batch_dispatch(pbatch, data_io, size)) _gpio_core_dispatch(data_io, size);
+		mutex_unlock(&_gpio_mutex);
+	}
+
+	trace_gpioctrl_cmd_exit(cmd, data_io[1], data_io[2]);
+
+	_gpio_stats_command(cmd, ktime_get_ns() - start_time);
+	return n_ret;
+}
+
+static ssize_t _gpio_mod_usrwrite(struct file *pfile, const char __user *usrbuf, size_t size, loff_t *poffset64)
+{
+	struct _gpio_file *pgpiofile = (struct _gpio_file*) pfile->private_data;
+	ssize_t n_ret;
+	ssize_t n_err;
+
+	if(size > __GPIO_DATAIO_SIZE_MAX) size = __GPIO_DATAIO_SIZE_MAX;
+	if(size < __GPIO_DATAIO_SIZE) size = __GPIO_DATAIO_SIZE;
+
+	n_ret = copy_from_user(pgpiofile->data_io, usrbuf, size);
+
+	n_err = _gpio_mod_execute(pgpiofile, &pgpiofile->batch, pgpiofile->data_io, size);
+	if(n_err) return n_err;
+
+	return n_ret;
+}
+
+//Commands the ring thread must not run: they sleep, their buffer does not fit in an entry, or they act on the file
+static bool _gpio_ring_cmd_allowed(uint8_t cmd)
+{
+	switch(cmd)
+	{
+		case __GPIO_CMD_WAIT_EVENT:
+		case __GPIO_CMD_WAIT_CONDITION:
+		case __GPIO_CMD_GET_CONFIG:
+		case __GPIO_CMD_CONFIGURE:
+		case __GPIO_CMD_POLL_SET:
+		case __GPIO_CMD_SUBSCRIBE:
+		case __GPIO_CMD_EVENT_READ:
+		case __GPIO_CMD_STATE_SAVE:
+		case __GPIO_CMD_STATE_RESTORE:
+		case __GPIO_CMD_MOTION_STATUS:
+			return false;
+	}
+
+	return true;
+}
+
+//Execute the submissions of a ring while its completion ring has room, returns the number executed
+//Each completion is published as soon as it is written, a submitter spinning on CQ_TAIL sees it at once
+static unsigned int _gpio_ring_drain(struct _gpio_ring *pring)
+{
+	uint32_t data_io32[__GPIO_DATAIO_SIZE_MAX/4U];
+	uint8_t *data_io = (uint8_t*) data_io32;
+	const uint32_t *psqe;
+	uint32_t *pcqe;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t tag;
+	unsigned int n_done = 0U;
+
+	sq_tail = smp_load_acquire(&pring->pheader[__GPIO_RING_SQ_TAIL]);
+	cq_head = smp_load_acquire(&pring->pheader[__GPIO_RING_CQ_HEAD]);
+
+	while((pring->sq_head != sq_tail) && ((pring->cq_tail - cq_head) < __GPIO_RING_ENTRIES))
+	{
+		psqe = &pring->psq[(pring->sq_head & (__GPIO_RING_ENTRIES - 1U))*__GPIO_RING_ENTRY_WORDS];
+		pcqe = &pring->pcq[(pring->cq_tail & (__GPIO_RING_ENTRIES - 1U))*__GPIO_RING_ENTRY_WORDS];
+
+		memset(data_io32, 0, sizeof(data_io32));
+		memcpy(data_io32, psqe, __GPIO_RING_ENTRY_PAYLOAD);
+		tag = READ_ONCE(psqe[__GPIO_RING_ENTRY_TAG]);
+
+		if(_gpio_ring_cmd_allowed(data_io[0])) _gpio_mod_execute(NULL, pring->pbatch, data_io, __GPIO_RING_ENTRY_PAYLOAD);
+		else data_io[0] = __GPIO_RING_REJECTED;
+
+		memcpy(pcqe, data_io32, __GPIO_RING_ENTRY_PAYLOAD);
+		pcqe[__GPIO_RING_ENTRY_TAG] = tag;
+
+		pring->sq_head++;
+		pring->cq_tail++;
+		n_done++;
+
+		smp_store_release(&pring->pheader[__GPIO_RING_SQ_HEAD], pring->sq_head);
+		smp_store_release(&pring->pheader[__GPIO_RING_CQ_TAIL], pring->cq_tail);
+	}
+
+	return n_done;
+}
+
+//Set or clear NEED_WAKEUP on every ring, returns true if a ring has submissions pending
+//Caller holds _gpio_ring_mutex
+static bool _gpio_ring_set_need_wakeup(bool need_wakeup)
+{
+	struct _gpio_ring *pring;
+	bool pending = false;
+
+	list_for_each_entry(pring, &_gpio_ring_list, list)
+		WRITE_ONCE(pring->pheader[__GPIO_RING_FLAGS], need_wakeup ? __GPIO_RING_FLAG_NEED_WAKEUP : 0U);
+
+	//Pairs with the submitter's barrier between publishing SQ_TAIL and reading FLAGS
+	smp_mb();
+
+	list_for_each_entry(pring, &_gpio_ring_list, list)
+		if(READ_ONCE(pring->pheader[__GPIO_RING_SQ_TAIL]) != pring->sq_head) pending = true;
+
+	return pending;
+}
+
+static int _gpio_ring_thread(void *pvoid)
+{
+	struct _gpio_ring *pring;
+	unsigned int n_done;
+	u64 idle_start;
+	bool pending;
+
+	idle_start = ktime_get_ns();
+
+	while(!kthread_should_stop())
+	{
+		n_done = 0U;
+
+		mutex_lock(&_gpio_ring_mutex);
+		list_for_each_entry(pring, &_gpio_ring_list, list) n_done += _gpio_ring_drain(pring);
+		mutex_unlock(&_gpio_ring_mutex);
+
+		if(n_done) idle_start = ktime_get_ns();
+
+		if(n_done || ((ktime_get_ns() - idle_start) < 1000ULL*_gpio_ring_idle_us))
+		{
+			cond_resched();
+			cpu_relax();
+			continue;
+		}
+
+		//Submissions made before a submitter could see NEED_WAKEUP are caught by the check after setting it
+		mutex_lock(&_gpio_ring_mutex);
+		pending = _gpio_ring_set_need_wakeup(true);
+		mutex_unlock(&_gpio_ring_mutex);
+
+		if(!pending) wait_event_interruptible(_gpio_ring_wq, (READ_ONCE(_gpio_ring_kick) || kthread_should_stop()));
+
+		WRITE_ONCE(_gpio_ring_kick, false);
+
+		mutex_lock(&_gpio_ring_mutex);
+		_gpio_ring_set_need_wakeup(false);
+		mutex_unlock(&_gpio_ring_mutex);
+
+		idle_start = ktime_get_ns();
+	}
+
+	return 0;
+}
+
+//The module pages user space maps (status page, rings) are freed at unload, so every mapping holds a module reference
+//Copies of a mapping (fork, split) take their own reference through vm_ops->open, the initial one is taken at mmap
+static void _gpio_mod_vma_open(struct vm_area_struct *vma)
+{
+	__module_get(THIS_MODULE);
+	return;
+}
+
+static void _gpio_mod_vma_close(struct vm_area_struct *vma)
+{
+	module_put(THIS_MODULE);
+	return;
+}
+
+static const struct vm_operations_struct _gpio_vm_ops = {
+	.open = &_gpio_mod_vma_open,
+	.close = &_gpio_mod_vma_close
+};
+
+static void _gpio_mod_vma_pin(struct vm_area_struct *vma)
+{
+	vma->vm_ops = &_gpio_vm_ops;
+	__module_get(THIS_MODULE);
+	return;
+}
+
+//Map the rings of the file, created on first use; new rings start with NEED_WAKEUP set
+static int _gpio_mod_ring_mmap(struct _gpio_file *pgpiofile, struct vm_area_struct *vma)
+{
+	struct _gpio_ring *pring;
+	int n_ret;
+
+	if(_gpio_ring_task == NULL) return -ENODEV;
+	if((vma->vm_end - vma->vm_start) != __GPIO_RING_MMAP_SIZE) return -EINVAL;
+
+	mutex_lock(&_gpio_ring_mutex);
+
+	pring = pgpiofile->pring;
+
+	if(pring == NULL)
+	{
+		pring = kzalloc(sizeof(struct _gpio_ring), GFP_KERNEL);
+		if(pring != NULL) pring->pheader = (uint32_t*) alloc_pages_exact(__GPIO_RING_MMAP_SIZE, GFP_KERNEL | __GFP_ZERO);
+
+		if((pring == NULL) || (pring->pheader == NULL))
+		{
+			mutex_unlock(&_gpio_ring_mutex);
+			kfree(pring);
+			return -ENOMEM;
+		}
+
+		pring->psq = &pring->pheader[__GPIO_RING_PAGE_WORDS];
+		pring->pcq = &pring->pheader[2U*__GPIO_RING_PAGE_WORDS];
+		pring->pheader[__GPIO_RING_FLAGS] = __GPIO_RING_FLAG_NEED_WAKEUP;
+		pring->pbatch = &pgpiofile->batch;
+
+		list_add_tail(&pring->list, &_gpio_ring_list);
+		pgpiofile->pring = pring;
+	}
+
+	mutex_unlock(&_gpio_ring_mutex);
+
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+	n_ret = remap_pfn_range(vma, vma->vm_start, (virt_to_phys(pring->pheader) >> PAGE_SHIFT), __GPIO_RING_MMAP_SIZE, vma->vm_page_prot);
+	if(n_ret) return n_ret;
+
+	_gpio_mod_vma_pin(vma);
+	return 0;
+}
+
+//Map the read-only status page (offset 0, at most one page) or the file's rings (offset __GPIO_RING_MMAP_OFFSET)
+static int _gpio_mod_usrmmap(struct file *pfile, struct vm_area_struct *vma)
+{
+	int n_ret;
+
+	if(vma->vm_pgoff == (__GPIO_RING_MMAP_OFFSET >> PAGE_SHIFT)) return _gpio_mod_ring_mmap((struct _gpio_file*) pfile->private_data, vma);
+
+	if(vma->vm_pgoff != 0UL) return -EINVAL;
+	if((vma->vm_end - vma->vm_start) > PAGE_SIZE) return -EINVAL;
+	if(vma->vm_flags & VM_WRITE) return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	n_ret = remap_pfn_range(vma, vma->vm_start, (virt_to_phys(_gpio_status_page) >> PAGE_SHIFT), PAGE_SIZE, vma->vm_page_prot);
+	if(n_ret) return n_ret;
+
+	_gpio_mod_vma_pin(vma);
+	return 0;
+}
+
+//Readiness for poll()/epoll, set up with POLL_SET (POLLIN also while a subscribed file has records queued)
+//Reading the file still returns the last command response
+//Watched pins that still hold their snapshot level get detection of the opposite level armed (as in WAIT_CONDITION),
+//so a change raises an interrupt and wakes the pollers
+static __poll_t _gpio_mod_usrpoll(struct file *pfile, struct poll_table_struct *pwait)
+{
+	struct _gpio_file *pgpiofile = (struct _gpio_file*) pfile->private_data;
+	uint32_t changed_level[2];
+	uint32_t level[2];
+	__poll_t mask = 0U;
+
+	poll_wait(pfile, &_gpio_event_wq, pwait);
+
+	if(_gpio_event_pending(pgpiofile->poll_event_mask[0], pgpiofile->poll_event_mask[1])) mask |= (EPOLLIN | EPOLLRDNORM);
+
+	mutex_lock(&pgpiofile->sub_mutex);
+	if(pgpiofile->subscribed && _gpio_subscriber_pending(pgpiofile->psub)) mask |= (EPOLLIN | EPOLLRDNORM);
+	mutex_unlock(&pgpiofile->sub_mutex);
+
+	if(pgpiofile->poll_level_mask[0] | pgpiofile->poll_level_mask[1])
+	{
+		changed_level[0] = (pgpiofile->poll_level_snapshot[0] ^ pgpiofile->poll_level_mask[0]);
+		changed_level[1] = (pgpiofile->poll_level_snapshot[1] ^ pgpiofile->poll_level_mask[1]);
+
+		_gpio_condition_check(pgpiofile->poll_level_mask, changed_level, level);
+
+		if(((level[0] ^ pgpiofile->poll_level_snapshot[0]) & pgpiofile->poll_level_mask[0]) ||
+			((level[1] ^ pgpiofile->poll_level_snapshot[1]) & pgpiofile->poll_level_mask[1])) mask |= EPOLLPRI;
+	}
+
+	return mask;
+}
+
+static void _gpio_mod_events_enable(void)
+{
+	struct device_node *pnode;
+	uint8_t n_bank;
+
+	pnode = of_find_compatible_node(NULL, NULL, "brcm,bcm2835-gpio");
+
+	for(n_bank = 0U; n_bank < 2U; n_bank++)
+	{
+		if((_gpio_irq[n_bank] <= 0) && (pnode != NULL)) _gpio_irq[n_bank] = irq_of_parse_and_map(pnode, n_bank);
+		if(_gpio_irq[n_bank] <= 0) continue;
+
+		if(request_irq(_gpio_irq[n_bank], &_gpio_mod_irq, IRQF_SHARED, "gpioctrl", &_gpio_irq_requested[n_bank]))
+		{
+			printk("GPIO: Warning: GPIO interrupt %d unavailable", _gpio_irq[n_bank]);
+			continue;
+		}
+
+		_gpio_irq_requested[n_bank] = true;
+	}
+
+	of_node_put(pnode);
+
+	if(_gpio_irq_requested[0] && _gpio_irq_requested[1]) return;
+
+	if(!_gpio_poll_us) _gpio_poll_us = 1U;
+
+	hrtimer_init(&_gpio_poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	_gpio_poll_timer.function = &_gpio_mod_poll;
+	_gpio_poll_active = true;
+
+	printk("GPIO: Events polled every %u us while waited on", _gpio_poll_us);
+	return;
+}
+
+static void _gpio_mod_events_disable(void)
+{
+	unsigned long flags;
+	bool poll_active;
+	uint8_t n_bank;
+
+	//No new user can start the timer once polling is inactive
+	spin_lock_irqsave(&_gpio_poll_lock, flags);
+	poll_active = _gpio_poll_active;
+	_gpio_poll_active = false;
+	_gpio_poll_users = 0U;
+	spin_unlock_irqrestore(&_gpio_poll_lock, flags);
+
+	if(poll_active) hrtimer_cancel(&_gpio_poll_timer);
+
+	for(n_bank = 0U; n_bank < 2U; n_bank++)
+	{
+		if(!_gpio_irq_requested[n_bank]) continue;
+
+		free_irq(_gpio_irq[n_bank], &_gpio_irq_requested[n_bank]);
+		_gpio_irq_requested[n_bank] = false;
+	}
+
+	return;
+}
+
+static void _gpio_mod_ring_enable(void)
+{
+	_gpio_ring_task = kthread_create(&_gpio_ring_thread, NULL, "gpioctrl_ring");
+	if(IS_ERR(_gpio_ring_task))
+	{
+		_gpio_ring_task = NULL;
+		printk("GPIO: Warning: GPIO ring thread creation failed");
+		return;
+	}
+
+	if((_gpio_ring_cpu >= 0) && cpu_online(_gpio_ring_cpu)) kthread_bind(_gpio_ring_task, _gpio_ring_cpu);
+
+	wake_up_process(_gpio_ring_task);
+	return;
+}
+
+static void _gpio_mod_ring_disable(void)
+{
+	if(_gpio_ring_task == NULL) return;
+
+	kthread_stop(_gpio_ring_task);
+	_gpio_ring_task = NULL;
+	return;
+}
+
+//Whole-register writes through _gpio_state_restore(), outputs are driven to their saved level before they become outputs
+static void _gpio_mod_profile_apply(void)
+{
+	const struct firmware *pfw = NULL;
+	uint32_t words[(__GPIO_DATAIO_STATE_SIZE - 4UL)/4UL];
+	bool loaded = false;
+
+	if(_gpio_profile_fw != NULL)
+	{
+		if(request_firmware(&pfw, _gpio_profile_fw, NULL))
+		{
+			printk("GPIO: Warning: GPIO profile firmware \"%s\" not found", _gpio_profile_fw);
+		}
+		else
+		{
+			if(pfw->size == sizeof(words))
+			{
+				memcpy(words, pfw->data, sizeof(words));
+				loaded = true;
+			}
+			else printk("GPIO: Warning: GPIO profile firmware \"%s\" has %zu bytes, expected %zu", _gpio_profile_fw, pfw->size, sizeof(words));
+
+			release_firmware(pfw);
+		}
+	}
+
+	if(!loaded && _gpio_profile_words)
+	{
+		if(_gpio_profile_words == (int) ARRAY_SIZE(_gpio_profile))
+		{
+			memcpy(words, _gpio_profile, sizeof(words));
+			loaded = true;
+		}
+		else printk("GPIO: Warning: GPIO profile has %d words, expected %zu", _gpio_profile_words, ARRAY_SIZE(_gpio_profile));
+	}
+
+	if(!loaded) return;
+
+	mutex_lock(&_gpio_mutex);
+	_gpio_state_restore(words);
+	mutex_unlock(&_gpio_mutex);
+
+	printk("GPIO: Boot profile applied");
+	return;
+}
+
+static int __init _gpio_mod_enable(void)
+{
+	_gpio_status_page = (uint32_t*) get_zeroed_page(GFP_KERNEL);
+	if(_gpio_status_page == NULL)
+	{
+		printk("GPIO: Error: GPIO status page allocation failed");
+		return -1;
+	}
+
+	_gpio_mmap = (uint32_t*) ioremap(__GPIO_BASE_ADDR, __GPIO_MMAP_SIZE);
+	if(_gpio_mmap == NULL)
+	{
+		free_page((unsigned long) _gpio_status_page);
+		_gpio_status_page = NULL;
+
+		printk("GPIO: Error: GPIO mapping failed");
+		return -1;
+	}
+
+	_gpio_core_init();
+	_gpio_mod_profile_apply();
+	_gpio_sched_init();
+	_gpio_motion_init();
+	_gpio_mod_events_enable();
+	_gpio_mod_ring_enable();
+
+	_gpio_proc = proc_create("gpioctrl", 0x1b6, NULL, &_gpio_proc_ops);
+	if(_gpio_proc == NULL)
+	{
+		_gpio_mod_ring_disable();
+		_gpio_mod_events_disable();
+		_gpio_motion_deinit();
+		_gpio_sched_deinit();
+
+		iounmap(_gpio_mmap);
+		_gpio_mmap = NULL;
+
+		free_page((unsigned long) _gpio_status_page);
+		_gpio_status_page = NULL;
+
+		printk("GPIO: Error: GPIO proc file creation failed");
+		return -1;
+	}
+
+	if(_gpio_stats_init()) printk("GPIO: Warning: GPIO stats proc file creation failed");
+
+	printk("GPIO: Module enabled");
+	return 0;
+}
+
+//Teardown runs from the outside in: sleepers are released and the proc file removed (which waits for running calls),
+//then the ring thread, event sources and timers stop, and only then is the register mapping released
+static void __exit _gpio_mod_disable(void)
+{
+	WRITE_ONCE(_gpio_shutdown, true);
+	wake_up_interruptible_all(&_gpio_event_wq);
+
+	if(_gpio_proc != NULL)
+	{
+		proc_remove(_gpio_proc);
+		_gpio_proc = NULL;
+	}
+
+	_gpio_mod_ring_disable();
+	_gpio_mod_events_disable();
+	_gpio_motion_deinit();
+	_gpio_sched_deinit();
+	_gpio_stats_deinit();
+
+	if(_gpio_mmap != NULL)
+	{
+		iounmap(_gpio_mmap);
+		_gpio_mmap = NULL;
+	}
+
+	if(_gpio_status_page != NULL)
+	{
+		free_page((unsigned long) _gpio_status_page);
+		_gpio_status_page = NULL;
+	}
+
+	printk("GPIO: Module disabled");
+	return;
+}
+
+module_init(_gpio_mod_enable);
+module_exit(_gpio_mod_disable);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Rafael Sabe");
+MODULE_DESCRIPTION("GPIO Driver (Version 2.0) for Broadcom BCM2837");
+
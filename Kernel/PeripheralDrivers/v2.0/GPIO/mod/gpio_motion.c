@@ -0,0 +1,96 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#include "gpio_motion.h"
+#include "gpio_core.h"
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+//Engine state is shared between commands and the timer
+static DEFINE_SPINLOCK(_gpio_motion_lock);
+
+static struct hrtimer _gpio_motion_timer;
+
+//Set by _gpio_motion_deinit(), commands are refused and the timer is not armed again
+static bool _gpio_motion_closed = false;
+
+static enum hrtimer_restart _gpio_motion_fire(struct hrtimer *ptimer)
+{
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	u64 next;
+
+	spin_lock_irqsave(&_gpio_motion_lock, flags);
+
+	next = _gpio_motion_run(ktime_get_ns());
+
+	//A command on another CPU may already have restarted the timer
+	if(next && !_gpio_motion_closed && !hrtimer_is_queued(ptimer))
+	{
+		hrtimer_set_expires(ptimer, ns_to_ktime(next));
+		ret = HRTIMER_RESTART;
+	}
+
+	spin_unlock_irqrestore(&_gpio_motion_lock, flags);
+	return ret;
+}
+
+void _gpio_motion_execute(uint8_t *data_io, size_t size)
+{
+	unsigned long flags;
+	u64 next;
+
+	spin_lock_irqsave(&_gpio_motion_lock, flags);
+
+	if(_gpio_motion_closed)
+	{
+		spin_unlock_irqrestore(&_gpio_motion_lock, flags);
+		data_io[0] = __GPIO_CMD_KERNEL_RESPONSE;
+		data_io[2] = 0u;
+		return;
+	}
+
+	next = _gpio_motion_dispatch(data_io, size, ktime_get_ns());
+
+	//Only an earlier edge moves the timer, a later one is picked up when it fires
+	if(next && (!hrtimer_is_queued(&_gpio_motion_timer) || (ktime_to_ns(hrtimer_get_expires(&_gpio_motion_timer)) > next)))
+		hrtimer_start(&_gpio_motion_timer, ns_to_ktime(next), HRTIMER_MODE_ABS);
+
+	spin_unlock_irqrestore(&_gpio_motion_lock, flags);
+	return;
+}
+
+void _gpio_motion_init(void)
+{
+	hrtimer_init(&_gpio_motion_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	_gpio_motion_timer.function = &_gpio_motion_fire;
+	return;
+}
+
+//Stop every axis before the timer goes away, a pulse in progress is ended
+//Runs after the proc entry is removed, the STOP goes to the engine directly since commands are refused from here on
+void _gpio_motion_deinit(void)
+{
+	uint32_t data_io32[__GPIO_DATAIO_MOTION_STOP_SIZE/4U] = {0U, 0xffffffffU, 0U};
+	uint8_t *data_io = (uint8_t*) data_io32;
+	unsigned long flags;
+
+	data_io[0] = __GPIO_CMD_MOTION_STOP;
+
+	spin_lock_irqsave(&_gpio_motion_lock, flags);
+	_gpio_motion_closed = true;
+	spin_unlock_irqrestore(&_gpio_motion_lock, flags);
+
+	hrtimer_cancel(&_gpio_motion_timer);
+
+	spin_lock_irqsave(&_gpio_motion_lock, flags);
+	_gpio_motion_dispatch(data_io, __GPIO_DATAIO_MOTION_STOP_SIZE, ktime_get_ns());
+	spin_unlock_irqrestore(&_gpio_motion_lock, flags);
+	return;
+}
@@ -0,0 +1,22 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+//Stepper motion engine (gpio_core.c) run from an hrtimer, one edge per axis per expiry
+
+#ifndef GPIO_MOTION_H
+#define GPIO_MOTION_H
+
+#include <linux/types.h>
+
+void _gpio_motion_init(void);
+void _gpio_motion_deinit(void);
+
+//Execute a MOTION_* command held in a command buffer, size is the byte count received, the response replaces the command
+//Every command is refused (accepted flag 0) once _gpio_motion_deinit() has run
+void _gpio_motion_execute(uint8_t *data_io, size_t size);
+
+#endif //GPIO_MOTION_H
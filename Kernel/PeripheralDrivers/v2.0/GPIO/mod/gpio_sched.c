@@ -0,0 +1,171 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#include "gpio_sched.h"
+#include "gpio_core.h"
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/timerqueue.h>
+
+struct _gpio_sched_entry {
+	struct timerqueue_node node;
+	uint32_t set[2];
+	uint32_t clr[2];
+};
+
+static unsigned int _gpio_sched_coalesce_ns = 2000U;
+module_param_named(sched_coalesce_ns, _gpio_sched_coalesce_ns, uint, 0644);
+MODULE_PARM_DESC(sched_coalesce_ns, "Scheduled writes may be applied up to this late, so writes due within the window go out in one register write per bank (default 2000)");
+
+static unsigned int _gpio_sched_max = 1024U;
+module_param_named(sched_max, _gpio_sched_max, uint, 0444);
+MODULE_PARM_DESC(sched_max, "Maximum number of pending scheduled writes (default 1024)");
+
+static struct timerqueue_head _gpio_sched_queue;
+static unsigned int _gpio_sched_count = 0U;
+static DEFINE_SPINLOCK(_gpio_sched_lock);
+
+//Set under the lock at deinit, no write is queued (and the timer never armed) after it
+static bool _gpio_sched_closed = false;
+
+static struct hrtimer _gpio_sched_timer;
+
+//Merge every write already due in time order, a later write to a pin overrides an earlier one
+//Within a single write, clear wins over set (same order as _gpio_set_bankmask)
+//The timer is armed with the coalescing window as slack: it fires between the earliest due time and the end of the window,
+//so writes coalesce by being delayed, never by going out early
+static enum hrtimer_restart _gpio_sched_fire(struct hrtimer *ptimer)
+{
+	struct timerqueue_node *pnode;
+	struct _gpio_sched_entry *pentry;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	uint32_t set[2] = {0U, 0U};
+	uint32_t clr[2] = {0U, 0U};
+	unsigned long flags;
+	u64 limit;
+	uint8_t n_bank;
+
+	limit = ktime_get_ns();
+
+	spin_lock_irqsave(&_gpio_sched_lock, flags);
+
+	while((pnode = timerqueue_getnext(&_gpio_sched_queue)) != NULL)
+	{
+		if(ktime_to_ns(pnode->expires) > limit) break;
+
+		timerqueue_del(&_gpio_sched_queue, pnode);
+		pentry = container_of(pnode, struct _gpio_sched_entry, node);
+
+		for(n_bank = 0U; n_bank < 2U; n_bank++)
+		{
+			set[n_bank] = (set[n_bank] & ~pentry->clr[n_bank]) | (pentry->set[n_bank] & ~pentry->clr[n_bank]);
+			clr[n_bank] = (clr[n_bank] & ~pentry->set[n_bank]) | pentry->clr[n_bank];
+		}
+
+		kfree(pentry);
+		_gpio_sched_count--;
+	}
+
+	//A write queued on another CPU may already have restarted the timer
+	if((pnode != NULL) && !hrtimer_is_queued(ptimer))
+	{
+		hrtimer_set_expires_range_ns(ptimer, pnode->expires, _gpio_sched_coalesce_ns);
+		ret = HRTIMER_RESTART;
+	}
+
+	spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+
+	//SET/CLR registers have no shared state, no command lock needed
+	_gpio_set_bankmask(set[0], clr[0], set[1], clr[1]);
+	return ret;
+}
+
+int _gpio_sched_write(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1, u64 time_ns)
+{
+	struct _gpio_sched_entry *pentry;
+	unsigned long flags;
+
+	pentry = kmalloc(sizeof(struct _gpio_sched_entry), GFP_KERNEL);
+	if(pentry == NULL) return -ENOMEM;
+
+	timerqueue_init(&pentry->node);
+	pentry->node.expires = ns_to_ktime(time_ns);
+	pentry->set[0] = set0;
+	pentry->clr[0] = clr0;
+	pentry->set[1] = (set1 & __GPIO_BANK1_MASK);
+	pentry->clr[1] = (clr1 & __GPIO_BANK1_MASK);
+
+	spin_lock_irqsave(&_gpio_sched_lock, flags);
+
+	if(_gpio_sched_closed)
+	{
+		spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+		kfree(pentry);
+		return -ENODEV;
+	}
+
+	if(_gpio_sched_count >= _gpio_sched_max)
+	{
+		spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+		kfree(pentry);
+		return -ENOSPC;
+	}
+
+	_gpio_sched_count++;
+
+	//Only a new earliest write moves the timer
+	if(timerqueue_add(&_gpio_sched_queue, &pentry->node)) hrtimer_start_range_ns(&_gpio_sched_timer, pentry->node.expires, _gpio_sched_coalesce_ns, HRTIMER_MODE_ABS);
+
+	spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+	return 0;
+}
+
+void _gpio_sched_cancel(void)
+{
+	struct timerqueue_node *pnode;
+	unsigned long flags;
+
+	spin_lock_irqsave(&_gpio_sched_lock, flags);
+
+	while((pnode = timerqueue_getnext(&_gpio_sched_queue)) != NULL)
+	{
+		timerqueue_del(&_gpio_sched_queue, pnode);
+		kfree(container_of(pnode, struct _gpio_sched_entry, node));
+	}
+
+	_gpio_sched_count = 0U;
+
+	spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+	return;
+}
+
+void _gpio_sched_init(void)
+{
+	timerqueue_init_head(&_gpio_sched_queue);
+	_gpio_sched_closed = false;
+
+	hrtimer_init(&_gpio_sched_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	_gpio_sched_timer.function = &_gpio_sched_fire;
+	return;
+}
+
+void _gpio_sched_deinit(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&_gpio_sched_lock, flags);
+	_gpio_sched_closed = true;
+	spin_unlock_irqrestore(&_gpio_sched_lock, flags);
+
+	hrtimer_cancel(&_gpio_sched_timer);
+	_gpio_sched_cancel();
+	return;
+}
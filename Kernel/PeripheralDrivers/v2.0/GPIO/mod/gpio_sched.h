@@ -0,0 +1,27 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+//Output writes scheduled at absolute CLOCK_MONOTONIC times, applied from an hrtimer
+//Pending writes are kept in a timerqueue (time ordered), a write may go out up to the coalescing window late (never early),
+//so writes due within the window go out together
+
+#ifndef GPIO_SCHED_H
+#define GPIO_SCHED_H
+
+#include <linux/types.h>
+
+void _gpio_sched_init(void);
+void _gpio_sched_deinit(void);
+
+//Queue a write of the OUTPUTx_SET/OUTPUTx_CLR masks at time_ns (past times are applied at once)
+//Returns 0 if queued, -ENOSPC if the queue is full, -ENOMEM if allocation failed, -ENODEV after _gpio_sched_deinit()
+int _gpio_sched_write(uint32_t set0, uint32_t clr0, uint32_t set1, uint32_t clr1, u64 time_ns);
+
+//Drop every pending write
+void _gpio_sched_cancel(void);
+
+#endif //GPIO_SCHED_H
@@ -0,0 +1,196 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+#include "gpio_stats.h"
+#include "gpio_core.h"
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#define __GPIO_STATS_CMD_INVALID __GPIO_CMD_COUNT
+
+struct _gpio_stats_cpu {
+	u64 cmd_count[__GPIO_CMD_COUNT + 1U];
+	u64 cmd_hist[__GPIO_CMD_COUNT + 1U][__GPIO_STATS_HIST_BUCKETS];
+	u64 irq_count;
+};
+
+static DEFINE_PER_CPU(struct _gpio_stats_cpu, _gpio_stats_percpu);
+
+static atomic_t _gpio_stats_queue_hwm = ATOMIC_INIT(0);
+
+static struct proc_dir_entry *_gpio_stats_proc = NULL;
+
+static const char *_gpio_stats_cmd_names[__GPIO_CMD_COUNT + 1U] = {
+	"reset_pin",
+	"set_level",
+	"get_level",
+	"set_pinmode",
+	"get_pinmode",
+	"set_pudctrl",
+	"get_eventdetected",
+	"set_enable_redgedetect",
+	"get_enable_redgedetect",
+	"set_enable_fedgedetect",
+	"get_enable_fedgedetect",
+	"set_enable_async_redgedetect",
+	"get_enable_async_redgedetect",
+	"set_enable_async_fedgedetect",
+	"get_enable_async_fedgedetect",
+	"set_enable_highdetect",
+	"get_enable_highdetect",
+	"set_enable_lowdetect",
+	"get_enable_lowdetect",
+	"set_bankmask",
+	"get_banklevel",
+	"get_pudctrl",
+	"get_config",
+	"configure",
+	"wait_event",
+	"schedule_write",
+	"schedule_cancel",
+	"wait_condition",
+	"ring_enter",
+	"poll_set",
+	"subscribe",
+	"event_read",
+	"state_save",
+	"state_restore",
+	"write_begin",
+	"write_commit",
+	"motion_setup",
+	"motion_move",
+	"motion_start",
+	"motion_stop",
+	"motion_status",
+	"invalid"
+};
+
+static int _gpio_stats_usropen(struct inode *pinode, struct file *pfile);
+static ssize_t _gpio_stats_usrwrite(struct file *pfile, const char __user *usrbuf, size_t size, loff_t *poffset64);
+
+static const struct proc_ops _gpio_stats_proc_ops = {
+	.proc_open = &_gpio_stats_usropen,
+	.proc_read = &seq_read,
+	.proc_lseek = &seq_lseek,
+	.proc_release = &single_release,
+	.proc_write = &_gpio_stats_usrwrite
+};
+
+void _gpio_stats_command(uint8_t cmd, u64 time_ns)
+{
+	uint8_t bucket;
+
+	if(cmd >= __GPIO_CMD_COUNT) cmd = __GPIO_STATS_CMD_INVALID;
+
+	bucket = time_ns ? ilog2(time_ns) : 0U;
+	if(bucket >= __GPIO_STATS_HIST_BUCKETS) bucket = __GPIO_STATS_HIST_BUCKETS - 1U;
+
+	this_cpu_inc(_gpio_stats_percpu.cmd_count[cmd]);
+	this_cpu_inc(_gpio_stats_percpu.cmd_hist[cmd][bucket]);
+	return;
+}
+
+void _gpio_stats_irq(void)
+{
+	this_cpu_inc(_gpio_stats_percpu.irq_count);
+	return;
+}
+
+void _gpio_stats_queue_level(uint32_t level)
+{
+	int hwm;
+
+	hwm = atomic_read(&_gpio_stats_queue_hwm);
+	while(level > (uint32_t) hwm)
+		if(atomic_try_cmpxchg(&_gpio_stats_queue_hwm, &hwm, (int) level)) break;
+
+	return;
+}
+
+//Sums every CPU at read time, counters still moving on other CPUs may be off by the calls in flight
+static int _gpio_stats_show(struct seq_file *pseq, void *pvoid)
+{
+	u64 count;
+	u64 irq_count = 0U;
+	int cpu;
+	uint8_t cmd;
+	uint8_t bucket;
+
+	for_each_possible_cpu(cpu) irq_count += per_cpu_ptr(&_gpio_stats_percpu, cpu)->irq_count;
+
+	seq_printf(pseq, "irq_count %llu\n", irq_count);
+	seq_printf(pseq, "queue_hwm %d\n", atomic_read(&_gpio_stats_queue_hwm));
+	seq_printf(pseq, "#command count hist_log2_ns[0..%u]\n", __GPIO_STATS_HIST_BUCKETS - 1U);
+
+	for(cmd = 0U; cmd <= __GPIO_STATS_CMD_INVALID; cmd++)
+	{
+		count = 0U;
+		for_each_possible_cpu(cpu) count += per_cpu_ptr(&_gpio_stats_percpu, cpu)->cmd_count[cmd];
+
+		seq_printf(pseq, "%s %llu", _gpio_stats_cmd_names[cmd], count);
+
+		for(bucket = 0U; bucket < __GPIO_STATS_HIST_BUCKETS; bucket++)
+		{
+			count = 0U;
+			for_each_possible_cpu(cpu) count += per_cpu_ptr(&_gpio_stats_percpu, cpu)->cmd_hist[cmd][bucket];
+
+			seq_printf(pseq, " %llu", count);
+		}
+
+		seq_putc(pseq, '\n');
+	}
+
+	return 0;
+}
+
+static int _gpio_stats_usropen(struct inode *pinode, struct file *pfile)
+{
+	return single_open(pfile, &_gpio_stats_show, NULL);
+}
+
+//Counters updated while the reset runs may survive it
+static ssize_t _gpio_stats_usrwrite(struct file *pfile, const char __user *usrbuf, size_t size, loff_t *poffset64)
+{
+	char buf[8];
+	int cpu;
+
+	if(size > (sizeof(buf) - 1U)) return -EINVAL;
+	if(copy_from_user(buf, usrbuf, size)) return -EFAULT;
+
+	buf[size] = '\0';
+	if(strcmp(strim(buf), "reset")) return -EINVAL;
+
+	for_each_possible_cpu(cpu) memset(per_cpu_ptr(&_gpio_stats_percpu, cpu), 0, sizeof(struct _gpio_stats_cpu));
+
+	atomic_set(&_gpio_stats_queue_hwm, 0);
+	return size;
+}
+
+int _gpio_stats_init(void)
+{
+	_gpio_stats_proc = proc_create("gpioctrl_stats", 0x1a4, NULL, &_gpio_stats_proc_ops);
+	if(_gpio_stats_proc == NULL) return -ENOMEM;
+
+	return 0;
+}
+
+void _gpio_stats_deinit(void)
+{
+	if(_gpio_stats_proc != NULL)
+	{
+		proc_remove(_gpio_stats_proc);
+		_gpio_stats_proc = NULL;
+	}
+
+	return;
+}
@@ -0,0 +1,31 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+//Driver statistics, exported through /proc/gpioctrl_stats
+//Counters are per CPU and updated without locks, the proc file sums them on read
+//Writing "reset" to the proc file clears every counter
+
+#ifndef GPIO_STATS_H
+#define GPIO_STATS_H
+
+#include <linux/types.h>
+
+//Latency buckets, bucket n counts calls that took [2^n, 2^(n + 1)) ns, the last bucket also takes anything longer
+#define __GPIO_STATS_HIST_BUCKETS 32U
+
+int _gpio_stats_init(void);
+void _gpio_stats_deinit(void);
+
+//Account one command, unknown command bytes are counted together
+void _gpio_stats_command(uint8_t cmd, u64 time_ns);
+
+void _gpio_stats_irq(void);
+
+//Report the current event queue fill level, the highest level seen is kept
+void _gpio_stats_queue_level(uint32_t level);
+
+#endif //GPIO_STATS_H
@@ -0,0 +1,97 @@
+/*
+ * Broadcom BCM2837 GPIO Driver Version 2.0
+ *
+ * Author: Rafael Sabe
+ * Email: rafaelmsabe@gmail.com
+ */
+
+//Tracepoints, enabled at runtime through ftrace/perf (events/gpioctrl/*)
+//Defined in gpio_main.c (CREATE_TRACE_POINTS), usable from any unit of the module
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gpioctrl
+
+#if !defined(GPIO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define GPIO_TRACE_H
+
+#include <linux/tracepoint.h>
+
+//Command bytes as received (entry) and as returned to userspace (exit)
+DECLARE_EVENT_CLASS(gpioctrl_cmd,
+
+	TP_PROTO(uint8_t cmd, uint8_t pin, uint8_t value),
+
+	TP_ARGS(cmd, pin, value),
+
+	TP_STRUCT__entry(
+		__field(uint8_t, cmd)
+		__field(uint8_t, pin)
+		__field(uint8_t, value)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->pin = pin;
+		__entry->value = value;
+	),
+
+	TP_printk("cmd=%u pin=%u value=%u", __entry->cmd, __entry->pin, __entry->value)
+);
+
+DEFINE_EVENT(gpioctrl_cmd, gpioctrl_cmd_entry,
+	TP_PROTO(uint8_t cmd, uint8_t pin, uint8_t value),
+	TP_ARGS(cmd, pin, value)
+);
+
+DEFINE_EVENT(gpioctrl_cmd, gpioctrl_cmd_exit,
+	TP_PROTO(uint8_t cmd, uint8_t pin, uint8_t value),
+	TP_ARGS(cmd, pin, value)
+);
+
+//Pending event detect status of both banks when the interrupt is taken
+TRACE_EVENT(gpioctrl_irq,
+
+	TP_PROTO(uint32_t pending0, uint32_t pending1),
+
+	TP_ARGS(pending0, pending1),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, pending0)
+		__field(uint32_t, pending1)
+	),
+
+	TP_fast_assign(
+		__entry->pending0 = pending0;
+		__entry->pending1 = pending1;
+	),
+
+	TP_printk("pending0=0x%08x pending1=0x%08x", __entry->pending0, __entry->pending1)
+);
+
+TRACE_EVENT(gpioctrl_mmio_write,
+
+	TP_PROTO(uint32_t regindex32, uint32_t value),
+
+	TP_ARGS(regindex32, value),
+
+	TP_STRUCT__entry(
+		__field(uint32_t, regindex32)
+		__field(uint32_t, value)
+	),
+
+	TP_fast_assign(
+		__entry->regindex32 = regindex32;
+		__entry->value = value;
+	),
+
+	TP_printk("reg=0x%02x value=0x%08x", (__entry->regindex32 << 2), __entry->value)
+);
+
+#endif //GPIO_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gpio_trace
+
+#include <trace/define_trace.h>
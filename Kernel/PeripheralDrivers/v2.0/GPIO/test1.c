@@ -6,15 +6,13 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <time.h>
 
 #include "gpio.h"
 
 #define TEST_PIN 12U
-#define DELAYTIME_US 200000UL
+#define HALF_PERIOD_NS 200000000ULL
 
 void loop(void);
-void delay_us(unsigned long time_us);
 
 void main(void)
 {
@@ -33,23 +31,22 @@ void main(void)
 	return;
 }
 
+//Edges are paced on absolute times, so the period does not drift with the call latency
 void loop(void)
 {
+	uint64_t next_time = gpio_time_ns();
+
 	while(true)
 	{
 		gpio_set_level(TEST_PIN, true);
-		delay_us(DELAYTIME_US);
+		next_time += HALF_PERIOD_NS;
+		gpio_sleep_until(next_time);
+
 		gpio_set_level(TEST_PIN, false);
-		delay_us(DELAYTIME_US);
+		next_time += HALF_PERIOD_NS;
+		gpio_sleep_until(next_time);
 	}
 
 	return;
 }
 
-void delay_us(unsigned long time_us)
-{
-	clock_t start_time = clock();
-	while(clock() < (start_time + time_us));
-	return;
-}
-
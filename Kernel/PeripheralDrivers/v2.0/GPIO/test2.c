@@ -6,7 +6,6 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <time.h>
 
 #include "gpio.h"
 
@@ -20,9 +19,20 @@
 
 uint8_t b = 0u;
 
+const uint8_t led_pins[] = {LED0_PIN, LED1_PIN, LED2_PIN, LED3_PIN};
+gpio_port_t led_port;
+
+const gpio_pin_cfg pin_cfgs[] = {
+	{LED0_PIN, GPIO_PINMODE_OUTPUT, GPIO_PUDCTRL_NOPULL, 0u},
+	{LED1_PIN, GPIO_PINMODE_OUTPUT, GPIO_PUDCTRL_NOPULL, 0u},
+	{LED2_PIN, GPIO_PINMODE_OUTPUT, GPIO_PUDCTRL_NOPULL, 0u},
+	{LED3_PIN, GPIO_PINMODE_OUTPUT, GPIO_PUDCTRL_NOPULL, 0u},
+	{BUTTON0_PIN, GPIO_PINMODE_INPUT, GPIO_PUDCTRL_PULLUP, 0u},
+	{BUTTON1_PIN, GPIO_PINMODE_INPUT, GPIO_PUDCTRL_PULLUP, 0u}
+};
+
 void loop(void);
 void led_update(void);
-void delay_us(unsigned long time_us);
 
 void main(void)
 {
@@ -32,6 +42,7 @@ void main(void)
 		return;
 	}
 
+	//Resetting clears event status left pending by a previous user of the pins
 	gpio_reset_pin(LED0_PIN);
 	gpio_reset_pin(LED1_PIN);
 	gpio_reset_pin(LED2_PIN);
@@ -39,15 +50,14 @@ void main(void)
 	gpio_reset_pin(BUTTON0_PIN);
 	gpio_reset_pin(BUTTON1_PIN);
 
-	gpio_set_pinmode(LED0_PIN, GPIO_PINMODE_OUTPUT);
-	gpio_set_pinmode(LED1_PIN, GPIO_PINMODE_OUTPUT);
-	gpio_set_pinmode(LED2_PIN, GPIO_PINMODE_OUTPUT);
-	gpio_set_pinmode(LED3_PIN, GPIO_PINMODE_OUTPUT);
-	gpio_set_pinmode(BUTTON0_PIN, GPIO_PINMODE_INPUT);
-	gpio_set_pinmode(BUTTON1_PIN, GPIO_PINMODE_INPUT);
+	gpio_configure(pin_cfgs, 6u);
 
-	gpio_set_pudctrl(BUTTON0_PIN, GPIO_PUDCTRL_PULLUP);
-	gpio_set_pudctrl(BUTTON1_PIN, GPIO_PUDCTRL_PULLUP);
+	if(!gpio_port_init(&led_port, led_pins, 4u))
+	{
+		printf("GPIO PORT INIT ERROR\n");
+		gpio_deinit();
+		return;
+	}
 
 	printf("Running...\n");
 	loop();
@@ -64,7 +74,8 @@ void loop(void)
 			b--;
 			led_update();
 
-			while(!gpio_get_level(BUTTON0_PIN)) delay_us(1024ul);
+			//Sleep until released
+			gpio_wait_condition((1ULL << BUTTON0_PIN), (1ULL << BUTTON0_PIN), UINT64_MAX);
 		}
 
 		if(!gpio_get_level(BUTTON1_PIN))
@@ -72,10 +83,11 @@ void loop(void)
 			b++;
 			led_update();
 
-			while(!gpio_get_level(BUTTON1_PIN)) delay_us(1024ul);
+			//Sleep until released
+			gpio_wait_condition((1ULL << BUTTON1_PIN), (1ULL << BUTTON1_PIN), UINT64_MAX);
 		}
 
-		delay_us(16384ul);
+		gpio_delay_ns(16384000ULL);
 	}
 
 	return;
@@ -83,17 +95,7 @@ void loop(void)
 
 void led_update(void)
 {
-	gpio_set_level(LED3_PIN, (b & 0x8));
-	gpio_set_level(LED2_PIN, (b & 0x4));
-	gpio_set_level(LED1_PIN, (b & 0x2));
-	gpio_set_level(LED0_PIN, (b & 0x1));
-	return;
-}
-
-void delay_us(unsigned long time_us)
-{
-	clock_t start_time = clock();
-	while(clock() < (start_time + time_us));
+	gpio_port_write(&led_port, (b & 0xf));
 	return;
 }
 
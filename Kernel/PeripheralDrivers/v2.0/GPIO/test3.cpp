@@ -0,0 +1,45 @@
+/*
+ * GPIO Driver Test 3: C++ Interface
+ */
+
+#include <cstdio>
+
+#include "gpio.hpp"
+
+#define DELAYTIME_NS 200000000ULL
+
+using Led = gpio::OutputPin<12>;
+using LedPort = gpio::OutputPort<12, 13, 16, 17>;
+using Buttons = gpio::InputPort<5, 6>;
+
+void loop(void);
+
+int main(void)
+{
+	if(!gpio_init())
+	{
+		printf("GPIO INIT ERROR\n");
+		return 1;
+	}
+
+	LedPort::configure();
+	Buttons::configure(gpio::Pull::Up);
+
+	printf("Running...\n");
+	loop();
+
+	return 0;
+}
+
+void loop(void)
+{
+	while(true)
+	{
+		LedPort::write(Buttons::read() ^ 0x3);
+		gpio_delay_ns(DELAYTIME_NS);
+		Led::set();
+		gpio_delay_ns(DELAYTIME_NS);
+	}
+
+	return;
+}
@@ -0,0 +1,69 @@
+/*
+ * GPIO Driver Test 4: Simulator
+ * Runs without the kernel module or a Raspberry Pi
+ * A script toggles a simulated button on TEST_INPUT_PIN, its edges are mirrored on TEST_OUTPUT_PIN
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio.h"
+#include "gpio_sim.h"
+
+#define TEST_INPUT_PIN 17U
+#define TEST_OUTPUT_PIN 12U
+
+//Edges far enough apart for the loop to take each falling edge on its own, two pending edges latch as one event
+const gpio_sim_event_t button_script[] = {
+	{20000000ull, TEST_INPUT_PIN, false},
+	{40000000ull, TEST_INPUT_PIN, true},
+	{60000000ull, TEST_INPUT_PIN, false},
+	{80000000ull, TEST_INPUT_PIN, true}
+};
+
+#define N_SCRIPT_EVENTS (sizeof(button_script)/sizeof(gpio_sim_event_t))
+
+int main(void)
+{
+	uint32_t n_events = 0u;
+	bool level;
+
+	if(!gpio_init_sim())
+	{
+		printf("GPIO INIT ERROR\n");
+		return 1;
+	}
+
+	gpio_set_pinmode(TEST_OUTPUT_PIN, GPIO_PINMODE_OUTPUT);
+	gpio_set_pinmode(TEST_INPUT_PIN, GPIO_PINMODE_INPUT);
+	gpio_set_pudctrl(TEST_INPUT_PIN, GPIO_PUDCTRL_PULLUP);
+	gpio_enable_fedge_detect(TEST_INPUT_PIN, true);
+
+	if(!gpio_get_level(TEST_INPUT_PIN)) printf("Pull up not applied\n");
+
+	gpio_sim_play(button_script, N_SCRIPT_EVENTS);
+
+	while(n_events < 2u)
+	{
+		if(!gpio_wait_event((1ull << TEST_INPUT_PIN), 1000000u, NULL))
+		{
+			printf("Falling edge missed\n");
+			break;
+		}
+
+		n_events++;
+		level = gpio_get_level(TEST_OUTPUT_PIN);
+		gpio_set_level(TEST_OUTPUT_PIN, !level);
+
+		printf("Falling edge %u, output %u\n", n_events, (unsigned int) !level);
+	}
+
+	gpio_sim_wait();
+
+	printf("Input level %u, output level %u\n", (unsigned int) gpio_get_level(TEST_INPUT_PIN), (unsigned int) gpio_get_level(TEST_OUTPUT_PIN));
+
+	gpio_deinit();
+	return 0;
+}
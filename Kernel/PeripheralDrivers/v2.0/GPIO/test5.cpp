@@ -0,0 +1,101 @@
+/*
+ * GPIO Driver Test 5: C++ Coroutine Interface
+ * Runs on the simulator, without the kernel module or a Raspberry Pi
+ * TEST_OUTPUT_PIN is wired to TEST_INPUT_PIN, one thread runs the blinker, the edge counter, the button and N_TIMERS timers
+ */
+
+#include <cstdio>
+
+#include "gpio_co.hpp"
+#include "gpio_sim.h"
+
+#define TEST_OUTPUT_PIN 12U
+#define TEST_INPUT_PIN 13U
+#define TEST_BUTTON_PIN 5U
+
+#define N_BLINKS 5U
+#define BLINK_PERIOD_NS 2000000ULL
+
+#define N_TIMERS 200U
+
+const gpio_sim_event_t button_script[] = {
+	{20000000ull, TEST_BUTTON_PIN, false},
+	{30000000ull, TEST_BUTTON_PIN, true}
+};
+
+#define N_SCRIPT_EVENTS (sizeof(button_script)/sizeof(gpio_sim_event_t))
+
+unsigned int n_timers_done = 0u;
+
+gpio::Task blinker(void)
+{
+	uint64_t t = gpio_time_ns() + BLINK_PERIOD_NS;
+
+	for(unsigned int n = 0u; n < N_BLINKS; n++)
+	{
+		co_await gpio::write_at((1ULL << TEST_OUTPUT_PIN), 0u, t);
+		t += BLINK_PERIOD_NS/2u;
+
+		co_await gpio::write_at(0u, (1ULL << TEST_OUTPUT_PIN), t);
+		t += BLINK_PERIOD_NS/2u;
+	}
+}
+
+gpio::Task edge_counter(void)
+{
+	gpio_event_t event;
+
+	for(unsigned int n = 1u; n <= N_BLINKS; n++)
+	{
+		event = co_await gpio::edge(TEST_INPUT_PIN, gpio::Rising);
+		printf("Rising edge %u, resumed %llu ns after the interrupt\n", n, (unsigned long long) (gpio_time_ns() - event.irq_time_ns));
+	}
+}
+
+gpio::Task button(void)
+{
+	co_await gpio::level((1ULL << TEST_BUTTON_PIN), 0u);
+	printf("Button pressed\n");
+
+	co_await gpio::edge(TEST_BUTTON_PIN, gpio::Rising);
+	printf("Button released\n");
+}
+
+gpio::Task timer(unsigned int n)
+{
+	co_await gpio::sleep_until(gpio_time_ns() + 10000ULL*n);
+	n_timers_done++;
+}
+
+int main(void)
+{
+	gpio::Loop loop;
+
+	if(!gpio_init_sim())
+	{
+		printf("GPIO INIT ERROR\n");
+		return 1;
+	}
+
+	gpio_set_pinmode(TEST_OUTPUT_PIN, GPIO_PINMODE_OUTPUT);
+	gpio_set_pinmode(TEST_INPUT_PIN, GPIO_PINMODE_INPUT);
+	gpio_set_pinmode(TEST_BUTTON_PIN, GPIO_PINMODE_INPUT);
+	gpio_set_pudctrl(TEST_BUTTON_PIN, GPIO_PUDCTRL_PULLUP);
+	gpio_sim_connect(TEST_OUTPUT_PIN, TEST_INPUT_PIN);
+
+	loop.spawn(blinker());
+	loop.spawn(edge_counter());
+	loop.spawn(button());
+	for(unsigned int n = 0u; n < N_TIMERS; n++) loop.spawn(timer(n));
+
+	gpio_sim_play(button_script, N_SCRIPT_EVENTS);
+
+	if(!loop.run()) printf("Loop setup failed\n");
+
+	gpio_sim_wait();
+
+	printf("Timers done: %u/%u\n", n_timers_done, N_TIMERS);
+
+	gpio_deinit();
+	return 0;
+}